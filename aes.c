@@ -0,0 +1,385 @@
+/**
+ *  NetNuke - Erases all storage media deteced by the system
+ *  Copyright (C) 2009  Joseph Hunkeler <jhunkeler@gmail.com, jhunk@stsci.edu>
+ *
+ *  This file is part of NetNuke.
+ *
+ *  NetNuke is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  NetNuke is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with NetNuke.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * AES-CTR cryptographic random stream
+ *
+ * The stream is the AES-128 or AES-256 keystream of a counter block made
+ * of an 8 byte nonce followed by a 64-bit big-endian block number.  The
+ * block number is simply the byte offset divided by 16, so like the
+ * xoshiro stream any offset of a device can be regenerated from the key
+ * and nonce alone.
+ *
+ * AES-NI is used when the CPU has it; otherwise a table driven software
+ * implementation produces the exact same bytes, only slower.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#ifdef __linux__
+   #include <sys/random.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+   #include <immintrin.h>
+   #define AES_HAVE_NI
+#endif
+
+#include "netnuke.h"
+
+/* Counter blocks encrypted per AES-NI loop, enough to hide the latency
+ * of the aesenc instruction */
+#define AES_PARALLEL 8
+
+static const uint8_t sbox[256] = {
+   0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+   0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+   0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+   0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+   0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+   0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+   0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+   0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+   0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+   0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+   0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+   0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+   0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+   0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+   0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+   0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16
+};
+
+static uint32_t Te[4][256];
+static void (*aes_blocks)(const aesctr_t *aes, uint64_t block, uint64_t count, uint8_t *out) = NULL;
+static const char *aes_name = "software";
+static pthread_once_t aes_once = PTHREAD_ONCE_INIT;
+
+#define GETU32(p) (((uint32_t)(p)[0] << 24) | ((uint32_t)(p)[1] << 16) | ((uint32_t)(p)[2] << 8) | (uint32_t)(p)[3])
+#define PUTU32(p, v) do { (p)[0] = (uint8_t)((v) >> 24); (p)[1] = (uint8_t)((v) >> 16); \
+                          (p)[2] = (uint8_t)((v) >> 8); (p)[3] = (uint8_t)(v); } while(0)
+
+static inline uint32_t ror32(uint32_t x, int k)
+{
+   return (x >> k) | (x << (32 - k));
+}
+
+static inline uint32_t subword(uint32_t w)
+{
+   return ((uint32_t)sbox[w >> 24] << 24) | ((uint32_t)sbox[(w >> 16) & 0xff] << 16) |
+          ((uint32_t)sbox[(w >> 8) & 0xff] << 8) | (uint32_t)sbox[w & 0xff];
+}
+
+/* Counter block for a given block number */
+static inline void aes_counter(const aesctr_t *aes, uint64_t block, uint8_t out[16])
+{
+   int i;
+
+   memcpy(out, aes->nonce, sizeof(aes->nonce));
+   for(i = 0; i < 8; i++)
+      out[15 - i] = (uint8_t)(block >> (i * 8));
+}
+
+static void aes_blocks_soft(const aesctr_t *aes, uint64_t block, uint64_t count, uint8_t *out)
+{
+   const uint32_t *rk;
+   uint8_t ctr[16];
+   uint32_t s0, s1, s2, s3, t0, t1, t2, t3;
+   int round;
+
+   while(count-- > 0)
+   {
+      rk = aes->rk;
+      aes_counter(aes, block++, ctr);
+
+      s0 = GETU32(ctr) ^ rk[0];
+      s1 = GETU32(ctr + 4) ^ rk[1];
+      s2 = GETU32(ctr + 8) ^ rk[2];
+      s3 = GETU32(ctr + 12) ^ rk[3];
+
+      for(round = 1; round < aes->rounds; round++)
+      {
+         rk += 4;
+         t0 = Te[0][s0 >> 24] ^ Te[1][(s1 >> 16) & 0xff] ^ Te[2][(s2 >> 8) & 0xff] ^ Te[3][s3 & 0xff] ^ rk[0];
+         t1 = Te[0][s1 >> 24] ^ Te[1][(s2 >> 16) & 0xff] ^ Te[2][(s3 >> 8) & 0xff] ^ Te[3][s0 & 0xff] ^ rk[1];
+         t2 = Te[0][s2 >> 24] ^ Te[1][(s3 >> 16) & 0xff] ^ Te[2][(s0 >> 8) & 0xff] ^ Te[3][s1 & 0xff] ^ rk[2];
+         t3 = Te[0][s3 >> 24] ^ Te[1][(s0 >> 16) & 0xff] ^ Te[2][(s1 >> 8) & 0xff] ^ Te[3][s2 & 0xff] ^ rk[3];
+         s0 = t0;
+         s1 = t1;
+         s2 = t2;
+         s3 = t3;
+      }
+
+      /* The last round has no MixColumns */
+      rk += 4;
+      t0 = ((uint32_t)sbox[s0 >> 24] << 24) ^ ((uint32_t)sbox[(s1 >> 16) & 0xff] << 16) ^
+           ((uint32_t)sbox[(s2 >> 8) & 0xff] << 8) ^ (uint32_t)sbox[s3 & 0xff] ^ rk[0];
+      t1 = ((uint32_t)sbox[s1 >> 24] << 24) ^ ((uint32_t)sbox[(s2 >> 16) & 0xff] << 16) ^
+           ((uint32_t)sbox[(s3 >> 8) & 0xff] << 8) ^ (uint32_t)sbox[s0 & 0xff] ^ rk[1];
+      t2 = ((uint32_t)sbox[s2 >> 24] << 24) ^ ((uint32_t)sbox[(s3 >> 16) & 0xff] << 16) ^
+           ((uint32_t)sbox[(s0 >> 8) & 0xff] << 8) ^ (uint32_t)sbox[s1 & 0xff] ^ rk[2];
+      t3 = ((uint32_t)sbox[s3 >> 24] << 24) ^ ((uint32_t)sbox[(s0 >> 16) & 0xff] << 16) ^
+           ((uint32_t)sbox[(s1 >> 8) & 0xff] << 8) ^ (uint32_t)sbox[s2 & 0xff] ^ rk[3];
+
+      PUTU32(out, t0);
+      PUTU32(out + 4, t1);
+      PUTU32(out + 8, t2);
+      PUTU32(out + 12, t3);
+      out += 16;
+   }
+}
+
+#ifdef AES_HAVE_NI
+#define AES_CTR_BLOCK(n) _mm_xor_si128(_mm_set_epi64x((long long)__builtin_bswap64(block + (n)), (long long)nonce), key)
+
+__attribute__((target("aes,sse2")))
+static void aes_blocks_ni(const aesctr_t *aes, uint64_t block, uint64_t count, uint8_t *out)
+{
+   const __m128i *rk = (const __m128i*)aes->rkbytes;
+   __m128i b0, b1, b2, b3, b4, b5, b6, b7, key;
+   uint64_t nonce;
+   int round;
+
+   memcpy(&nonce, aes->nonce, sizeof(nonce));
+
+   /* Eight independent blocks keep the AES unit busy.  They are spelled
+    * out so the compiler keeps every one of them in a register */
+   while(count >= AES_PARALLEL)
+   {
+      key = _mm_loadu_si128(&rk[0]);
+      b0 = AES_CTR_BLOCK(0);
+      b1 = AES_CTR_BLOCK(1);
+      b2 = AES_CTR_BLOCK(2);
+      b3 = AES_CTR_BLOCK(3);
+      b4 = AES_CTR_BLOCK(4);
+      b5 = AES_CTR_BLOCK(5);
+      b6 = AES_CTR_BLOCK(6);
+      b7 = AES_CTR_BLOCK(7);
+
+      for(round = 1; round < aes->rounds; round++)
+      {
+         key = _mm_loadu_si128(&rk[round]);
+         b0 = _mm_aesenc_si128(b0, key);
+         b1 = _mm_aesenc_si128(b1, key);
+         b2 = _mm_aesenc_si128(b2, key);
+         b3 = _mm_aesenc_si128(b3, key);
+         b4 = _mm_aesenc_si128(b4, key);
+         b5 = _mm_aesenc_si128(b5, key);
+         b6 = _mm_aesenc_si128(b6, key);
+         b7 = _mm_aesenc_si128(b7, key);
+      }
+
+      key = _mm_loadu_si128(&rk[aes->rounds]);
+      _mm_storeu_si128((__m128i*)(out + 0), _mm_aesenclast_si128(b0, key));
+      _mm_storeu_si128((__m128i*)(out + 16), _mm_aesenclast_si128(b1, key));
+      _mm_storeu_si128((__m128i*)(out + 32), _mm_aesenclast_si128(b2, key));
+      _mm_storeu_si128((__m128i*)(out + 48), _mm_aesenclast_si128(b3, key));
+      _mm_storeu_si128((__m128i*)(out + 64), _mm_aesenclast_si128(b4, key));
+      _mm_storeu_si128((__m128i*)(out + 80), _mm_aesenclast_si128(b5, key));
+      _mm_storeu_si128((__m128i*)(out + 96), _mm_aesenclast_si128(b6, key));
+      _mm_storeu_si128((__m128i*)(out + 112), _mm_aesenclast_si128(b7, key));
+
+      block += AES_PARALLEL;
+      count -= AES_PARALLEL;
+      out += AES_PARALLEL * 16;
+   }
+
+   while(count-- > 0)
+   {
+      key = _mm_loadu_si128(&rk[0]);
+      b0 = AES_CTR_BLOCK(0);
+      for(round = 1; round < aes->rounds; round++)
+         b0 = _mm_aesenc_si128(b0, _mm_loadu_si128(&rk[round]));
+      _mm_storeu_si128((__m128i*)out, _mm_aesenclast_si128(b0, _mm_loadu_si128(&rk[aes->rounds])));
+
+      block++;
+      out += 16;
+   }
+}
+#endif
+
+static void aes_select(void)
+{
+   int i;
+
+   /* Build the round tables from the S-box */
+   for(i = 0; i < 256; i++)
+   {
+      uint8_t s = sbox[i];
+      uint8_t s2 = (uint8_t)((s << 1) ^ ((s & 0x80) ? 0x1b : 0));
+      uint8_t s3 = s2 ^ s;
+      uint32_t t = ((uint32_t)s2 << 24) | ((uint32_t)s << 16) | ((uint32_t)s << 8) | s3;
+
+      Te[0][i] = t;
+      Te[1][i] = ror32(t, 8);
+      Te[2][i] = ror32(t, 16);
+      Te[3][i] = ror32(t, 24);
+   }
+
+   aes_blocks = aes_blocks_soft;
+   aes_name = "software";
+
+#ifdef AES_HAVE_NI
+   __builtin_cpu_init();
+   if(__builtin_cpu_supports("aes"))
+   {
+      aes_blocks = aes_blocks_ni;
+      aes_name = "aes-ni";
+   }
+#endif
+
+   if(getenv("NETNUKE_AES_SOFTWARE") != NULL)
+   {
+      aes_blocks = aes_blocks_soft;
+      aes_name = "software";
+   }
+}
+
+const char* aes_impl(void)
+{
+   pthread_once(&aes_once, aes_select);
+   return aes_name;
+}
+
+/* Fill key and nonce from the kernel's cryptographic generator */
+int aes_keygen(uint8_t *key, int bits, uint8_t nonce[8])
+{
+   uint8_t material[40];
+   size_t need = bits / 8 + 8;
+   size_t got = 0;
+   ssize_t n;
+   int fd;
+
+#ifdef __linux__
+   while(got < need && (n = getrandom(material + got, need - got, 0)) > 0)
+      got += n;
+#endif
+   if(got < need && (fd = open("/dev/urandom", O_RDONLY)) > -1)
+   {
+      while(got < need && (n = read(fd, material + got, need - got)) > 0)
+         got += n;
+      close(fd);
+   }
+
+   /* Never wipe with a predictable key */
+   if(got < need)
+      return 1;
+
+   memcpy(key, material, bits / 8);
+   memcpy(nonce, material + bits / 8, 8);
+   memset(material, 0, sizeof(material));
+   return 0;
+}
+
+void aes_init(aesctr_t *aes, const uint8_t *key, int bits, const uint8_t nonce[8], int32_t pass)
+{
+   int nk = bits == 256 ? 8 : 4;
+   int total, i;
+   uint32_t temp, rcon = 0x01;
+
+   pthread_once(&aes_once, aes_select);
+
+   memset(aes, 0, sizeof(aesctr_t));
+   aes->bits = nk == 8 ? 256 : 128;
+   aes->rounds = nk + 6;
+   memcpy(aes->nonce, nonce, sizeof(aes->nonce));
+
+   /* Every pass runs on its own counter space */
+   for(i = 0; i < 4; i++)
+      aes->nonce[4 + i] ^= (uint8_t)((uint32_t)pass >> (24 - i * 8));
+
+   /* FIPS-197 key expansion */
+   total = 4 * (aes->rounds + 1);
+   for(i = 0; i < nk; i++)
+      aes->rk[i] = GETU32(key + i * 4);
+
+   for(i = nk; i < total; i++)
+   {
+      temp = aes->rk[i - 1];
+      if(i % nk == 0)
+      {
+         temp = subword((temp << 8) | (temp >> 24)) ^ (rcon << 24);
+         rcon = (rcon << 1) ^ ((rcon & 0x80) ? 0x1b : 0);
+      }
+      else if(nk > 6 && i % nk == 4)
+         temp = subword(temp);
+
+      aes->rk[i] = aes->rk[i - nk] ^ temp;
+   }
+
+   for(i = 0; i < total; i++)
+      PUTU32(&aes->rkbytes[i * 4], aes->rk[i]);
+}
+
+void aes_fill(const aesctr_t *aes, void *buffer, uint64_t length, uint64_t offset)
+{
+   uint8_t *dest = (uint8_t*)buffer;
+   uint8_t tmp[16];
+   uint64_t skip = offset % 16;
+   uint64_t blocks;
+
+   /* Leading partial block */
+   if(skip != 0 && length > 0)
+   {
+      uint64_t count = 16 - skip < length ? 16 - skip : length;
+
+      aes_blocks(aes, offset / 16, 1, tmp);
+      memcpy(dest, tmp + skip, count);
+      dest += count;
+      offset += count;
+      length -= count;
+   }
+
+   blocks = length / 16;
+   if(blocks > 0)
+   {
+      aes_blocks(aes, offset / 16, blocks, dest);
+      dest += blocks * 16;
+      offset += blocks * 16;
+      length -= blocks * 16;
+   }
+
+   /* Trailing partial block */
+   if(length > 0)
+   {
+      aes_blocks(aes, offset / 16, 1, tmp);
+      memcpy(dest, tmp, length);
+   }
+}
+
+void aes_hex(const uint8_t *data, size_t length, char *out)
+{
+   static const char digits[] = "0123456789abcdef";
+   size_t i;
+
+   for(i = 0; i < length; i++)
+   {
+      out[i * 2] = digits[data[i] >> 4];
+      out[i * 2 + 1] = digits[data[i] & 0x0f];
+   }
+   out[length * 2] = '\0';
+}
@@ -0,0 +1,242 @@
+/**
+ *  NetNuke - Erases all storage media deteced by the system
+ *  Copyright (C) 2009  Joseph Hunkeler <jhunkeler@gmail.com, jhunk@stsci.edu>
+ *
+ *  This file is part of NetNuke.
+ *
+ *  NetNuke is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  NetNuke is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with NetNuke.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * Block size and queue depth tuning
+ *
+ * What a device wants depends on the device: a SATA disk behind a slow
+ * expander is happy with a few large writes, an NVMe drive wants many in
+ * flight.  Instead of one block size for everything each device tries a
+ * grid of block sizes and queue depths for AUTOTUNE_TRIAL each, on the
+ * start of the pass it is about to wipe anyway, and keeps the fastest.
+ * The tried region holds the right data for the pass, so nothing is
+ * written twice.  With --retune the tuning is repeated when the rate falls
+ * below AUTOTUNE_DROP of what it was tuned to.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <time.h>
+#ifdef __FreeBSD__
+   #include <libutil.h>
+#else
+   #include "human_readable.h"
+#endif
+
+#include "netnuke.h"
+
+/* Nanoseconds each combination is written for */
+#define AUTOTUNE_TRIAL 250000000ULL
+/* And at most this much, or this share of the device */
+#define AUTOTUNE_TRIAL_BYTES (256 * 1024 * 1024)
+#define AUTOTUNE_SHARE 64
+/* Devices smaller than this are done before tuning would pay off */
+#define AUTOTUNE_MIN_SIZE (1024ULL * 1024 * 1024)
+/* Nanoseconds the rate is measured over when watching for a drop */
+#define AUTOTUNE_CHECK 30000000000ULL
+/* Fraction of the tuned rate that triggers another round */
+#define AUTOTUNE_DROP 0.5
+
+static const uint64_t autotune_sizes[] = { 65536, 262144, 1048576, 4194304 };
+static const int32_t autotune_depths[] = { 1, 4, 16, 32 };
+
+/* Write from offset with one combination, ending on a multiple of align
+ * so direct I/O takes every write.  Returns the rate in bytes per second,
+ * or -1 with error set. */
+static double autotune_trial(nukejob_t *job, int fd, uint64_t blocksize, int32_t depth, uint64_t align,
+      uint64_t *offset, int32_t *used, int *error)
+{
+   ioctx_t io;
+   ioslot_t *slot;
+   uint64_t start, until, elapsed, done = 0;
+   uint64_t position = *offset;
+   uint64_t most = job->size / AUTOTUNE_SHARE < AUTOTUNE_TRIAL_BYTES ? job->size / AUTOTUNE_SHARE : AUTOTUNE_TRIAL_BYTES;
+   uint64_t limit;
+
+   most = most / align * align;
+   limit = job->size - position < most ? job->size : (position + most) / align * align;
+
+   memset(&io, 0, sizeof(ioctx_t));
+   if((*error = -io_open(&io, job->iotype, fd, depth, blocksize, NULL, 0)) != 0)
+      return -1;
+   *used = io.depth;
+
+   start = latency_now();
+   until = start + AUTOTUNE_TRIAL;
+   while(1)
+   {
+      while(*error == 0 && position < limit && latency_now() < until && (slot = io_slot(&io)) != NULL)
+      {
+         slot->offset = position;
+         slot->length = limit - position < blocksize ? limit - position : blocksize;
+         nuke_fill(job, slot->buf, slot->length, slot->offset);
+         if(io_submit(&io, slot) != 0)
+         {
+            *error = EIO;
+            break;
+         }
+         position += slot->length;
+      }
+
+      if(io.inflight == 0)
+         break;
+
+      if((slot = io_reap(&io)) == NULL)
+      {
+         *error = errno;
+         break;
+      }
+      latency_record(&job->latency, slot->latency);
+
+      /* Whatever went wrong is left to the write loop */
+      if(slot->result != (int64_t)slot->length)
+         *error = slot->result < 0 ? (int)-slot->result : EIO;
+      else
+         done += slot->length;
+   }
+   elapsed = latency_now() - start;
+   io_close(&io);
+
+   /* A failed trial is written again by the write loop */
+   if(*error != 0)
+      return -1;
+
+   *offset = position;
+   return elapsed ? (double)done * 1e9 / (double)elapsed : 0;
+}
+
+/* Find the fastest block size and queue depth for job, writing the pass
+ * from offset on.  offset is moved past what was written, to a multiple of
+ * the new block size.  Returns 0, or an errno when a trial write failed;
+ * offset is then left alone and so are the settings. */
+int autotune_run(nukejob_t *job, int fd, uint64_t *offset)
+{
+   uint64_t align = job->psector > job->lsector ? job->psector : job->lsector;
+   uint64_t position = *offset;
+   uint64_t bestsize = job->blocksize;
+   int32_t bestdepth = job->qdepth;
+   double best = 0;
+   char human[16];
+   size_t s, d;
+   int error = 0;
+
+   if(align == 0)
+      align = 512;
+
+   for(s = 0; s < sizeof(autotune_sizes) / sizeof(autotune_sizes[0]); s++)
+   {
+      uint64_t blocksize = autotune_sizes[s];
+
+      /* The fast random level repeats one block, its size is part of the
+       * data, so only the depth is tried */
+      if(job->nukelevel == NUKE_RANDOM_FAST)
+         blocksize = job->blocksize;
+      else if(blocksize % align != 0)
+         continue;
+
+      for(d = 0; d < sizeof(autotune_depths) / sizeof(autotune_depths[0]) && position < job->size; d++)
+      {
+         int32_t used;
+         double rate = autotune_trial(job, fd, blocksize, autotune_depths[d], align, &position, &used, &error);
+
+         if(rate < 0)
+         {
+            lwrite("%s: Tuning stopped, %s\n", job->target, strerror(error));
+            return error;
+         }
+
+         humanize_number(human, 5, (int64_t)rate, "", HN_AUTOSCALE, HN_B | HN_NOSPACE | HN_DECIMAL);
+         lwrite("%s: %ju byte blocks, queue depth %d: %s/s\n", job->target, (uintmax_t)blocksize, used, human);
+         if(rate > best)
+         {
+            best = rate;
+            bestsize = blocksize;
+            bestdepth = used;
+         }
+
+         /* The backend went no deeper, going further measures the same */
+         if(used < autotune_depths[d])
+            break;
+      }
+
+      if(job->nukelevel == NUKE_RANDOM_FAST)
+         break;
+   }
+
+   job->blocksize = (int32_t)bestsize;
+   job->qdepth = bestdepth;
+   job->tunedrate = best;
+   job->tunestart = 0;
+   /* Only what the write loop does not go over again counts as written,
+    * the rounded off tail is written and counted there */
+   position = position / bestsize * bestsize;
+   job->written += position - *offset;
+   *offset = position;
+
+   humanize_number(human, 5, (int64_t)best, "", HN_AUTOSCALE, HN_B | HN_NOSPACE | HN_DECIMAL);
+   lwrite("%s: Tuned to %d byte blocks, queue depth %d (%s/s)\n", job->target, job->blocksize, job->qdepth, human);
+   if(job->verbose)
+      printf("%s: Tuned to %d byte blocks, queue depth %d (%s/s)\n", job->target, job->blocksize, job->qdepth, human);
+
+   return 0;
+}
+
+/* Whether a device is big enough, and free enough, for tuning to pay off */
+bool autotune_wanted(const nukejob_t *job)
+{
+   return job->autotune && job->size >= AUTOTUNE_MIN_SIZE && job->ratelimit == 0
+      && job->nukelevel != NUKE_REWRITE && job->nukelevel < NUKE_OFFLOAD_ZERO;
+}
+
+/* Whether the rate fell so far below the tuned rate that it is worth
+ * tuning again.  done is what the pass has written so far. */
+bool autotune_due(nukejob_t *job, uint64_t done)
+{
+   uint64_t now;
+   double rate;
+
+   if(!job->retune || job->tunedrate <= 0)
+      return false;
+
+   now = latency_now();
+   if(job->tunestart == 0 || done < job->tunedone)
+   {
+      job->tunestart = now;
+      job->tunedone = done;
+      return false;
+   }
+   if(now - job->tunestart < AUTOTUNE_CHECK)
+      return false;
+
+   rate = (double)(done - job->tunedone) * 1e9 / (double)(now - job->tunestart);
+   job->tunestart = now;
+   job->tunedone = done;
+
+   if(rate >= job->tunedrate * AUTOTUNE_DROP)
+      return false;
+
+   lwrite("%s: Rate fell to %.0f%% of what it was tuned to, tuning again\n", job->target, rate / job->tunedrate * 100);
+   return true;
+}
@@ -0,0 +1,254 @@
+/**
+ *  NetNuke - Erases all storage media deteced by the system
+ *  Copyright (C) 2009  Joseph Hunkeler <jhunkeler@gmail.com, jhunk@stsci.edu>
+ *
+ *  This file is part of NetNuke.
+ *
+ *  NetNuke is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  NetNuke is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with NetNuke.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * Bad block recovery
+ *
+ * A failed write is retried in halves, down to single sectors, so only
+ * the sectors that really refuse to be written are given up on.  When
+ * both halves of a split fail the whole of it is given up on instead:
+ * an unreadable stretch costs a handful of failed writes rather than one
+ * per sector.  Bad sectors are kept in an interval map per device and
+ * reported at the end.  When
+ * failures follow each other closely the device is in a bad region, and
+ * every further failure jumps twice as far ahead as the last, up to
+ * BADBLOCK_SKIP_MAX, so a dying drive costs a bounded number of timeouts
+ * instead of one per sector.  What is jumped over is recorded as well.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+#include "netnuke.h"
+
+/* Add [start, end) to the map, merging it with every range it touches.
+ * Returns 0, or ENOMEM. */
+int badmap_add(badmap_t *map, uint64_t start, uint64_t end)
+{
+   uint64_t bytes;
+   uint32_t first, last, i;
+
+   if(start >= end)
+      return 0;
+
+   /* First range that ends at or after start */
+   for(first = 0; first < map->count && map->ranges[first].end < start; first++)
+      ;
+   /* One past the last range that begins at or before end */
+   for(last = first; last < map->count && map->ranges[last].start <= end; last++)
+      ;
+
+   if(first == last)
+   {
+      if(map->count == map->capacity)
+      {
+         uint32_t capacity = map->capacity ? map->capacity * 2 : 16;
+         badrange_t *ranges = (badrange_t*)realloc(map->ranges, capacity * sizeof(badrange_t));
+
+         if(ranges == NULL)
+            return ENOMEM;
+         map->ranges = ranges;
+         map->capacity = capacity;
+      }
+      memmove(&map->ranges[first + 1], &map->ranges[first], (map->count - first) * sizeof(badrange_t));
+      map->ranges[first].start = start;
+      map->ranges[first].end = end;
+      map->count++;
+   }
+   else
+   {
+      /* Swallow ranges first to last - 1 */
+      if(map->ranges[first].start < start)
+         start = map->ranges[first].start;
+      if(map->ranges[last - 1].end > end)
+         end = map->ranges[last - 1].end;
+      map->ranges[first].start = start;
+      map->ranges[first].end = end;
+      memmove(&map->ranges[first + 1], &map->ranges[last], (map->count - last) * sizeof(badrange_t));
+      map->count -= last - first - 1;
+   }
+
+   /* Read by the metrics thread while the map grows */
+   for(i = 0, bytes = 0; i < map->count; i++)
+      bytes += map->ranges[i].end - map->ranges[i].start;
+   __atomic_store_n(&map->bytes, bytes, __ATOMIC_RELAXED);
+
+   return 0;
+}
+
+void badmap_free(badmap_t *map)
+{
+   free(map->ranges);
+   memset(map, 0, sizeof(badmap_t));
+}
+
+/* Write all of it or fail.  Returns 0, or the errno of the failure. */
+static int badblock_write(int fd, const char *data, uint64_t length, uint64_t offset)
+{
+   uint64_t done = 0;
+
+   while(done < length)
+   {
+      ssize_t result = pwrite(fd, data + done, length - done, offset + done);
+
+      if(result <= 0)
+         return result == 0 ? EIO : errno;
+      done += result;
+   }
+   return 0;
+}
+
+/* Give up on a range that failed with error */
+static int badblock_mark(nukejob_t *job, int error, uint64_t offset, uint64_t length)
+{
+   metrics_error(job, error);
+   return badmap_add(&job->bad, offset, offset + length) != 0 ? ENOMEM : 0;
+}
+
+/* Find what can be written of a range a write of failed with error, by
+ * writing its halves.  Returns 0, or the errno that makes carrying on
+ * pointless. */
+static int badblock_split(nukejob_t *job, int fd, const char *data, uint64_t offset, uint64_t length, int error)
+{
+   uint64_t sector = job->lsector ? job->lsector : 512;
+   uint64_t half;
+   int first, second;
+
+   if(length <= sector)
+      return badblock_mark(job, error, offset, length);
+
+   half = length / sector / 2 * sector;
+   if(half == 0)
+      half = sector;
+
+   first = badblock_write(fd, data, half, offset);
+   /* The device is gone, there is nothing left to find out */
+   if(first == ENXIO || first == ENODEV)
+      return first;
+   second = badblock_write(fd, data + half, length - half, offset + half);
+   if(second == ENXIO || second == ENODEV)
+      return second;
+
+   /* Nothing of it takes a write, looking closer only costs timeouts */
+   if(first != 0 && second != 0)
+      return badblock_mark(job, first, offset, length);
+
+   if(first == 0)
+      job->written += half;
+   else if((error = badblock_split(job, fd, data, offset, half, first)) != 0)
+      return error;
+
+   if(second == 0)
+      job->written += length - half;
+   else if((error = badblock_split(job, fd, data + half, offset + half, length - half, second)) != 0)
+      return error;
+
+   return 0;
+}
+
+/* Write what can be written of a range.  Returns 0, or the errno that
+ * makes carrying on pointless. */
+static int badblock_bisect(nukejob_t *job, int fd, const char *data, uint64_t offset, uint64_t length)
+{
+   int error;
+
+   if((error = badblock_write(fd, data, length, offset)) == 0)
+   {
+      job->written += length;
+      return 0;
+   }
+
+   if(error == ENXIO || error == ENODEV)
+      return error;
+   return badblock_split(job, fd, data, offset, length, error);
+}
+
+/* Recover from a failed write of slot.  offset is where the next write
+ * would go, it is moved past a clustered bad region.  NULL when the caller
+ * can not skip, nor wants progress counted.  Returns 0 when the wipe can
+ * carry on, otherwise errno says why not. */
+int badblock_recover(nukejob_t *job, int fd, ioslot_t *slot, uint64_t *offset, uint64_t byteSize)
+{
+   uint64_t before = job->bad.bytes;
+   uint64_t from, to;
+   bool clustered = job->badlast != 0 && slot->offset <= job->badlast + BADBLOCK_CLUSTER;
+   bool skipped = clustered && job->badskip != 0;
+   int error;
+
+   /* Inside a bad region already, a write that was in flight when the
+    * skip began is skipped as well instead of probed */
+   if(skipped)
+   {
+      if(badmap_add(&job->skipped, slot->offset, slot->offset + slot->length) != 0)
+      {
+         errno = ENOMEM;
+         return 1;
+      }
+      metrics_error(job, EIO);
+      lwrite("%s: In a bad region, skipping bytes %ju-%ju\n", job->target,
+            (uintmax_t)slot->offset, (uintmax_t)(slot->offset + slot->length - 1));
+   }
+   else if((error = badblock_bisect(job, fd, slot->data, slot->offset, slot->length)) != 0)
+   {
+      errno = error;
+      return 1;
+   }
+   if(offset != NULL)
+      __atomic_add_fetch(&job->passdone, slot->length, __ATOMIC_RELAXED);
+
+   /* The retry went through, nothing is wrong with the media */
+   if(job->bad.bytes == before && !skipped)
+      return 0;
+
+   if(job->bad.bytes != before)
+      lwrite("%s: %ju unwritable bytes between %ju and %ju\n", job->target, (uintmax_t)(job->bad.bytes - before),
+            (uintmax_t)slot->offset, (uintmax_t)(slot->offset + slot->length - 1));
+
+   /* Failing close to the last failure: jump farther every time */
+   if(clustered)
+      job->badskip = job->badskip ? job->badskip * 2 : byteSize;
+   else
+      job->badskip = 0;
+   if(job->badskip > BADBLOCK_SKIP_MAX)
+      job->badskip = BADBLOCK_SKIP_MAX / byteSize * byteSize;
+   if(slot->offset + slot->length > job->badlast)
+      job->badlast = slot->offset + slot->length;
+
+   if(job->badskip == 0 || offset == NULL || *offset >= job->size)
+      return 0;
+
+   from = *offset;
+   to = job->size - from < job->badskip ? job->size : from + job->badskip;
+   if(badmap_add(&job->skipped, from, to) != 0)
+      return 1;
+   __atomic_add_fetch(&job->passdone, to - from, __ATOMIC_RELAXED);
+   *offset = to;
+
+   lwrite("%s: In a bad region, skipping bytes %ju-%ju\n", job->target, (uintmax_t)from, (uintmax_t)to - 1);
+   fprintf(stderr, "%s: In a bad region, skipping bytes %ju-%ju\n", job->target, (uintmax_t)from, (uintmax_t)to - 1);
+   return 0;
+}
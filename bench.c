@@ -0,0 +1,724 @@
+/**
+ *  NetNuke - Erases all storage media deteced by the system
+ *  Copyright (C) 2009  Joseph Hunkeler <jhunkeler@gmail.com, jhunk@stsci.edu>
+ *
+ *  This file is part of NetNuke.
+ *
+ *  NetNuke is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  NetNuke is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with NetNuke.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * Wipe throughput benchmark
+ *
+ * netnuke-bench runs the real wipe path, pool and all, against throwaway
+ * targets: sparse files, files on a tmpfs and loop devices backed by a
+ * sparse file.  Never a disk.  Each case is one pass of one nuke level,
+ * block size, write mode, I/O backend and device count, and reports the
+ * rate, the CPU time spent per GB written and the write latency
+ * percentiles on one line, so runs can be saved and compared later.
+ *
+ * By default every factor is varied on its own around a base case; with
+ * --matrix every combination is run.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <time.h>
+#ifdef __linux__
+   #include <linux/loop.h>
+#endif
+
+#include "netnuke.h"
+
+/* Bumped whenever the output changes meaning */
+#define BENCH_FORMAT 1
+#define BENCH_AXIS_MAX 16
+#define BENCH_MB (1024.0 * 1024.0)
+
+typedef enum benchtarget
+{
+   BENCH_TMPFS=0,
+   BENCH_SPARSE,
+   BENCH_LOOP
+} benchTarget_t;
+
+typedef struct BENCHCASE_T
+{
+   nukeLevel_t level;
+   int32_t blocksize;
+   int8_t wmode;
+   ioType_t iotype;
+   int32_t jobs;
+   benchTarget_t target;
+   char name[128];
+} benchcase_t;
+
+typedef struct BENCHRESULT_T
+{
+   char name[128];
+   double mbps;
+   double cpugb;               /* CPU seconds per GB written */
+   double p50, p99, p999;      /* Microseconds */
+} benchresult_t;
+
+/* A list of values per factor, the first one is the base case */
+typedef struct BENCHAXIS_T
+{
+   int32_t values[BENCH_AXIS_MAX];
+   int32_t count;
+} benchaxis_t;
+
+static const char *bench_targets[] = { "tmpfs", "sparse", "loop" };
+
+static char *bench_dir = "/tmp";
+static char *bench_tmpfs = "/dev/shm";
+static uint64_t bench_size = 256ULL * 1024 * 1024;
+static int32_t bench_qdepth = 8;
+static bool bench_buffered = false;
+
+/* The pool reports nothing to anyone */
+void clearline(void)
+{
+}
+
+void usage(const char* cmd)
+{
+   printf("usage: %s [options] ...\n", cmd);
+   printf("--help            -h       This message\n");
+   printf("--dir path                 Where sparse files and loop backing files go (default: /tmp)\n");
+   printf("--tmpfs path               Where tmpfs files go (default: /dev/shm)\n");
+   printf("--size n                   MB written per device and case (default: 256)\n");
+   printf("--levels list              Nuke levels, e.g. 0,1,2 (default: 0,1,2,3,4,5)\n");
+   printf("--block-sizes list         Block sizes in bytes (default: 1048576,4096,65536,4194304)\n");
+   printf("--write-modes list         sync, async (default: sync,async)\n");
+   printf("--backends list            auto, sync, uring, splice (default: auto,sync,uring,splice)\n");
+   printf("--jobs list                Devices written at once (default: 1,2,4,8)\n");
+   printf("--targets list             tmpfs, sparse, loop (default: tmpfs,sparse,loop)\n");
+   printf("--queue-depth n            Writes kept in flight per device (default: 8)\n");
+   printf("--buffered                 Write through the page cache instead of O_DIRECT\n");
+   printf("--matrix                   Run every combination instead of one factor at a time\n");
+   printf("--json                     One JSON object per case instead of text\n");
+   printf("--save file                Keep the results as a baseline\n");
+   printf("--baseline file            Compare with a saved baseline, exit 1 on a regression\n");
+   printf("--tolerance n              Percent slower than the baseline that still passes (default: 10)\n");
+   printf("\nThe first value of every list is the base case.\n");
+}
+
+/* Parse a comma separated list with a name table, or numbers when there is
+ * no table.  Returns 0 on success. */
+static int bench_axis(const char *str, const char **names, int32_t nnames, benchaxis_t *axis)
+{
+   char copy[BUFSIZ];
+   char *tok, *save = NULL;
+
+   snprintf(copy, sizeof(copy), "%s", str);
+   axis->count = 0;
+
+   for(tok = strtok_r(copy, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save))
+   {
+      int32_t value = -1, i;
+
+      if(axis->count >= BENCH_AXIS_MAX)
+         return 1;
+
+      if(names == NULL)
+      {
+         char *end;
+
+         value = (int32_t)strtol(tok, &end, 10);
+         if(*end != '\0' || value < 0)
+            return 1;
+      }
+      else
+      {
+         for(i = 0; i < nnames; i++)
+            if(strcmp(tok, names[i]) == 0)
+               value = i;
+         if(value < 0)
+            return 1;
+      }
+
+      axis->values[axis->count++] = value;
+   }
+
+   return axis->count == 0;
+}
+
+/* I/O backend names, in ioType_t order */
+static const char *bench_backends[] = { "auto", "sync", "uring", "splice" };
+static const char *bench_wmodes[] = { "sync", "async" };
+
+static void bench_name(benchcase_t *c)
+{
+   snprintf(c->name, sizeof(c->name), "level%d-bs%d-%s-%s-j%d-%s", c->level, c->blocksize,
+         bench_wmodes[c->wmode], io_type_str(c->iotype), c->jobs, bench_targets[c->target]);
+}
+
+/* Append a case unless an identical one is already listed */
+static void bench_add(benchcase_t *cases, int32_t *count, benchcase_t c)
+{
+   int32_t i;
+
+   bench_name(&c);
+   for(i = 0; i < *count; i++)
+      if(strcmp(cases[i].name, c.name) == 0)
+         return;
+   cases[(*count)++] = c;
+}
+
+static uint64_t bench_clock(void)
+{
+   return latency_now();
+}
+
+static double bench_cpu(void)
+{
+   struct rusage usage;
+
+   getrusage(RUSAGE_SELF, &usage);
+   return (double)usage.ru_utime.tv_sec + (double)usage.ru_utime.tv_usec / 1e6
+      + (double)usage.ru_stime.tv_sec + (double)usage.ru_stime.tv_usec / 1e6;
+}
+
+/* Attach a loop device to a file.  Returns the loop device number, or -1
+ * with errno set. */
+static int bench_loop_attach(const char *file, char *device, size_t size)
+{
+#ifdef __linux__
+   int control, number, loop, fd;
+
+   if((control = open("/dev/loop-control", O_RDWR)) < 0)
+      return -1;
+   number = ioctl(control, LOOP_CTL_GET_FREE);
+   close(control);
+   if(number < 0)
+      return -1;
+
+   snprintf(device, size, "/dev/loop%d", number);
+   if((fd = open(file, O_RDWR)) < 0)
+      return -1;
+   if((loop = open(device, O_RDWR)) < 0)
+   {
+      close(fd);
+      return -1;
+   }
+
+   if(ioctl(loop, LOOP_SET_FD, fd) < 0)
+   {
+      int error = errno;
+
+      close(loop);
+      close(fd);
+      errno = error;
+      return -1;
+   }
+
+   close(fd);
+   close(loop);
+   return number;
+#else
+   (void)file;
+   (void)device;
+   (void)size;
+   errno = ENOTSUP;
+   return -1;
+#endif
+}
+
+static void bench_loop_detach(const char *device)
+{
+#ifdef __linux__
+   int loop;
+
+   if((loop = open(device, O_RDWR)) < 0)
+      return;
+   ioctl(loop, LOOP_CLR_FD, 0);
+   close(loop);
+#else
+   (void)device;
+#endif
+}
+
+/* A fresh, sparse file of the benchmark size */
+static int bench_file(const char *path)
+{
+   int fd;
+
+   if((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0)
+      return -1;
+   if(ftruncate(fd, (off_t)bench_size) != 0)
+   {
+      int error = errno;
+
+      close(fd);
+      unlink(path);
+      errno = error;
+      return -1;
+   }
+   close(fd);
+   return 0;
+}
+
+/* Create the targets of one case.  Returns 0 when every one of them exists;
+ * whatever was made is recorded so bench_teardown() can undo it. */
+static int bench_setup(benchcase_t *c, nukejob_t *jobs, char (*files)[PATH_MAX])
+{
+   int32_t i;
+
+   for(i = 0; i < c->jobs; i++)
+   {
+      media_t device;
+
+      memset(&device, 0, sizeof(media_t));
+      device.size = bench_size;
+      device.numanode = -1;
+      device.usable = USABLE_MEDIA;
+
+      snprintf(files[i], PATH_MAX, "%s/netnuke-bench-%ld-%d.img",
+            c->target == BENCH_TMPFS ? bench_tmpfs : bench_dir, (long)getpid(), i);
+      if(bench_file(files[i]) != 0)
+      {
+         fprintf(stderr, "%s: Could not create: %s\n", files[i], strerror(errno));
+         files[i][0] = '\0';
+         return 1;
+      }
+
+      snprintf(device.name, sizeof(device.name), "%s", files[i]);
+      if(c->target == BENCH_LOOP && bench_loop_attach(files[i], device.name, sizeof(device.name)) < 0)
+      {
+         fprintf(stderr, "%s: Could not attach a loop device: %s\n", files[i], strerror(errno));
+         unlink(files[i]);
+         files[i][0] = '\0';
+         return 1;
+      }
+      snprintf(device.nameshort, sizeof(device.nameshort), "bench%d", i);
+
+      job_init(&jobs[i], device);
+      jobs[i].nukelevel = c->level;
+      jobs[i].wmode = c->wmode;
+      jobs[i].passes = 1;
+      jobs[i].blocksize = c->blocksize;
+      jobs[i].iotype = c->iotype;
+      jobs[i].qdepth = bench_qdepth;
+      jobs[i].oflags = bench_buffered ? 0 : O_DIRECT;
+   }
+
+   return 0;
+}
+
+static void bench_teardown(benchcase_t *c, nukejob_t *jobs, char (*files)[PATH_MAX])
+{
+   int32_t i;
+
+   for(i = 0; i < c->jobs; i++)
+   {
+      if(files[i][0] == '\0')
+         continue;
+      if(c->target == BENCH_LOOP && jobs[i].target[0] != '\0')
+         bench_loop_detach(jobs[i].target);
+      unlink(files[i]);
+      badmap_free(&jobs[i].bad);
+      badmap_free(&jobs[i].skipped);
+   }
+}
+
+/* Run one case.  Returns 0 when every target was written in full. */
+static int bench_run(benchcase_t *c, benchresult_t *result)
+{
+   nukejob_t *jobs;
+   char (*files)[PATH_MAX];
+   latency_t *latency;
+   uint64_t start, elapsed, written = 0;
+   double cpu;
+   int32_t i;
+   int out, failed = 0;
+
+   memset(result, 0, sizeof(benchresult_t));
+   snprintf(result->name, sizeof(result->name), "%s", c->name);
+
+   jobs = (nukejob_t*)calloc(c->jobs, sizeof(nukejob_t));
+   files = calloc(c->jobs, PATH_MAX);
+   latency = (latency_t*)calloc(1, sizeof(latency_t));
+   if(jobs == NULL || files == NULL || latency == NULL)
+   {
+      fprintf(stderr, "%s: Could not allocate %d jobs\n", c->name, c->jobs);
+      free(jobs);
+      free(files);
+      free(latency);
+      return 1;
+   }
+
+   if(bench_setup(c, jobs, files) != 0)
+   {
+      bench_teardown(c, jobs, files);
+      free(jobs);
+      free(files);
+      free(latency);
+      return 1;
+   }
+
+   /* Keep the wipe messages out of the results */
+   fflush(stdout);
+   out = dup(STDOUT_FILENO);
+   freopen("/dev/null", "w", stdout);
+
+   cpu = bench_cpu();
+   start = bench_clock();
+   pool_run(jobs, c->jobs, 0);
+   elapsed = bench_clock() - start;
+   cpu = bench_cpu() - cpu;
+
+   fflush(stdout);
+   dup2(out, STDOUT_FILENO);
+   close(out);
+
+   for(i = 0; i < c->jobs; i++)
+   {
+      if(jobs[i].state != JOB_DONE)
+      {
+         fprintf(stderr, "%s: %s did not finish: %s\n", c->name, jobs[i].target,
+               jobs[i].error ? strerror(jobs[i].error) : "unknown error");
+         failed = 1;
+      }
+      written += jobs[i].written;
+      latency_add(latency, &jobs[i].latency);
+   }
+
+   if(elapsed > 0)
+      result->mbps = (double)written / BENCH_MB / ((double)elapsed / 1e9);
+   if(written > 0)
+      result->cpugb = cpu / ((double)written / 1e9);
+   result->p50 = (double)latency_percentile(latency, 0.50) / 1e3;
+   result->p99 = (double)latency_percentile(latency, 0.99) / 1e3;
+   result->p999 = (double)latency_percentile(latency, 0.999) / 1e3;
+
+   bench_teardown(c, jobs, files);
+   free(jobs);
+   free(files);
+   free(latency);
+   return failed;
+}
+
+static void bench_header(FILE *fp, bool json)
+{
+   if(json)
+      return;
+   fprintf(fp, "netnuke-bench %d\n", BENCH_FORMAT);
+   fprintf(fp, "%-44s %10s %10s %10s %10s %10s\n", "case", "MB/s", "CPU s/GB", "p50 us", "p99 us", "p999 us");
+}
+
+static void bench_print(FILE *fp, const benchresult_t *r, bool json)
+{
+   if(json)
+      fprintf(fp, "{\"format\":%d,\"case\":\"%s\",\"mbps\":%.1f,\"cpu_s_per_gb\":%.3f,"
+            "\"p50_us\":%.1f,\"p99_us\":%.1f,\"p999_us\":%.1f}\n",
+            BENCH_FORMAT, r->name, r->mbps, r->cpugb, r->p50, r->p99, r->p999);
+   else
+      fprintf(fp, "%-44s %10.1f %10.3f %10.1f %10.1f %10.1f\n",
+            r->name, r->mbps, r->cpugb, r->p50, r->p99, r->p999);
+   fflush(fp);
+}
+
+/* Read a file written by --save.  Returns the number of results, or -1
+ * when it can not be read. */
+static int32_t bench_load(const char *path, benchresult_t **results)
+{
+   char line[BUFSIZ];
+   int32_t count = 0, capacity = 0, format = 0;
+   FILE *fp;
+
+   *results = NULL;
+   if((fp = fopen(path, "r")) == NULL)
+   {
+      fprintf(stderr, "%s: %s\n", path, strerror(errno));
+      return -1;
+   }
+
+   while(fgets(line, sizeof(line), fp) != NULL)
+   {
+      benchresult_t r;
+
+      if(sscanf(line, "netnuke-bench %d", &format) == 1)
+         continue;
+      memset(&r, 0, sizeof(r));
+      if(sscanf(line, "%127s %lf %lf %lf %lf %lf", r.name, &r.mbps, &r.cpugb, &r.p50, &r.p99, &r.p999) != 6)
+         continue;
+
+      if(count == capacity)
+      {
+         benchresult_t *grown;
+
+         capacity = capacity ? capacity * 2 : 32;
+         if((grown = (benchresult_t*)realloc(*results, capacity * sizeof(benchresult_t))) == NULL)
+            break;
+         *results = grown;
+      }
+      (*results)[count++] = r;
+   }
+   fclose(fp);
+
+   if(format != BENCH_FORMAT)
+   {
+      fprintf(stderr, "%s: not a netnuke-bench %d baseline\n", path, BENCH_FORMAT);
+      free(*results);
+      *results = NULL;
+      return -1;
+   }
+
+   return count;
+}
+
+/* Compare with the baseline.  Returns the number of regressions. */
+static int32_t bench_compare(FILE *out, const benchresult_t *now, int32_t count, const benchresult_t *base, int32_t nbase,
+      double tolerance)
+{
+   int32_t i, j, regressions = 0;
+
+   fprintf(out, "\n%-44s %10s %10s %8s\n", "case", "base MB/s", "MB/s", "change");
+   for(i = 0; i < count; i++)
+   {
+      for(j = 0; j < nbase; j++)
+         if(strcmp(now[i].name, base[j].name) == 0)
+            break;
+      if(j == nbase || base[j].mbps <= 0)
+      {
+         fprintf(out, "%-44s %10s %10.1f %8s\n", now[i].name, "-", now[i].mbps, "new");
+         continue;
+      }
+
+      double change = (now[i].mbps - base[j].mbps) / base[j].mbps * 100.0;
+      bool slower = change < -tolerance;
+
+      fprintf(out, "%-44s %10.1f %10.1f %+7.1f%%%s\n", now[i].name, base[j].mbps, now[i].mbps, change,
+            slower ? "  REGRESSION" : "");
+      regressions += slower;
+   }
+
+   return regressions;
+}
+
+int main(int argc, char* argv[])
+{
+   benchaxis_t levels = { { 0, 1, 2, 3, 4, 5 }, 6 };
+   benchaxis_t sizes = { { 1048576, 4096, 65536, 4194304 }, 4 };
+   benchaxis_t wmodes = { { 0, 1 }, 2 };
+   benchaxis_t backends = { { IO_AUTO, IO_SYNC, IO_URING, IO_SPLICE }, 4 };
+   benchaxis_t jobs = { { 1, 2, 4, 8 }, 4 };
+   benchaxis_t targets = { { BENCH_TMPFS, BENCH_SPARSE, BENCH_LOOP }, 3 };
+   benchcase_t *cases;
+   benchresult_t *results, *base = NULL;
+   char *save = NULL, *baseline = NULL;
+   double tolerance = 10.0;
+   bool matrix = false, json = false;
+   int32_t ncases = 0, nbase = 0, nresults = 0, failed = 0, max, i;
+   int tok;
+   FILE *fp = NULL;
+
+   for(tok = 1; tok < argc; tok++)
+   {
+      int bad = 0;
+
+      if(ARGMATCH("--help") || ARGMATCH("-h"))
+      {
+         usage(argv[0]);
+         exit(0);
+      }
+      else if(ARGMATCH("--matrix"))
+         matrix = true;
+      else if(ARGMATCH("--json"))
+         json = true;
+      else if(ARGMATCH("--buffered"))
+         bench_buffered = true;
+      else
+      {
+         ARGNULL(+1);
+         if(ARGMATCH("--dir"))
+            bench_dir = argv[tok+1];
+         else if(ARGMATCH("--tmpfs"))
+            bench_tmpfs = argv[tok+1];
+         else if(ARGMATCH("--size"))
+            bad = (bench_size = strtoull(argv[tok+1], NULL, 10) * 1024 * 1024) == 0;
+         else if(ARGMATCH("--levels"))
+            bad = bench_axis(argv[tok+1], NULL, 0, &levels);
+         else if(ARGMATCH("--block-sizes"))
+            bad = bench_axis(argv[tok+1], NULL, 0, &sizes);
+         else if(ARGMATCH("--write-modes"))
+            bad = bench_axis(argv[tok+1], bench_wmodes, 2, &wmodes);
+         else if(ARGMATCH("--backends"))
+            bad = bench_axis(argv[tok+1], bench_backends, 4, &backends);
+         else if(ARGMATCH("--jobs"))
+            bad = bench_axis(argv[tok+1], NULL, 0, &jobs);
+         else if(ARGMATCH("--targets"))
+            bad = bench_axis(argv[tok+1], bench_targets, 3, &targets);
+         else if(ARGMATCH("--queue-depth"))
+            bad = (bench_qdepth = atoi(argv[tok+1])) < 1;
+         else if(ARGMATCH("--save"))
+            save = argv[tok+1];
+         else if(ARGMATCH("--baseline"))
+            baseline = argv[tok+1];
+         else if(ARGMATCH("--tolerance"))
+            bad = (tolerance = atof(argv[tok+1])) < 0;
+         else
+         {
+            fprintf(stderr, "unknown option %s\n", argv[tok]);
+            exit(1);
+         }
+         tok++;
+      }
+
+      if(bad)
+      {
+         fprintf(stderr, "invalid value for %s\n", argv[tok-1]);
+         exit(1);
+      }
+   }
+
+   for(i = 0; i < levels.count; i++)
+      if(levels.values[i] > NUKE_RANDOM_CRYPTO)
+      {
+         fprintf(stderr, "level %d is not benchmarked, the offload levels do nothing to files\n", levels.values[i]);
+         exit(1);
+      }
+   for(i = 0; i < sizes.count; i++)
+      if(sizes.values[i] < 512 || sizes.values[i] % 512 != 0 || (uint64_t)sizes.values[i] > bench_size)
+      {
+         fprintf(stderr, "block size %d is not a multiple of 512 no larger than --size\n", sizes.values[i]);
+         exit(1);
+      }
+   for(i = 0; i < jobs.count; i++)
+      if(jobs.values[i] < 1)
+      {
+         fprintf(stderr, "--jobs needs at least one device\n");
+         exit(1);
+      }
+
+   if(baseline != NULL && (nbase = bench_load(baseline, &base)) < 0)
+      exit(1);
+
+   max = levels.count * sizes.count * wmodes.count * backends.count * jobs.count * targets.count;
+   cases = (benchcase_t*)calloc(max, sizeof(benchcase_t));
+   results = (benchresult_t*)calloc(max, sizeof(benchresult_t));
+   if(cases == NULL || results == NULL)
+   {
+      fprintf(stderr, "Could not allocate %d cases\n", max);
+      exit(1);
+   }
+
+   if(matrix)
+   {
+      int32_t l, s, w, b, j, t;
+
+      for(t = 0; t < targets.count; t++)
+      for(j = 0; j < jobs.count; j++)
+      for(b = 0; b < backends.count; b++)
+      for(w = 0; w < wmodes.count; w++)
+      for(s = 0; s < sizes.count; s++)
+      for(l = 0; l < levels.count; l++)
+      {
+         benchcase_t c = { levels.values[l], sizes.values[s], wmodes.values[w],
+            backends.values[b], jobs.values[j], targets.values[t], "" };
+         bench_add(cases, &ncases, c);
+      }
+   }
+   else
+   {
+      benchcase_t c = { levels.values[0], sizes.values[0], wmodes.values[0],
+         backends.values[0], jobs.values[0], targets.values[0], "" };
+      benchcase_t v;
+
+      for(i = 0; i < levels.count; i++)
+      {
+         v = c;
+         v.level = levels.values[i];
+         bench_add(cases, &ncases, v);
+      }
+      for(i = 0; i < sizes.count; i++)
+      {
+         v = c;
+         v.blocksize = sizes.values[i];
+         bench_add(cases, &ncases, v);
+      }
+      for(i = 0; i < wmodes.count; i++)
+      {
+         v = c;
+         v.wmode = wmodes.values[i];
+         bench_add(cases, &ncases, v);
+      }
+      for(i = 0; i < backends.count; i++)
+      {
+         v = c;
+         v.iotype = backends.values[i];
+         bench_add(cases, &ncases, v);
+      }
+      for(i = 0; i < jobs.count; i++)
+      {
+         v = c;
+         v.jobs = jobs.values[i];
+         bench_add(cases, &ncases, v);
+      }
+      for(i = 0; i < targets.count; i++)
+      {
+         v = c;
+         v.target = targets.values[i];
+         bench_add(cases, &ncases, v);
+      }
+   }
+
+   if(save != NULL && (fp = fopen(save, "w")) == NULL)
+   {
+      fprintf(stderr, "%s: %s\n", save, strerror(errno));
+      exit(1);
+   }
+
+   sched_limits(0, 0);
+   bench_header(stdout, json);
+   if(fp != NULL)
+      bench_header(fp, false);
+
+   for(i = 0; i < ncases; i++)
+   {
+      if(bench_run(&cases[i], &results[nresults]) != 0)
+      {
+         fprintf(stderr, "%s: failed, left out of the results\n", cases[i].name);
+         failed++;
+         continue;
+      }
+
+      bench_print(stdout, &results[nresults], json);
+      if(fp != NULL)
+         bench_print(fp, &results[nresults], false);
+      nresults++;
+   }
+
+   if(fp != NULL)
+      fclose(fp);
+
+   if(baseline != NULL && bench_compare(json ? stderr : stdout, results, nresults, base, nbase, tolerance) > 0)
+      failed++;
+
+   free(base);
+   free(results);
+   free(cases);
+   return failed ? 1 : 0;
+}
@@ -0,0 +1,300 @@
+/**
+ *  NetNuke - Erases all storage media deteced by the system
+ *  Copyright (C) 2009  Joseph Hunkeler <jhunkeler@gmail.com, jhunk@stsci.edu>
+ *
+ *  This file is part of NetNuke.
+ *
+ *  NetNuke is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  NetNuke is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with NetNuke.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * Generated data pipeline
+ *
+ * The slow random and crypto levels write data that depends on the offset
+ * and the pass, so it used to be generated into every write buffer just
+ * before the write went out.  Instead generator threads fill a ring of
+ * chunks ahead of the writer, in the order they will be written, and run
+ * on from the end of one pass into the start of the next so a new pass
+ * finds its first chunks ready.  The writer only ever waits on the device.
+ *
+ * Like the read-ahead the consumer takes chunks in order and hands back
+ * the oldest.  Each thread keeps its own generator state, the job's is
+ * left to the writer.  Threads inherit the CPU affinity and memory policy
+ * of the worker that started them, so they stay on the device's node.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "netnuke.h"
+
+struct GENERATOR_T
+{
+   nukejob_t *job;
+   uint64_t chunksize;
+   uint64_t nchunks;           /* Per pass */
+   int32_t pass;               /* Of the first chunk */
+   uint64_t first;             /* Chunk of that pass to start at */
+   uint64_t total;             /* Chunks up to the end of the last pass */
+
+   pthread_t threads[GENERATE_THREADS];
+   int32_t nthreads;
+   pthread_mutex_t lock;
+   pthread_cond_t cond;
+   rachunk_t *ring;
+   int32_t *passes;            /* Pass of each ring chunk */
+   uint64_t *ready;            /* Sequence number + 1 once filled */
+   int32_t count;
+   uint64_t claimed;           /* Chunks handed to a thread */
+   uint64_t taken;             /* Chunks handed to the writer */
+   uint64_t consumed;          /* Chunks given back by the writer */
+   bool stop;
+};
+
+/* Where the chunk with this sequence number goes */
+static void generate_locate(generator_t *gen, uint64_t seq, int32_t *pass, uint64_t *chunk)
+{
+   uint64_t rest = gen->nchunks - gen->first;
+
+   if(seq < rest)
+   {
+      *pass = gen->pass;
+      *chunk = gen->first + seq;
+      return;
+   }
+
+   seq -= rest;
+   *pass = gen->pass + 1 + (int32_t)(seq / gen->nchunks);
+   *chunk = seq % gen->nchunks;
+}
+
+static void* generate_thread(void *arg)
+{
+   generator_t *gen = (generator_t*)arg;
+   nukejob_t *job = gen->job;
+   int32_t current = 0;
+   bool crypto = false;
+   rng_t rng;
+   aesctr_t aes;
+
+   while(1)
+   {
+      rachunk_t *slot;
+      uint64_t seq, chunk;
+      int32_t pass;
+
+      /* Claim the next chunk once its buffer is free */
+      pthread_mutex_lock(&gen->lock);
+      while(gen->claimed < gen->total && gen->claimed - gen->consumed >= (uint64_t)gen->count && !gen->stop)
+         pthread_cond_wait(&gen->cond, &gen->lock);
+      if(gen->stop || gen->claimed >= gen->total)
+      {
+         pthread_mutex_unlock(&gen->lock);
+         break;
+      }
+      seq = gen->claimed++;
+      slot = &gen->ring[seq % gen->count];
+      pthread_mutex_unlock(&gen->lock);
+
+      generate_locate(gen, seq, &pass, &chunk);
+      if(pass != current)
+      {
+         crypto = job_level(job, pass) == NUKE_RANDOM_CRYPTO;
+         rng_init(&rng, job->seed, pass);
+         if(crypto)
+            aes_init(&aes, job->aeskey, job->aesbits, job->aesnonce, pass);
+         current = pass;
+      }
+
+      slot->offset = chunk * gen->chunksize;
+      slot->length = job->size - slot->offset < gen->chunksize ? job->size - slot->offset : gen->chunksize;
+      slot->error = 0;
+      if(crypto)
+         aes_fill(&aes, slot->buf, slot->length, slot->offset);
+      else
+         rng_fill(&rng, slot->buf, slot->length, slot->offset);
+
+      pthread_mutex_lock(&gen->lock);
+      gen->passes[seq % gen->count] = pass;
+      gen->ready[seq % gen->count] = seq + 1;
+      pthread_cond_broadcast(&gen->cond);
+      pthread_mutex_unlock(&gen->lock);
+   }
+
+   memset(&aes, 0, sizeof(aes));
+   return NULL;
+}
+
+/* Threads a generator runs.  One CPU is left to the writer, without a
+ * second one generating ahead only costs memory bandwidth. */
+int32_t generate_threads(void)
+{
+   long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+   if(cpus < 2)
+      return 0;
+   return cpus - 1 < GENERATE_THREADS ? (int32_t)(cpus - 1) : GENERATE_THREADS;
+}
+
+/* Start generating the data of job from offset of pass to the end of its
+ * last pass into count chunks of chunksize bytes laid out back to back in
+ * pool.  Returns NULL and sets errno on failure. */
+generator_t* generate_open(nukejob_t *job, char *pool, int32_t count, uint64_t chunksize,
+      int32_t pass, uint64_t offset)
+{
+   generator_t *gen;
+   int32_t i, threads, last;
+   int error = EAGAIN;
+
+   if((gen = (generator_t*)calloc(1, sizeof(generator_t))) == NULL)
+      return NULL;
+   gen->ring = (rachunk_t*)calloc(count, sizeof(rachunk_t));
+   gen->passes = (int32_t*)calloc(count, sizeof(int32_t));
+   gen->ready = (uint64_t*)calloc(count, sizeof(uint64_t));
+   if(gen->ring == NULL || gen->passes == NULL || gen->ready == NULL)
+   {
+      free(gen->ring);
+      free(gen->passes);
+      free(gen->ready);
+      free(gen);
+      errno = ENOMEM;
+      return NULL;
+   }
+
+   gen->job = job;
+   gen->chunksize = chunksize;
+   gen->nchunks = (job->size + chunksize - 1) / chunksize;
+   gen->pass = pass;
+   gen->first = offset / chunksize;
+   if(gen->first > gen->nchunks)
+      gen->first = gen->nchunks;
+   /* A profile may write something else in between, generating stops
+    * before it and starts over at the next generated pass */
+   for(last = pass; last < job->passes && level_generated(job_level(job, last + 1)); last++)
+      ;
+   gen->total = gen->nchunks - gen->first + (uint64_t)(last - pass) * gen->nchunks;
+   gen->count = count;
+   for(i = 0; i < count; i++)
+      gen->ring[i].buf = pool + (size_t)i * chunksize;
+
+   pthread_mutex_init(&gen->lock, NULL);
+   pthread_cond_init(&gen->cond, NULL);
+
+   if((threads = generate_threads()) < 1)
+      threads = 1;
+   for(i = 0; i < threads; i++)
+   {
+      if((error = pthread_create(&gen->threads[i], NULL, generate_thread, gen)) != 0)
+         break;
+      gen->nthreads++;
+   }
+
+   if(gen->nthreads == 0)
+   {
+      pthread_cond_destroy(&gen->cond);
+      pthread_mutex_destroy(&gen->lock);
+      free(gen->ring);
+      free(gen->passes);
+      free(gen->ready);
+      free(gen);
+      errno = error;
+      return NULL;
+   }
+
+   lwrite("%s: %d generator thread(s) filling %d chunks of %ju bytes from pass %d byte %ju\n", job->target,
+         gen->nthreads, count, (uintmax_t)chunksize, pass, (uintmax_t)(gen->first * chunksize));
+   return gen;
+}
+
+/* Chunks taken and not yet given back */
+int32_t generate_held(generator_t *gen)
+{
+   return (int32_t)(gen->taken - gen->consumed);
+}
+
+/* A chunk taken and not yet given back, 0 is the oldest.  NULL when there
+ * are not that many. */
+rachunk_t* generate_chunk(generator_t *gen, int32_t index, int32_t *pass)
+{
+   uint64_t seq = gen->consumed + index;
+
+   if(index < 0 || seq >= gen->taken)
+      return NULL;
+   *pass = gen->passes[seq % gen->count];
+   return &gen->ring[seq % gen->count];
+}
+
+/* The next chunk in write order, NULL once everything was generated.
+ * Blocks until a thread has filled it, so a writer holding every chunk
+ * must give one back first. */
+rachunk_t* generate_next(generator_t *gen, int32_t *pass)
+{
+   rachunk_t *chunk = NULL;
+   uint64_t seq;
+
+   pthread_mutex_lock(&gen->lock);
+   seq = gen->taken;
+   while(seq < gen->total && gen->ready[seq % gen->count] != seq + 1 && !gen->stop)
+      pthread_cond_wait(&gen->cond, &gen->lock);
+   if(seq < gen->total && !gen->stop)
+   {
+      chunk = &gen->ring[seq % gen->count];
+      *pass = gen->passes[seq % gen->count];
+      gen->taken++;
+   }
+   pthread_mutex_unlock(&gen->lock);
+
+   return chunk;
+}
+
+/* Hand the oldest chunk's buffer back to the generator threads */
+void generate_release(generator_t *gen)
+{
+   pthread_mutex_lock(&gen->lock);
+   if(gen->consumed < gen->taken)
+      gen->consumed++;
+   pthread_cond_broadcast(&gen->cond);
+   pthread_mutex_unlock(&gen->lock);
+}
+
+void generate_close(generator_t *gen)
+{
+   int32_t i;
+
+   if(gen == NULL)
+      return;
+
+   pthread_mutex_lock(&gen->lock);
+   gen->stop = true;
+   pthread_cond_broadcast(&gen->cond);
+   pthread_mutex_unlock(&gen->lock);
+
+   for(i = 0; i < gen->nthreads; i++)
+      pthread_join(gen->threads[i], NULL);
+
+   pthread_cond_destroy(&gen->cond);
+   pthread_mutex_destroy(&gen->lock);
+   free(gen->ring);
+   free(gen->passes);
+   free(gen->ready);
+   free(gen);
+}
@@ -0,0 +1,672 @@
+/**
+ *  NetNuke - Erases all storage media deteced by the system
+ *  Copyright (C) 2009  Joseph Hunkeler <jhunkeler@gmail.com, jhunk@stsci.edu>
+ *
+ *  This file is part of NetNuke.
+ *
+ *  NetNuke is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  NetNuke is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with NetNuke.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/uio.h>
+#ifndef __FreeBSD__
+   #include <fcntl.h>
+   #include <sys/mman.h>
+   #include <sys/syscall.h>
+   #include <linux/io_uring.h>
+#endif
+
+#include "netnuke.h"
+
+/* Alignment of every I/O buffer, good enough for any sector size */
+#define IO_ALIGN 4096
+
+/*
+ * Synchronous backend
+ *
+ * Every submission is written with pwrite() on the spot, so there is never
+ * more than one request in flight.  This is the historic behavior and
+ * works on any file descriptor.
+ */
+typedef struct IOSYNC_T
+{
+   ioslot_t *done;
+} iosync_t;
+
+static int io_sync_setup(ioctx_t *io)
+{
+   io->depth = 1;
+   io->priv = calloc(1, sizeof(iosync_t));
+   return io->priv == NULL ? -ENOMEM : 0;
+}
+
+static void io_sync_teardown(ioctx_t *io)
+{
+   free(io->priv);
+   io->priv = NULL;
+}
+
+static int io_sync_submit(ioctx_t *io, ioslot_t *slot)
+{
+   iosync_t *sync = (iosync_t*)io->priv;
+   ssize_t result = pwrite(io->fd, slot->data, slot->length, slot->offset);
+
+   slot->result = result < 0 ? -errno : result;
+   sync->done = slot;
+   return 0;
+}
+
+static ioslot_t* io_sync_reap(ioctx_t *io)
+{
+   iosync_t *sync = (iosync_t*)io->priv;
+   ioslot_t *slot = sync->done;
+
+   sync->done = NULL;
+   return slot;
+}
+
+static const iobackend_t io_sync_backend = {
+   "sync",
+   io_sync_setup,
+   io_sync_teardown,
+   io_sync_submit,
+   io_sync_reap
+};
+
+#ifndef __FreeBSD__
+/*
+ * io_uring backend
+ *
+ * Talks to the kernel directly through the three io_uring system calls so
+ * there is no dependency on liburing.  Slot buffers are registered with the
+ * ring once and written with IORING_OP_WRITE_FIXED, which saves the kernel
+ * from pinning the pages again on every request.
+ */
+typedef struct IOURING_T
+{
+   int ringfd;
+   bool fixed;
+   uint32_t pending;      /* Queued but not yet handed to the kernel */
+
+   void *sq_ring;
+   size_t sq_ring_size;
+   unsigned *sq_head;
+   unsigned *sq_tail;
+   unsigned *sq_mask;
+   unsigned *sq_array;
+   struct io_uring_sqe *sqes;
+   size_t sqes_size;
+
+   void *cq_ring;
+   size_t cq_ring_size;
+   unsigned *cq_head;
+   unsigned *cq_tail;
+   unsigned *cq_mask;
+   struct io_uring_cqe *cqes;
+} iouring_t;
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+   return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned submit, unsigned complete, unsigned flags)
+{
+   return (int)syscall(__NR_io_uring_enter, fd, submit, complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nargs)
+{
+   return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nargs);
+}
+
+static bool io_uring_supports(int ringfd, int opcode)
+{
+   size_t len = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+   struct io_uring_probe *probe = (struct io_uring_probe*)calloc(1, len);
+   bool supported = false;
+
+   if(probe == NULL)
+      return false;
+
+   if(sys_io_uring_register(ringfd, IORING_REGISTER_PROBE, probe, 256) == 0)
+   {
+      if(opcode <= probe->last_op)
+         supported = (probe->ops[opcode].flags & IO_URING_OP_SUPPORTED) != 0;
+   }
+
+   free(probe);
+   return supported;
+}
+
+static void io_uring_teardown(ioctx_t *io)
+{
+   iouring_t *ring = (iouring_t*)io->priv;
+
+   if(ring == NULL)
+      return;
+
+   if(ring->sqes != NULL && ring->sqes != MAP_FAILED)
+      munmap(ring->sqes, ring->sqes_size);
+   if(ring->cq_ring != NULL && ring->cq_ring != MAP_FAILED && ring->cq_ring != ring->sq_ring)
+      munmap(ring->cq_ring, ring->cq_ring_size);
+   if(ring->sq_ring != NULL && ring->sq_ring != MAP_FAILED)
+      munmap(ring->sq_ring, ring->sq_ring_size);
+   if(ring->ringfd > -1)
+      close(ring->ringfd);
+
+   free(ring);
+   io->priv = NULL;
+}
+
+static int io_uring_setup_ring(ioctx_t *io)
+{
+   struct io_uring_params p;
+   struct iovec *iov;
+   iouring_t *ring;
+   int32_t i;
+   int error;
+
+   ring = (iouring_t*)calloc(1, sizeof(iouring_t));
+   if(ring == NULL)
+      return -ENOMEM;
+   ring->ringfd = -1;
+   io->priv = ring;
+
+   memset(&p, 0, sizeof(p));
+   ring->ringfd = sys_io_uring_setup(io->depth, &p);
+   if(ring->ringfd < 0)
+   {
+      error = -errno;
+      io_uring_teardown(io);
+      return error;
+   }
+
+   ring->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+   ring->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+   /* Newer kernels map both rings with a single mmap */
+   if(p.features & IORING_FEAT_SINGLE_MMAP)
+   {
+      if(ring->cq_ring_size > ring->sq_ring_size)
+         ring->sq_ring_size = ring->cq_ring_size;
+      ring->cq_ring_size = ring->sq_ring_size;
+   }
+
+   ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+         MAP_SHARED | MAP_POPULATE, ring->ringfd, IORING_OFF_SQ_RING);
+   if(ring->sq_ring == MAP_FAILED)
+   {
+      error = -errno;
+      io_uring_teardown(io);
+      return error;
+   }
+
+   if(p.features & IORING_FEAT_SINGLE_MMAP)
+      ring->cq_ring = ring->sq_ring;
+   else
+   {
+      ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring->ringfd, IORING_OFF_CQ_RING);
+      if(ring->cq_ring == MAP_FAILED)
+      {
+         error = -errno;
+         io_uring_teardown(io);
+         return error;
+      }
+   }
+
+   ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+   ring->sqes = (struct io_uring_sqe*)mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+         MAP_SHARED | MAP_POPULATE, ring->ringfd, IORING_OFF_SQES);
+   if(ring->sqes == MAP_FAILED)
+   {
+      error = -errno;
+      io_uring_teardown(io);
+      return error;
+   }
+
+   ring->sq_head = (unsigned*)((char*)ring->sq_ring + p.sq_off.head);
+   ring->sq_tail = (unsigned*)((char*)ring->sq_ring + p.sq_off.tail);
+   ring->sq_mask = (unsigned*)((char*)ring->sq_ring + p.sq_off.ring_mask);
+   ring->sq_array = (unsigned*)((char*)ring->sq_ring + p.sq_off.array);
+   ring->cq_head = (unsigned*)((char*)ring->cq_ring + p.cq_off.head);
+   ring->cq_tail = (unsigned*)((char*)ring->cq_ring + p.cq_off.tail);
+   ring->cq_mask = (unsigned*)((char*)ring->cq_ring + p.cq_off.ring_mask);
+   ring->cqes = (struct io_uring_cqe*)((char*)ring->cq_ring + p.cq_off.cqes);
+
+   /* The kernel may round the ring up, never down */
+   if((int32_t)p.sq_entries < io->depth)
+      io->depth = p.sq_entries;
+
+   /* Register the slot buffers, and the shared buffer after them, once
+    * so the kernel keeps them pinned.  This can fail when RLIMIT_MEMLOCK
+    * is small, plain writes still work */
+   iov = (struct iovec*)calloc(io->depth + 1, sizeof(struct iovec));
+   if(iov != NULL)
+   {
+      int32_t count = 0;
+
+      for(i = 0; i < io->depth && io->bufsize > 0; i++)
+      {
+         iov[count].iov_base = io->slots[i].buf;
+         iov[count].iov_len = io->bufsize;
+         count++;
+      }
+      if(io->shared != NULL)
+      {
+         iov[count].iov_base = io->shared;
+         iov[count].iov_len = io->sharedsize;
+         count++;
+      }
+      if(count > 0)
+         ring->fixed = sys_io_uring_register(ring->ringfd, IORING_REGISTER_BUFFERS, iov, count) == 0;
+      free(iov);
+   }
+
+   if(!ring->fixed && !io_uring_supports(ring->ringfd, IORING_OP_WRITE))
+   {
+      io_uring_teardown(io);
+      return -EOPNOTSUPP;
+   }
+
+   return 0;
+}
+
+static int io_uring_submit(ioctx_t *io, ioslot_t *slot)
+{
+   iouring_t *ring = (iouring_t*)io->priv;
+   unsigned tail = *ring->sq_tail;
+   unsigned index = tail & *ring->sq_mask;
+   struct io_uring_sqe *sqe = &ring->sqes[index];
+
+   memset(sqe, 0, sizeof(*sqe));
+   sqe->opcode = ring->fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+   sqe->fd = io->fd;
+   sqe->addr = (uint64_t)(uintptr_t)slot->data;
+   sqe->len = (uint32_t)slot->length;
+   sqe->off = slot->offset;
+   sqe->buf_index = ring->fixed ? (uint16_t)slot->bufindex : 0;
+   sqe->user_data = (uint64_t)(uintptr_t)slot;
+
+   ring->sq_array[index] = index;
+   __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+   /* Handed to the kernel in one batch by the next reap */
+   ring->pending++;
+   return 0;
+}
+
+static ioslot_t* io_uring_reap(ioctx_t *io)
+{
+   iouring_t *ring = (iouring_t*)io->priv;
+   int submitted;
+
+   while(1)
+   {
+      unsigned head = *ring->cq_head;
+      unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+      if(head != tail)
+      {
+         struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+         ioslot_t *slot = (ioslot_t*)(uintptr_t)cqe->user_data;
+
+         slot->result = cqe->res;
+         __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+         return slot;
+      }
+
+      /* The kernel may take fewer entries than offered, and the rest are
+       * still queued for the next call.  EAGAIN and EBUSY mean it is short
+       * of resources or completions must be reaped first: retry */
+      submitted = sys_io_uring_enter(ring->ringfd, ring->pending, 1, IORING_ENTER_GETEVENTS);
+      if(submitted < 0)
+      {
+         if(errno == EINTR || errno == EAGAIN || errno == EBUSY)
+            continue;
+         return NULL;
+      }
+      ring->pending -= (uint32_t)submitted;
+   }
+}
+
+static const iobackend_t io_uring_backend = {
+   "io_uring",
+   io_uring_setup_ring,
+   io_uring_teardown,
+   io_uring_submit,
+   io_uring_reap
+};
+
+/*
+ * splice backend
+ *
+ * For targets written through the page cache.  The data is mapped into a
+ * pipe with vmsplice(), which takes references to the pages instead of
+ * copying them, and moved from there into the target with splice().  The
+ * only copy left is the one into the page cache, so wipes writing from
+ * the shared buffer do not stream it through a bounce buffer first.  Like
+ * the synchronous backend there is one request at a time, and the pipe
+ * is always empty again before a submission returns, so the buffer can
+ * be reused right away.
+ */
+typedef struct IOSPLICE_T
+{
+   int pipe[2];
+   size_t pipesize;
+   ioslot_t *done;
+} iosplice_t;
+
+static void io_splice_teardown(ioctx_t *io)
+{
+   iosplice_t *sp = (iosplice_t*)io->priv;
+
+   if(sp == NULL)
+      return;
+   if(sp->pipe[0] > -1)
+      close(sp->pipe[0]);
+   if(sp->pipe[1] > -1)
+      close(sp->pipe[1]);
+   free(sp);
+   io->priv = NULL;
+}
+
+static int io_splice_setup(ioctx_t *io)
+{
+   iosplice_t *sp;
+   int size, error;
+
+   /* Direct writes can not come out of a pipe */
+   if(fcntl(io->fd, F_GETFL) & O_DIRECT)
+      return -EINVAL;
+
+   io->depth = 1;
+   if((sp = (iosplice_t*)calloc(1, sizeof(iosplice_t))) == NULL)
+      return -ENOMEM;
+   sp->pipe[0] = sp->pipe[1] = -1;
+   io->priv = sp;
+
+   if(pipe(sp->pipe) != 0)
+   {
+      error = -errno;
+      io_splice_teardown(io);
+      return error;
+   }
+
+   /* Draining after a failed splice must not block on an empty pipe */
+   fcntl(sp->pipe[0], F_SETFL, O_NONBLOCK);
+
+   /* A pipe as large as a block moves it in one go, when allowed */
+   if(io->bufsize > 0)
+      fcntl(sp->pipe[1], F_SETPIPE_SZ, (int)(io->bufsize > 1024 * 1024 ? 1024 * 1024 : io->bufsize));
+   if((size = fcntl(sp->pipe[1], F_GETPIPE_SZ)) <= 0)
+      size = 65536;
+   sp->pipesize = (size_t)size;
+
+   return 0;
+}
+
+static int io_splice_submit(ioctx_t *io, ioslot_t *slot)
+{
+   iosplice_t *sp = (iosplice_t*)io->priv;
+   uint64_t done = 0;
+   loff_t offset = (loff_t)slot->offset;
+
+   slot->result = 0;
+   while(done < slot->length)
+   {
+      struct iovec iov;
+      ssize_t mapped, moved = 0;
+
+      iov.iov_base = slot->data + done;
+      iov.iov_len = slot->length - done < sp->pipesize ? slot->length - done : sp->pipesize;
+      if((mapped = vmsplice(sp->pipe[1], &iov, 1, 0)) <= 0)
+      {
+         slot->result = mapped < 0 ? -errno : -EIO;
+         break;
+      }
+
+      while(moved < mapped)
+      {
+         ssize_t result = splice(sp->pipe[0], NULL, io->fd, &offset, mapped - moved, SPLICE_F_MOVE);
+
+         if(result <= 0)
+         {
+            slot->result = result < 0 ? -errno : -EIO;
+            break;
+         }
+         moved += result;
+      }
+
+      /* Leave nothing behind in the pipe for the next request */
+      if(moved < mapped)
+      {
+         char sink[4096];
+
+         while(read(sp->pipe[0], sink, sizeof(sink)) > 0)
+            ;
+         break;
+      }
+      done += moved;
+   }
+
+   if(slot->result == 0)
+      slot->result = (int64_t)done;
+   sp->done = slot;
+   return 0;
+}
+
+static ioslot_t* io_splice_reap(ioctx_t *io)
+{
+   iosplice_t *sp = (iosplice_t*)io->priv;
+   ioslot_t *slot = sp->done;
+
+   sp->done = NULL;
+   return slot;
+}
+
+static const iobackend_t io_splice_backend = {
+   "splice",
+   io_splice_setup,
+   io_splice_teardown,
+   io_splice_submit,
+   io_splice_reap
+};
+#endif
+
+const char* io_type_str(ioType_t type)
+{
+   switch(type)
+   {
+      case IO_AUTO:
+         return "auto";
+      case IO_SYNC:
+         return "sync";
+      case IO_URING:
+         return "io_uring";
+      case IO_SPLICE:
+         return "splice";
+   }
+   return "unknown";
+}
+
+int io_type_parse(const char *str, ioType_t *type)
+{
+   if(strcmp(str, "auto") == 0)
+      *type = IO_AUTO;
+   else if(strcmp(str, "sync") == 0)
+      *type = IO_SYNC;
+   else if(strcmp(str, "uring") == 0 || strcmp(str, "io_uring") == 0)
+      *type = IO_URING;
+   else if(strcmp(str, "splice") == 0)
+      *type = IO_SPLICE;
+   else
+      return 1;
+   return 0;
+}
+
+static void io_free_slots(ioctx_t *io)
+{
+   numa_free(io->pool, io->poolsize);
+   free(io->slots);
+   io->pool = NULL;
+   io->slots = NULL;
+}
+
+int io_open(ioctx_t *io, ioType_t type, int fd, int32_t depth, uint64_t bufsize,
+      char *shared, uint64_t sharedsize)
+{
+   int32_t i;
+   int error = 0;
+   uint64_t stride;
+
+   memset(io, 0, sizeof(ioctx_t));
+   io->fd = fd;
+   io->depth = depth < 1 ? 1 : depth;
+   io->bufsize = bufsize;
+   io->shared = shared;
+   io->sharedsize = sharedsize;
+
+   if(type == IO_SYNC || type == IO_SPLICE)
+      io->depth = 1;
+
+   io->slots = (ioslot_t*)calloc(io->depth, sizeof(ioslot_t));
+   if(io->slots == NULL)
+      return -ENOMEM;
+
+   /* Every slot starts on an aligned boundary so O_DIRECT accepts it.
+    * Slots that only ever point into the shared buffer need no memory */
+   stride = (bufsize + IO_ALIGN - 1) / IO_ALIGN * IO_ALIGN;
+   io->poolsize = io->depth * stride;
+   if(stride > 0 && (io->pool = (char*)numa_alloc(io->poolsize)) == NULL)
+   {
+      io_free_slots(io);
+      return -ENOMEM;
+   }
+
+   for(i = 0; i < io->depth; i++)
+   {
+      io->slots[i].buf = io->pool ? io->pool + i * stride : NULL;
+      io->slots[i].data = io->slots[i].buf;
+      io->slots[i].index = i;
+      io->slots[i].bufindex = i;
+   }
+
+#ifndef __FreeBSD__
+   if(type == IO_SPLICE)
+   {
+      io->ops = &io_splice_backend;
+      if((error = io->ops->setup(io)) == 0)
+         return 0;
+
+      lwrite("splice is unavailable (%s), using synchronous writes\n", strerror(-error));
+   }
+   else if(type != IO_SYNC)
+   {
+      io->ops = &io_uring_backend;
+      if((error = io->ops->setup(io)) == 0)
+         return 0;
+
+      if(type == IO_URING)
+         lwrite("io_uring is unavailable (%s), using synchronous writes\n", strerror(-error));
+   }
+#endif
+
+   /* Fall back to the synchronous path, it always works */
+   io->ops = &io_sync_backend;
+   if((error = io->ops->setup(io)) != 0)
+      io_free_slots(io);
+
+   return error;
+}
+
+void io_close(ioctx_t *io)
+{
+   /* Never let the kernel write out of memory we are about to free */
+   while(io->inflight > 0)
+   {
+      if(io_reap(io) == NULL)
+         break;
+   }
+
+   if(io->ops != NULL)
+      io->ops->teardown(io);
+   io_free_slots(io);
+   io->ops = NULL;
+}
+
+ioslot_t* io_slot(ioctx_t *io)
+{
+   int32_t i;
+
+   for(i = 0; i < io->depth; i++)
+   {
+      if(!io->slots[i].busy)
+      {
+         /* Writes from the slot's own buffer unless told otherwise */
+         io->slots[i].data = io->slots[i].buf;
+         io->slots[i].bufindex = i;
+         return &io->slots[i];
+      }
+   }
+   return NULL;
+}
+
+/* Point a slot at part of the shared buffer instead of its own */
+void io_use_shared(ioctx_t *io, ioslot_t *slot, char *data)
+{
+   slot->data = data;
+   slot->bufindex = io->bufsize > 0 ? io->depth : 0;
+}
+
+int io_submit(ioctx_t *io, ioslot_t *slot)
+{
+   int error;
+
+   slot->submitted = latency_now();
+   error = io->ops->submit(io, slot);
+
+   if(error == 0)
+   {
+      slot->busy = true;
+      io->inflight++;
+   }
+   return error;
+}
+
+ioslot_t* io_reap(ioctx_t *io)
+{
+   ioslot_t *slot;
+
+   if(io->inflight < 1)
+      return NULL;
+
+   slot = io->ops->reap(io);
+   if(slot != NULL)
+   {
+      slot->latency = latency_now() - slot->submitted;
+      slot->busy = false;
+      io->inflight--;
+   }
+   return slot;
+}
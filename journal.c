@@ -0,0 +1,352 @@
+/**
+ *  NetNuke - Erases all storage media deteced by the system
+ *  Copyright (C) 2009  Joseph Hunkeler <jhunkeler@gmail.com, jhunk@stsci.edu>
+ *
+ *  This file is part of NetNuke.
+ *
+ *  NetNuke is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  NetNuke is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with NetNuke.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * Checkpoint journal
+ *
+ * One line per device records everything needed to pick an interrupted
+ * wipe up where it stopped: the identity of the device, the level, the
+ * random seed, key and pattern, the pass being written and the offset
+ * below which that pass is known to be on the media.  Workers update the
+ * journal every JOURNAL_INTERVAL seconds after an fdatasync(2), and at the
+ * end of every pass.  The file is replaced through a temporary copy, so a
+ * crash at any point leaves the previous checkpoint intact.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <string.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include <limits.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "netnuke.h"
+
+#define JOURNAL_MAGIC "netnuke-journal 1"
+
+static char journal_path[PATH_MAX];
+static nukejob_t *journal_jobs = NULL;
+static int32_t journal_count = 0;
+static pthread_mutex_t journal_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Serial numbers may hold spaces, the journal is split on them */
+static void journal_word(const char *in, char *out, size_t size)
+{
+   size_t i;
+
+   for(i = 0; in[i] != '\0' && i + 1 < size; i++)
+      out[i] = isspace((unsigned char)in[i]) || in[i] == '=' ? '_' : in[i];
+   out[i] = '\0';
+   if(i == 0)
+      snprintf(out, size, "-");
+}
+
+static void journal_line(FILE *fp, nukejob_t *job)
+{
+   char serial[sizeof(job->device.serial)];
+   char pattern[PATTERN_MAX * 2 + 1];
+   char key[65], nonce[17];
+   char profile[sizeof(job->profile->name)];
+
+   journal_word(job->device.serial, serial, sizeof(serial));
+   if(job->pattern.length > 0)
+      aes_hex(job->pattern.bytes, job->pattern.length, pattern);
+   else
+      snprintf(pattern, sizeof(pattern), "-");
+
+   fprintf(fp, "target=%s serial=%s size=%ju level=%d blocksize=%d passes=%d pass=%d offset=%ju seed=%016jx pattern=%s",
+         job->target, serial, (uintmax_t)job->size, job->nukelevel, job->blocksize, job->passes,
+         job->ckpass, (uintmax_t)job->ckoffset, (uintmax_t)job->seed, pattern);
+
+   /* The level changes from pass to pass, the profile does not */
+   if(job->profile != NULL)
+   {
+      journal_word(job->profile->name, profile, sizeof(profile));
+      fprintf(fp, " profile=%s", profile);
+   }
+
+   /* Without the key the stream can not be regenerated at the offset */
+   if(job_writes(job, NUKE_RANDOM_CRYPTO) && job->aeskeyed)
+   {
+      aes_hex(job->aeskey, job->aesbits / 8, key);
+      aes_hex(job->aesnonce, sizeof(job->aesnonce), nonce);
+      fprintf(fp, " aesbits=%d aeskey=%s aesnonce=%s", job->aesbits, key, nonce);
+      memset(key, 0, sizeof(key));
+   }
+   fputc('\n', fp);
+}
+
+/* Write the checkpoint of every device with journal_lock held.  Returns
+ * 0 once it is durable. */
+static int journal_write(void)
+{
+   char temporary[PATH_MAX + 8];
+   char directory[PATH_MAX];
+   FILE *fp;
+   int32_t i;
+   int fd, error = 0;
+
+   snprintf(temporary, sizeof(temporary), "%s.tmp", journal_path);
+   if((fp = fopen(temporary, "w")) == NULL)
+      return errno;
+
+   fprintf(fp, "%s\n", JOURNAL_MAGIC);
+   for(i = 0; i < journal_count; i++)
+      journal_line(fp, &journal_jobs[i]);
+
+   if(fflush(fp) != 0 || fsync(fileno(fp)) != 0)
+      error = errno;
+   if(fclose(fp) != 0 && error == 0)
+      error = errno;
+   if(error == 0 && rename(temporary, journal_path) != 0)
+      error = errno;
+
+   /* The rename is only durable once the directory is */
+   if(error == 0)
+   {
+      snprintf(directory, sizeof(directory), "%s", journal_path);
+      if((fd = open(dirname(directory), O_RDONLY)) >= 0)
+      {
+         fsync(fd);
+         close(fd);
+      }
+   }
+   else
+      unlink(temporary);
+
+   return error;
+}
+
+/* Write the checkpoint of every device.  Returns 0 once it is durable. */
+int journal_save(void)
+{
+   int error;
+
+   if(journal_jobs == NULL)
+      return 0;
+
+   pthread_mutex_lock(&journal_lock);
+   error = journal_write();
+   pthread_mutex_unlock(&journal_lock);
+
+   return error;
+}
+
+/* Record that everything of pass below offset is on the media */
+void journal_checkpoint(nukejob_t *job, int32_t pass, uint64_t offset)
+{
+   int error;
+
+   if(!job->journal || journal_jobs == NULL)
+      return;
+
+   /* Another worker's save must never see the new pass with the old offset */
+   pthread_mutex_lock(&journal_lock);
+   job->ckpass = pass;
+   job->ckoffset = offset;
+   error = journal_write();
+   pthread_mutex_unlock(&journal_lock);
+   if(error != 0)
+      lwrite("%s: Could not write the journal %s: %s\n", job->target, journal_path, strerror(error));
+}
+
+/* Copy the state of one journal line into the job it belongs to */
+static void journal_apply(nukejob_t jobs[], int32_t count, char *line)
+{
+   char *target = NULL, *serial = NULL, *pattern = NULL, *aeskey = NULL, *aesnonce = NULL;
+   char *profile = NULL;
+   char *word, *save = NULL;
+   uint64_t size = 0, offset = 0, seed = 0;
+   int32_t level = -1, blocksize = 0, pass = 0, aesbits = 0;
+   char mine[sizeof(jobs[0].device.serial)];
+   char ours[BUFSIZ];
+   nukejob_t *job = NULL;
+   pattern_t bytes;
+   int32_t i;
+
+   for(word = strtok_r(line, " \t\n", &save); word != NULL; word = strtok_r(NULL, " \t\n", &save))
+   {
+      char *value = strchr(word, '=');
+
+      if(value == NULL)
+         continue;
+      *value++ = '\0';
+
+      if(strcmp(word, "target") == 0)
+         target = value;
+      else if(strcmp(word, "serial") == 0)
+         serial = value;
+      else if(strcmp(word, "size") == 0)
+         size = strtoull(value, NULL, 10);
+      else if(strcmp(word, "level") == 0)
+         level = atoi(value);
+      else if(strcmp(word, "blocksize") == 0)
+         blocksize = atoi(value);
+      else if(strcmp(word, "pass") == 0)
+         pass = atoi(value);
+      else if(strcmp(word, "offset") == 0)
+         offset = strtoull(value, NULL, 10);
+      else if(strcmp(word, "seed") == 0)
+         seed = strtoull(value, NULL, 16);
+      else if(strcmp(word, "pattern") == 0)
+         pattern = value;
+      else if(strcmp(word, "aesbits") == 0)
+         aesbits = atoi(value);
+      else if(strcmp(word, "aeskey") == 0)
+         aeskey = value;
+      else if(strcmp(word, "aesnonce") == 0)
+         aesnonce = value;
+      else if(strcmp(word, "profile") == 0)
+         profile = value;
+   }
+
+   if(target == NULL || pass < 1)
+      return;
+
+   for(i = 0; i < count && job == NULL; i++)
+   {
+      if(strcmp(jobs[i].target, target) == 0)
+         job = &jobs[i];
+   }
+   if(job == NULL)
+      return;
+
+   /* Only ever continue on the very same device, with the same data */
+   journal_word(job->device.serial, mine, sizeof(mine));
+   if((serial != NULL && strcmp(serial, mine) != 0) || size != job->size)
+   {
+      lwrite("%s: The journal is for another device (serial %s, %ju bytes), starting over\n",
+            target, serial ? serial : "-", (uintmax_t)size);
+      fprintf(stderr, "%s: The journal is for another device, starting over\n", target);
+      return;
+   }
+   if(job->profile != NULL)
+   {
+      journal_word(job->profile->name, ours, sizeof(ours));
+      if(profile == NULL || strcmp(profile, ours) != 0)
+      {
+         lwrite("%s: The journal is for profile %s, not %s, starting over\n", target, profile ? profile : "-", ours);
+         fprintf(stderr, "%s: The journal is for profile %s, not %s, starting over\n", target, profile ? profile : "-", ours);
+         return;
+      }
+   }
+   else if(profile != NULL)
+   {
+      lwrite("%s: The journal is for profile %s, starting over\n", target, profile);
+      fprintf(stderr, "%s: The journal is for profile %s, starting over\n", target, profile);
+      return;
+   }
+   else if(level != (int32_t)job->nukelevel)
+   {
+      lwrite("%s: The journal is for nuke level %d, not %d, starting over\n", target, level, job->nukelevel);
+      fprintf(stderr, "%s: The journal is for nuke level %d, not %d, starting over\n", target, level, job->nukelevel);
+      return;
+   }
+   if(job_writes(job, NUKE_RANDOM_CRYPTO) && (aeskey == NULL || aesnonce == NULL))
+   {
+      lwrite("%s: The journal holds no key, starting over\n", target);
+      fprintf(stderr, "%s: The journal holds no key, starting over\n", target);
+      return;
+   }
+
+   job->seed = seed;
+   if(pattern != NULL && strcmp(pattern, "-") != 0 && pattern_parse(pattern, &bytes) == 0)
+      job->pattern = bytes;
+   else
+      memset(&job->pattern, 0, sizeof(pattern_t));
+
+   if(job_writes(job, NUKE_RANDOM_CRYPTO))
+   {
+      job->aesbits = aesbits;
+      if(pattern_parse(aeskey, &bytes) == 0)
+         memcpy(job->aeskey, bytes.bytes, sizeof(job->aeskey) < bytes.length ? sizeof(job->aeskey) : bytes.length);
+      if(pattern_parse(aesnonce, &bytes) == 0)
+         memcpy(job->aesnonce, bytes.bytes, sizeof(job->aesnonce) < bytes.length ? sizeof(job->aesnonce) : bytes.length);
+      job->aeskeyed = true;
+   }
+
+   /* The offset is a multiple of the block size it was written with */
+   if(blocksize > 0)
+      job->blocksize = blocksize;
+   job->resumepass = pass;
+   job->resumeoffset = offset;
+   job->ckpass = pass;
+   job->ckoffset = offset;
+}
+
+/* Keep the journal at path for the jobs.  With resume the jobs first pick
+ * up the state the journal holds for them.  Returns 0, or an errno. */
+int journal_open(const char *path, nukejob_t jobs[], int32_t count, bool resume)
+{
+   char line[BUFSIZ];
+   FILE *fp;
+   int32_t i;
+   int error;
+
+   snprintf(journal_path, sizeof(journal_path), "%s", path);
+
+   if(resume)
+   {
+      if((fp = fopen(journal_path, "r")) == NULL)
+         return errno;
+
+      if(fgets(line, sizeof(line), fp) == NULL || strncmp(line, JOURNAL_MAGIC, strlen(JOURNAL_MAGIC)) != 0)
+      {
+         fclose(fp);
+         return EINVAL;
+      }
+
+      while(fgets(line, sizeof(line), fp) != NULL)
+         journal_apply(jobs, count, line);
+      fclose(fp);
+   }
+
+   for(i = 0; i < count; i++)
+   {
+      jobs[i].journal = true;
+      if(jobs[i].ckpass == 0)
+         jobs[i].ckpass = 1;
+   }
+
+   journal_jobs = jobs;
+   journal_count = count;
+   if((error = journal_save()) != 0)
+   {
+      for(i = 0; i < count; i++)
+         jobs[i].journal = false;
+      journal_close();
+   }
+
+   return error;
+}
+
+void journal_close(void)
+{
+   journal_jobs = NULL;
+   journal_count = 0;
+}
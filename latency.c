@@ -0,0 +1,200 @@
+/**
+ *  NetNuke - Erases all storage media deteced by the system
+ *  Copyright (C) 2009  Joseph Hunkeler <jhunkeler@gmail.com, jhunk@stsci.edu>
+ *
+ *  This file is part of NetNuke.
+ *
+ *  NetNuke is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  NetNuke is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with NetNuke.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * Write latency
+ *
+ * Every completed write adds its submission to completion time to a
+ * log-linear histogram in the HDR style: each power of two range of
+ * nanoseconds is split into LATENCY_SUB equal buckets, so percentiles are
+ * accurate to a few percent from a microsecond up to minutes in a fixed
+ * 11KiB per device.  Recording is a bit scan, a shift and a few additions,
+ * cheap enough to leave on for every write of every device.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "netnuke.h"
+
+/* Nanoseconds on the monotonic clock */
+uint64_t latency_now(void)
+{
+   struct timespec now;
+
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+static int32_t latency_index(uint64_t ns)
+{
+   int32_t shift, index;
+
+   /* Below LATENCY_SUB every nanosecond has its own bucket */
+   if(ns < LATENCY_SUB)
+      return (int32_t)ns;
+
+   shift = 63 - __builtin_clzll(ns) - LATENCY_SUB_BITS;
+   index = (shift + 1) * LATENCY_SUB + (int32_t)((ns >> shift) - LATENCY_SUB);
+
+   return index < LATENCY_BUCKETS ? index : LATENCY_BUCKETS - 1;
+}
+
+static uint64_t latency_lower(int32_t bucket)
+{
+   int32_t shift;
+
+   if(bucket < LATENCY_SUB)
+      return (uint64_t)bucket;
+
+   shift = bucket / LATENCY_SUB - 1;
+   return (uint64_t)(LATENCY_SUB + bucket % LATENCY_SUB) << shift;
+}
+
+/* Only the worker writing the device records, others may read at will.
+ * With the one writer relaxed atomics are enough, they only keep a reader
+ * from seeing a torn value. */
+void latency_record(latency_t *latency, uint64_t ns)
+{
+   __atomic_add_fetch(&latency->buckets[latency_index(ns)], 1, __ATOMIC_RELAXED);
+   __atomic_add_fetch(&latency->count, 1, __ATOMIC_RELAXED);
+   __atomic_add_fetch(&latency->sum, ns, __ATOMIC_RELAXED);
+   if(ns > latency->max)
+      __atomic_store_n(&latency->max, ns, __ATOMIC_RELAXED);
+}
+
+/* Nanoseconds every value counted in a bucket stays below */
+uint64_t latency_bound(int32_t bucket)
+{
+   if(bucket < LATENCY_SUB)
+      return (uint64_t)bucket + 1;
+   return latency_lower(bucket) + (1ULL << (bucket / LATENCY_SUB - 1));
+}
+
+/* A consistent copy of a histogram that is still being recorded into.  The
+ * count is taken from the buckets so the two always agree. */
+void latency_copy(const latency_t *live, latency_t *copy)
+{
+   int32_t i;
+
+   copy->count = 0;
+   for(i = 0; i < LATENCY_BUCKETS; i++)
+   {
+      copy->buckets[i] = __atomic_load_n(&live->buckets[i], __ATOMIC_RELAXED);
+      copy->count += copy->buckets[i];
+   }
+   copy->sum = __atomic_load_n(&live->sum, __ATOMIC_RELAXED);
+   copy->max = __atomic_load_n(&live->max, __ATOMIC_RELAXED);
+}
+
+/* Fold a finished histogram into another */
+void latency_add(latency_t *into, const latency_t *from)
+{
+   int32_t i;
+
+   for(i = 0; i < LATENCY_BUCKETS; i++)
+      into->buckets[i] += from->buckets[i];
+   into->count += from->count;
+   into->sum += from->sum;
+   if(from->max > into->max)
+      into->max = from->max;
+}
+
+/* What was recorded since previous was taken, previous catches up */
+void latency_window(const latency_t *live, latency_t *previous, latency_t *window)
+{
+   int32_t i;
+
+   window->count = 0;
+   window->max = 0;
+   for(i = 0; i < LATENCY_BUCKETS; i++)
+   {
+      uint64_t now = __atomic_load_n(&live->buckets[i], __ATOMIC_RELAXED);
+
+      window->buckets[i] = now - previous->buckets[i];
+      window->count += window->buckets[i];
+      if(window->buckets[i])
+         window->max = latency_bound(i) - 1;
+      previous->buckets[i] = now;
+   }
+
+   previous->count += window->count;
+   window->sum = __atomic_load_n(&live->sum, __ATOMIC_RELAXED) - previous->sum;
+   previous->sum += window->sum;
+}
+
+/* Values below ns, exact when ns is a power of two */
+uint64_t latency_below(const latency_t *latency, uint64_t ns)
+{
+   int32_t i, end = latency_index(ns);
+   uint64_t count = 0;
+
+   if(latency_lower(end) < ns)
+      end++;
+   for(i = 0; i < end; i++)
+      count += latency->buckets[i];
+
+   return count;
+}
+
+/* The value fraction of all writes completed within, 0 without data */
+uint64_t latency_percentile(const latency_t *latency, double fraction)
+{
+   uint64_t want, seen = 0;
+   int32_t i;
+
+   if(latency->count == 0)
+      return 0;
+
+   want = (uint64_t)(fraction * (double)latency->count + 0.5);
+   if(want < 1)
+      want = 1;
+
+   for(i = 0; i < LATENCY_BUCKETS; i++)
+   {
+      seen += latency->buckets[i];
+      if(seen >= want)
+      {
+         uint64_t value = latency_bound(i) - 1;
+
+         return latency->max && value > latency->max ? latency->max : value;
+      }
+   }
+
+   return latency->max;
+}
+
+/* 850us, 12.3ms, 1.20s */
+void latency_format(uint64_t ns, char *out, size_t size)
+{
+   if(ns < 1000)
+      snprintf(out, size, "%juns", (uintmax_t)ns);
+   else if(ns < 1000000)
+      snprintf(out, size, "%.*fus", ns < 10000 ? 1 : 0, (double)ns / 1e3);
+   else if(ns < 1000000000)
+      snprintf(out, size, "%.*fms", ns < 10000000 ? 1 : 0, (double)ns / 1e6);
+   else
+      snprintf(out, size, "%.2fs", (double)ns / 1e9);
+}
@@ -18,24 +18,128 @@
  *  along with NetNuke.  If not, see <http://www.gnu.org/licenses/>.
  **/
 
+/*
+ * Asynchronous logging
+ *
+ * lwrite() formats the line on the caller's stack and drops it into a
+ * fixed ring of LOG_RECORDS lines.  Slots are claimed with a single atomic
+ * compare-and-swap, so workers never wait on each other or on the disk.
+ * A background thread copies finished lines to the log file in batches,
+ * flushing once per batch, every loginterval() milliseconds or sooner
+ * when the ring fills up.  When the ring is full lwrite() waits for space
+ * rather than losing the line.  logflush() and logclose() drain the ring
+ * synchronously, so nothing is lost when a signal ends the program.
+ */
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
 #include <string.h>
 #include <stdarg.h>
+#include <signal.h>
+#include <sched.h>
 #include <time.h>
 #ifndef CLK_TCK
 	#define CLK_TCK CLOCKS_PER_SEC
 #endif
 #include <ctype.h>
+#include <pthread.h>
+
+/* Lines held in memory at most, a power of two */
+#define LOG_RECORDS 1024
+/* Longest line, anything longer is cut off */
+#define LOG_LINE 512
+
+typedef struct LRECORD_T
+{
+    uint64_t seq;           /* Ticket the slot is ready for */
+    char text[LOG_LINE];
+} lrecord_t;
 
 FILE* loutfile;
 static clock_t ltime_start;
-static clock_t ltime_current;
-static int logline;
+static lrecord_t *lring = NULL;
+static uint64_t lhead;      /* Next ticket handed to a writer */
+static uint64_t ltail;      /* Next ticket copied to the file */
+static int32_t linterval = 250;
+static bool lrunning = false;
+static int lstop;
+static pthread_t lthread;
+static pthread_mutex_t llock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t lwaitlock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t lwait = PTHREAD_COND_INITIALIZER;
+
+/* Copy every finished line to the file.  Only one thread drains at a time,
+ * lines come out in ticket order. */
+static void ldrain(void)
+{
+    bool wrote = false;
+
+    pthread_mutex_lock(&llock);
+    while(1)
+    {
+        lrecord_t *rec = &lring[ltail & (LOG_RECORDS - 1)];
+
+        if(__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) != ltail + 1)
+            break;
+
+        fputs(rec->text, loutfile);
+        wrote = true;
+
+        /* Hand the slot to the writer one lap ahead */
+        __atomic_store_n(&rec->seq, ltail + LOG_RECORDS, __ATOMIC_RELEASE);
+        __atomic_store_n(&ltail, ltail + 1, __ATOMIC_RELEASE);
+    }
+
+    if(wrote)
+        fflush(loutfile);
+    pthread_mutex_unlock(&llock);
+}
+
+static void* lthread_main(void *arg)
+{
+    sigset_t all;
+    (void)arg;
+
+    /* Signals go to the workers, a handler may wait on this thread */
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, NULL);
+
+    while(!__atomic_load_n(&lstop, __ATOMIC_ACQUIRE))
+    {
+        struct timespec until;
+
+        ldrain();
+
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_sec += linterval / 1000;
+        until.tv_nsec += (long)(linterval % 1000) * 1000000L;
+        if(until.tv_nsec >= 1000000000L)
+        {
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000L;
+        }
+
+        pthread_mutex_lock(&lwaitlock);
+        if(!__atomic_load_n(&lstop, __ATOMIC_ACQUIRE))
+            pthread_cond_timedwait(&lwait, &lwaitlock, &until);
+        pthread_mutex_unlock(&lwaitlock);
+    }
+
+    return NULL;
+}
+
+/* Milliseconds between writes to the log file */
+void loginterval(int interval)
+{
+    linterval = interval > 0 ? interval : 1;
+}
 
 int logopen(const char* logfile)
 {
-    logline = 0;
+    uint64_t i;
+
     ltime_start = clock() * CLK_TCK;
     loutfile = fopen(logfile, "wa+");
 
@@ -46,35 +150,114 @@ int logopen(const char* logfile)
     }
 
     fseek(loutfile, 0, SEEK_SET);
+
+    lhead = ltail = 0;
+    lstop = 0;
+    lring = (lrecord_t*)calloc(LOG_RECORDS, sizeof(lrecord_t));
+    if(lring == NULL)
+        return 0;
+
+    /* Slot i is first ready for ticket i */
+    for(i = 0; i < LOG_RECORDS; i++)
+        lring[i].seq = i;
+
+    /* Without the thread every line is written straight away */
+    lrunning = pthread_create(&lthread, NULL, lthread_main, NULL) == 0;
     return 0;
 }
 
+/* Write out everything logged so far */
+void logflush(void)
+{
+    if(loutfile == NULL)
+        return;
+    if(lring != NULL)
+        ldrain();
+    fflush(loutfile);
+}
+
 void logclose()
 {
+    if(loutfile == NULL)
+        return;
+
+    if(lrunning)
+    {
+        __atomic_store_n(&lstop, 1, __ATOMIC_RELEASE);
+        pthread_cond_signal(&lwait);
+        pthread_join(lthread, NULL);
+        lrunning = false;
+    }
+
+    logflush();
     fclose(loutfile);
+    loutfile = NULL;
+    free(lring);
+    lring = NULL;
 }
 
 int lwrite(char *format, ...)
 {
-    ltime_current = clock() * CLK_TCK;
-
-    char *str = (char*)malloc(sizeof(char) * 256);
-    char tmpstr[256];
-    int n;
+    clock_t ltime_current = clock() * CLK_TCK;
+    char str[LOG_LINE - 64];
+    lrecord_t *rec;
+    uint64_t ticket;
 
     va_list args;
     va_start (args, format);
-    n = vsprintf (str, format, args);
+    vsnprintf (str, sizeof(str), format, args);
     va_end (args);
 
     float seconds = (ltime_current - ltime_start) / 1000;
 
-    snprintf(tmpstr, 255, "[%d.%0.0f]  %s", logline, seconds, str);
-    fprintf(loutfile, tmpstr);
-    logline++;
+    if(loutfile == NULL)
+        return 1;
+
+    if(lring == NULL)
+    {
+        /* Logging to the file directly */
+        pthread_mutex_lock(&llock);
+        fprintf(loutfile, "[%ju.%0.0f]  %s", (uintmax_t)lhead++, seconds, str);
+        fflush(loutfile);
+        pthread_mutex_unlock(&llock);
+        return 0;
+    }
+
+    /* Claim the next slot.  Its ticket is also the line number. */
+    ticket = __atomic_load_n(&lhead, __ATOMIC_RELAXED);
+    while(1)
+    {
+        rec = &lring[ticket & (LOG_RECORDS - 1)];
+        int64_t lap = (int64_t)(__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) - ticket);
+
+        if(lap == 0)
+        {
+            if(__atomic_compare_exchange_n(&lhead, &ticket, ticket + 1, true,
+                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        }
+        else if(lap < 0)
+        {
+            /* The ring is full, get the file written and wait for room */
+            if(lrunning)
+            {
+                pthread_cond_signal(&lwait);
+                sched_yield();
+            }
+            else
+                ldrain();
+            ticket = __atomic_load_n(&lhead, __ATOMIC_RELAXED);
+        }
+        else
+            ticket = __atomic_load_n(&lhead, __ATOMIC_RELAXED);
+    }
+
+    snprintf(rec->text, sizeof(rec->text), "[%ju.%0.0f]  %s", (uintmax_t)ticket, seconds, str);
+    __atomic_store_n(&rec->seq, ticket + 1, __ATOMIC_RELEASE);
+
+    /* Do not let the ring fill up before the next interval */
+    if(lrunning && ticket - __atomic_load_n(&ltail, __ATOMIC_RELAXED) >= LOG_RECORDS / 2)
+        pthread_cond_signal(&lwait);
 
-    /* I am aware of the implications of using fflush constantly. */
-    fflush(loutfile);
-    free(str);
     return 0;
 }
@@ -0,0 +1,545 @@
+/**
+ *  NetNuke - Erases all storage media deteced by the system
+ *  Copyright (C) 2009  Joseph Hunkeler <jhunkeler@gmail.com, jhunk@stsci.edu>
+ *
+ *  This file is part of NetNuke.
+ *
+ *  NetNuke is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  NetNuke is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with NetNuke.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * Metrics export
+ *
+ * The progress reporter hands every device's counters to metrics_write()
+ * once per interval.  They go out either as a Prometheus textfile,
+ * replaced atomically so the node exporter never reads half of it, or as
+ * one JSON object per device and line, appended to a file or sent to a
+ * Unix socket given as unix:<path>.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "netnuke.h"
+
+/* Prometheus buckets are powers of two, 2^11ns (2us) to 2^36ns (68s) */
+#define METRICS_BUCKET_FIRST 11
+#define METRICS_BUCKET_LAST 36
+
+static bool metrics_enabled = false;
+static char metrics_target[PATH_MAX];
+static metricsFormat_t metrics_format = METRICS_PROM;
+static uint64_t metrics_interval = 0;
+static uint64_t metrics_next = 0;
+static FILE *metrics_fp = NULL;
+static int metrics_sock = -1;
+static bool metrics_failed = false;
+static char metrics_host[256];
+static latency_t metrics_latency;       /* Copy of the histogram being written */
+static const double metrics_quantiles[] = { 0.5, 0.99, 0.999 };
+
+static const int metrics_errnos[JOB_ERRNOS - 1] = { EIO, ENXIO, ENOSPC, EINVAL };
+static const char *metrics_errnames[JOB_ERRNOS] = { "EIO", "ENXIO", "ENOSPC", "EINVAL", "other" };
+static const jobState_t metrics_states[] = { JOB_PENDING, JOB_RUNNING, JOB_DONE, JOB_SKIPPED, JOB_FAILED };
+
+/* Where an errno is counted in job->errors */
+int metrics_errno(int error)
+{
+   int i;
+
+   for(i = 0; i < JOB_ERRNOS - 1; i++)
+   {
+      if(metrics_errnos[i] == error)
+         return i;
+   }
+   return JOB_ERRNOS - 1;
+}
+
+void metrics_error(nukejob_t *job, int error)
+{
+   __atomic_add_fetch(&job->errors[metrics_errno(error)], 1, __ATOMIC_RELAXED);
+}
+
+int metrics_format_parse(const char *str, metricsFormat_t *format)
+{
+   if(str == NULL)
+      return 1;
+   if(strcmp(str, "prom") == 0 || strcmp(str, "prometheus") == 0)
+      *format = METRICS_PROM;
+   else if(strcmp(str, "json") == 0 || strcmp(str, "ndjson") == 0)
+      *format = METRICS_JSON;
+   else
+      return 1;
+   return 0;
+}
+
+static bool metrics_socket(void)
+{
+   return strncmp(metrics_target, "unix:", 5) == 0;
+}
+
+/* Start exporting to target every interval milliseconds.  Returns 0, or
+ * an errno when the target can not be written. */
+int metrics_open(const char *target, metricsFormat_t format, int32_t interval)
+{
+   snprintf(metrics_target, sizeof(metrics_target), "%s", target);
+   metrics_format = format;
+   metrics_interval = (uint64_t)(interval > 0 ? interval : 1) * 1000000ULL;
+   metrics_next = latency_now() + metrics_interval;
+   metrics_failed = false;
+
+   if(gethostname(metrics_host, sizeof(metrics_host)) != 0)
+      metrics_host[0] = '\0';
+   metrics_host[sizeof(metrics_host) - 1] = '\0';
+
+   /* The stream is appended to, the textfile is replaced every time */
+   if(!metrics_socket() && format == METRICS_JSON)
+   {
+      if((metrics_fp = fopen(metrics_target, "a")) == NULL)
+         return errno;
+   }
+
+   metrics_enabled = true;
+   return 0;
+}
+
+/* True once per interval */
+bool metrics_due(void)
+{
+   uint64_t now;
+
+   if(!metrics_enabled)
+      return false;
+
+   now = latency_now();
+   if(now < metrics_next)
+      return false;
+
+   metrics_next = now + metrics_interval;
+   return true;
+}
+
+/* A label value or JSON string, quoted */
+static void metrics_quote(FILE *fp, const char *str)
+{
+   fputc('"', fp);
+   for(; *str != '\0'; str++)
+   {
+      unsigned char c = (unsigned char)*str;
+
+      if(c == '"' || c == '\\')
+         fprintf(fp, "\\%c", c);
+      else if(c == '\n')
+         fputs("\\n", fp);
+      else if(c < 0x20)
+      {
+         if(metrics_format == METRICS_JSON)
+            fprintf(fp, "\\u%04x", c);
+      }
+      else
+         fputc(c, fp);
+   }
+   fputc('"', fp);
+}
+
+/* Seconds until the last pass is written, negative when unknown */
+static double metrics_eta(nukejob_t *job, const progress_t *state)
+{
+   uint64_t done = state->done < job->size ? state->done : job->size;
+   uint64_t remaining;
+
+   if(state->average <= 0 || state->pass < 1)
+      return -1;
+
+   remaining = (uint64_t)(job->passes - state->pass) * job->size + (job->size - done);
+   return (double)remaining / state->average;
+}
+
+static void metrics_family(FILE *fp, const char *name, const char *type, const char *help)
+{
+   fprintf(fp, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static void metrics_series(FILE *fp, const char *name, nukejob_t *job)
+{
+   fprintf(fp, "%s{device=", name);
+   metrics_quote(fp, job->device.nameshort);
+}
+
+static void metrics_prom(FILE *fp, nukejob_t jobs[], const progress_t state[], int32_t count)
+{
+   int32_t i, j;
+
+   metrics_family(fp, "netnuke_device_info", "gauge", "Device being wiped.");
+   for(i = 0; i < count; i++)
+   {
+      metrics_series(fp, "netnuke_device_info", &jobs[i]);
+      fputs(",target=", fp);
+      metrics_quote(fp, jobs[i].target);
+      fputs(",model=", fp);
+      metrics_quote(fp, jobs[i].device.model);
+      fputs(",serial=", fp);
+      metrics_quote(fp, jobs[i].device.serial);
+      fprintf(fp, ",level=\"%d\"} 1\n", jobs[i].nukelevel);
+   }
+
+   metrics_family(fp, "netnuke_device_size_bytes", "gauge", "Bytes wiped per pass.");
+   for(i = 0; i < count; i++)
+   {
+      metrics_series(fp, "netnuke_device_size_bytes", &jobs[i]);
+      fprintf(fp, "} %ju\n", (uintmax_t)jobs[i].size);
+   }
+
+   metrics_family(fp, "netnuke_state", "gauge", "Current state of the wipe.");
+   for(i = 0; i < count; i++)
+   {
+      jobState_t current = __atomic_load_n(&jobs[i].state, __ATOMIC_ACQUIRE);
+
+      for(j = 0; j < (int32_t)(sizeof(metrics_states) / sizeof(metrics_states[0])); j++)
+      {
+         metrics_series(fp, "netnuke_state", &jobs[i]);
+         fprintf(fp, ",state=\"%s\"} %d\n", job_state_str(metrics_states[j]), metrics_states[j] == current);
+      }
+   }
+
+   metrics_family(fp, "netnuke_bytes_written_total", "counter", "Bytes written across all passes.");
+   for(i = 0; i < count; i++)
+   {
+      metrics_series(fp, "netnuke_bytes_written_total", &jobs[i]);
+      fprintf(fp, "} %ju\n", (uintmax_t)__atomic_load_n(&jobs[i].written, __ATOMIC_RELAXED));
+   }
+
+   metrics_family(fp, "netnuke_pass", "gauge", "Pass being written.");
+   for(i = 0; i < count; i++)
+   {
+      metrics_series(fp, "netnuke_pass", &jobs[i]);
+      fprintf(fp, "} %d\n", state[i].pass);
+   }
+
+   metrics_family(fp, "netnuke_passes", "gauge", "Passes to write.");
+   for(i = 0; i < count; i++)
+   {
+      metrics_series(fp, "netnuke_passes", &jobs[i]);
+      fprintf(fp, "} %d\n", jobs[i].passes);
+   }
+
+   metrics_family(fp, "netnuke_pass_bytes", "gauge", "Bytes of the current pass written.");
+   for(i = 0; i < count; i++)
+   {
+      metrics_series(fp, "netnuke_pass_bytes", &jobs[i]);
+      fprintf(fp, "} %ju\n", (uintmax_t)state[i].done);
+   }
+
+   metrics_family(fp, "netnuke_throughput_bytes_per_second", "gauge", "Write rate, current and moving average.");
+   for(i = 0; i < count; i++)
+   {
+      bool running = __atomic_load_n(&jobs[i].state, __ATOMIC_ACQUIRE) == JOB_RUNNING;
+
+      metrics_series(fp, "netnuke_throughput_bytes_per_second", &jobs[i]);
+      fprintf(fp, ",window=\"current\"} %.0f\n", running ? state[i].rate : 0);
+      metrics_series(fp, "netnuke_throughput_bytes_per_second", &jobs[i]);
+      fprintf(fp, ",window=\"average\"} %.0f\n", state[i].average);
+   }
+
+   metrics_family(fp, "netnuke_eta_seconds", "gauge", "Time left until the last pass is written.");
+   for(i = 0; i < count; i++)
+   {
+      double eta = metrics_eta(&jobs[i], &state[i]);
+
+      if(__atomic_load_n(&jobs[i].state, __ATOMIC_ACQUIRE) != JOB_RUNNING || eta < 0)
+         continue;
+      metrics_series(fp, "netnuke_eta_seconds", &jobs[i]);
+      fprintf(fp, "} %.1f\n", eta);
+   }
+
+   metrics_family(fp, "netnuke_write_errors_total", "counter", "Failed writes by errno.");
+   for(i = 0; i < count; i++)
+   {
+      for(j = 0; j < JOB_ERRNOS; j++)
+      {
+         metrics_series(fp, "netnuke_write_errors_total", &jobs[i]);
+         fprintf(fp, ",errno=\"%s\"} %ju\n", metrics_errnames[j],
+               (uintmax_t)__atomic_load_n(&jobs[i].errors[j], __ATOMIC_RELAXED));
+      }
+   }
+
+   metrics_family(fp, "netnuke_verified_bytes_total", "counter", "Bytes read back for verification.");
+   for(i = 0; i < count; i++)
+   {
+      metrics_series(fp, "netnuke_verified_bytes_total", &jobs[i]);
+      fprintf(fp, "} %ju\n", (uintmax_t)__atomic_load_n(&jobs[i].verified, __ATOMIC_RELAXED));
+   }
+
+   metrics_family(fp, "netnuke_mismatched_bytes_total", "counter", "Bytes that did not read back as written.");
+   for(i = 0; i < count; i++)
+   {
+      metrics_series(fp, "netnuke_mismatched_bytes_total", &jobs[i]);
+      fprintf(fp, "} %ju\n", (uintmax_t)__atomic_load_n(&jobs[i].mismatched, __ATOMIC_RELAXED));
+   }
+
+   metrics_family(fp, "netnuke_bad_bytes", "gauge", "Bytes that could not be written.");
+   for(i = 0; i < count; i++)
+   {
+      metrics_series(fp, "netnuke_bad_bytes", &jobs[i]);
+      fprintf(fp, "} %ju\n", (uintmax_t)__atomic_load_n(&jobs[i].bad.bytes, __ATOMIC_RELAXED));
+   }
+
+   metrics_family(fp, "netnuke_skipped_bytes", "gauge", "Bytes left alone inside bad regions.");
+   for(i = 0; i < count; i++)
+   {
+      metrics_series(fp, "netnuke_skipped_bytes", &jobs[i]);
+      fprintf(fp, "} %ju\n", (uintmax_t)__atomic_load_n(&jobs[i].skipped.bytes, __ATOMIC_RELAXED));
+   }
+
+   metrics_family(fp, "netnuke_write_latency_seconds", "histogram", "Time from submitting a write to its completion.");
+   for(i = 0; i < count; i++)
+   {
+      latency_copy(&jobs[i].latency, &metrics_latency);
+
+      for(j = METRICS_BUCKET_FIRST; j <= METRICS_BUCKET_LAST; j++)
+      {
+         metrics_series(fp, "netnuke_write_latency_seconds_bucket", &jobs[i]);
+         fprintf(fp, ",le=\"%.9g\"} %ju\n", (double)(1ULL << j) / 1e9,
+               (uintmax_t)latency_below(&metrics_latency, 1ULL << j));
+      }
+      metrics_series(fp, "netnuke_write_latency_seconds_bucket", &jobs[i]);
+      fprintf(fp, ",le=\"+Inf\"} %ju\n", (uintmax_t)metrics_latency.count);
+      metrics_series(fp, "netnuke_write_latency_seconds_sum", &jobs[i]);
+      fprintf(fp, "} %.9f\n", (double)metrics_latency.sum / 1e9);
+      metrics_series(fp, "netnuke_write_latency_seconds_count", &jobs[i]);
+      fprintf(fp, "} %ju\n", (uintmax_t)metrics_latency.count);
+   }
+
+   metrics_family(fp, "netnuke_write_latency_quantile_seconds", "gauge", "Write latency percentiles since the start.");
+   for(i = 0; i < count; i++)
+   {
+      latency_copy(&jobs[i].latency, &metrics_latency);
+      if(metrics_latency.count == 0)
+         continue;
+
+      for(j = 0; j < (int32_t)(sizeof(metrics_quantiles) / sizeof(metrics_quantiles[0])); j++)
+      {
+         metrics_series(fp, "netnuke_write_latency_quantile_seconds", &jobs[i]);
+         fprintf(fp, ",quantile=\"%g\"} %.9f\n", metrics_quantiles[j],
+               (double)latency_percentile(&metrics_latency, metrics_quantiles[j]) / 1e9);
+      }
+   }
+
+   metrics_family(fp, "netnuke_slow", "gauge", "Device flagged as much slower than its peers.");
+   for(i = 0; i < count; i++)
+   {
+      metrics_series(fp, "netnuke_slow", &jobs[i]);
+      fprintf(fp, "} %d\n", __atomic_load_n(&jobs[i].slow, __ATOMIC_RELAXED) ? 1 : 0);
+   }
+
+   metrics_family(fp, "netnuke_last_update_timestamp_seconds", "gauge", "When these metrics were written.");
+   fprintf(fp, "netnuke_last_update_timestamp_seconds %jd\n", (intmax_t)time(NULL));
+}
+
+static void metrics_json(FILE *fp, nukejob_t jobs[], const progress_t state[], int32_t count)
+{
+   time_t now = time(NULL);
+   int32_t i, j;
+
+   for(i = 0; i < count; i++)
+   {
+      nukejob_t *job = &jobs[i];
+      jobState_t current = __atomic_load_n(&job->state, __ATOMIC_ACQUIRE);
+      double eta = metrics_eta(job, &state[i]);
+      uint64_t below;
+      bool first = true;
+
+      fprintf(fp, "{\"time\":%jd,\"host\":", (intmax_t)now);
+      metrics_quote(fp, metrics_host);
+      fputs(",\"device\":", fp);
+      metrics_quote(fp, job->device.nameshort);
+      fputs(",\"target\":", fp);
+      metrics_quote(fp, job->target);
+      fputs(",\"model\":", fp);
+      metrics_quote(fp, job->device.model);
+      fputs(",\"serial\":", fp);
+      metrics_quote(fp, job->device.serial);
+      fprintf(fp, ",\"state\":\"%s\",\"level\":%d,\"pass\":%d,\"passes\":%d,\"size\":%ju,\"pass_bytes\":%ju,\"bytes_written\":%ju",
+            job_state_str(current), job->nukelevel, state[i].pass, job->passes, (uintmax_t)job->size,
+            (uintmax_t)state[i].done, (uintmax_t)__atomic_load_n(&job->written, __ATOMIC_RELAXED));
+      fprintf(fp, ",\"rate\":%.0f,\"average\":%.0f", current == JOB_RUNNING ? state[i].rate : 0, state[i].average);
+      if(current == JOB_RUNNING && eta >= 0)
+         fprintf(fp, ",\"eta\":%.1f", eta);
+      else
+         fputs(",\"eta\":null", fp);
+
+      fputs(",\"errors\":{", fp);
+      for(j = 0; j < JOB_ERRNOS; j++)
+         fprintf(fp, "%s\"%s\":%ju", j ? "," : "", metrics_errnames[j],
+               (uintmax_t)__atomic_load_n(&job->errors[j], __ATOMIC_RELAXED));
+      fprintf(fp, "},\"verified\":%ju,\"mismatched\":%ju", (uintmax_t)__atomic_load_n(&job->verified, __ATOMIC_RELAXED),
+            (uintmax_t)__atomic_load_n(&job->mismatched, __ATOMIC_RELAXED));
+      fprintf(fp, ",\"bad_bytes\":%ju,\"skipped_bytes\":%ju", (uintmax_t)__atomic_load_n(&job->bad.bytes, __ATOMIC_RELAXED),
+            (uintmax_t)__atomic_load_n(&job->skipped.bytes, __ATOMIC_RELAXED));
+
+      latency_copy(&job->latency, &metrics_latency);
+      fprintf(fp, ",\"slow\":%s,\"latency\":{\"count\":%ju,\"sum_ns\":%ju,\"max_ns\":%ju",
+            __atomic_load_n(&job->slow, __ATOMIC_RELAXED) ? "true" : "false",
+            (uintmax_t)metrics_latency.count, (uintmax_t)metrics_latency.sum, (uintmax_t)metrics_latency.max);
+      fprintf(fp, ",\"p50_ns\":%ju,\"p99_ns\":%ju,\"p999_ns\":%ju",
+            (uintmax_t)latency_percentile(&metrics_latency, 0.5),
+            (uintmax_t)latency_percentile(&metrics_latency, 0.99),
+            (uintmax_t)latency_percentile(&metrics_latency, 0.999));
+
+      /* Power of two buckets that counted something, keyed by their bound */
+      fputs(",\"buckets\":{", fp);
+      for(j = 1, below = 0; j <= LATENCY_RANGE; j++)
+      {
+         uint64_t n = latency_below(&metrics_latency, 1ULL << j) - below;
+
+         below += n;
+         if(n == 0)
+            continue;
+         fprintf(fp, "%s\"%ju\":%ju", first ? "" : ",", (uintmax_t)(1ULL << j), (uintmax_t)n);
+         first = false;
+      }
+      fputs("}}}\n", fp);
+   }
+}
+
+/* Send the text to the socket, connecting first when needed */
+static int metrics_send(const char *text, size_t length)
+{
+   struct sockaddr_un addr;
+   size_t done = 0;
+
+   if(metrics_sock < 0)
+   {
+      const char *path = metrics_target + 5;
+
+      if(strlen(path) >= sizeof(addr.sun_path))
+         return ENAMETOOLONG;
+      memset(&addr, 0, sizeof(addr));
+      addr.sun_family = AF_UNIX;
+      memcpy(addr.sun_path, path, strlen(path) + 1);
+
+      if((metrics_sock = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+         return errno;
+      if(connect(metrics_sock, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+      {
+         int error = errno;
+
+         close(metrics_sock);
+         metrics_sock = -1;
+         return error;
+      }
+   }
+
+   while(done < length)
+   {
+      ssize_t result = send(metrics_sock, text + done, length - done, MSG_NOSIGNAL);
+
+      if(result < 0)
+      {
+         int error = errno;
+
+         /* Reconnect next time */
+         close(metrics_sock);
+         metrics_sock = -1;
+         return error;
+      }
+      done += result;
+   }
+
+   return 0;
+}
+
+/* Replace the textfile, never leaving a partial one behind */
+static int metrics_replace(const char *text, size_t length)
+{
+   char temporary[PATH_MAX + 8];
+   FILE *fp;
+   int error = 0;
+
+   snprintf(temporary, sizeof(temporary), "%s.tmp", metrics_target);
+   if((fp = fopen(temporary, "w")) == NULL)
+      return errno;
+
+   if(fwrite(text, 1, length, fp) != length)
+      error = errno ? errno : EIO;
+   if(fclose(fp) != 0 && error == 0)
+      error = errno;
+
+   if(error == 0 && rename(temporary, metrics_target) != 0)
+      error = errno;
+   if(error != 0)
+      unlink(temporary);
+
+   return error;
+}
+
+void metrics_write(nukejob_t jobs[], const progress_t state[], int32_t count)
+{
+   char *text = NULL;
+   size_t length = 0;
+   FILE *fp;
+   int error;
+
+   if(!metrics_enabled || (fp = open_memstream(&text, &length)) == NULL)
+      return;
+
+   if(metrics_format == METRICS_PROM)
+      metrics_prom(fp, jobs, state, count);
+   else
+      metrics_json(fp, jobs, state, count);
+   fclose(fp);
+
+   if(metrics_socket())
+      error = metrics_send(text, length);
+   else if(metrics_format == METRICS_PROM)
+      error = metrics_replace(text, length);
+   else
+   {
+      error = fwrite(text, 1, length, metrics_fp) == length && fflush(metrics_fp) == 0 ? 0 : (errno ? errno : EIO);
+      if(error == 0 && ferror(metrics_fp))
+         error = EIO;
+   }
+   free(text);
+
+   /* Complain once, not every interval */
+   if(error != 0 && !metrics_failed)
+      lwrite("Could not write metrics to %s: %s\n", metrics_target, strerror(error));
+   else if(error == 0 && metrics_failed)
+      lwrite("Writing metrics to %s again\n", metrics_target);
+   metrics_failed = error != 0;
+}
+
+void metrics_close(void)
+{
+   if(!metrics_enabled)
+      return;
+
+   if(metrics_fp != NULL)
+      fclose(metrics_fp);
+   if(metrics_sock >= 0)
+      close(metrics_sock);
+   metrics_fp = NULL;
+   metrics_sock = -1;
+   metrics_enabled = false;
+}
@@ -0,0 +1,423 @@
+/**
+ *  NetNuke - Erases all storage media deteced by the system
+ *  Copyright (C) 2009  Joseph Hunkeler <jhunkeler@gmail.com, jhunk@stsci.edu>
+ *
+ *  This file is part of NetNuke.
+ *
+ *  NetNuke is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  NetNuke is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with NetNuke.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * Generator and comparison microbenchmarks
+ *
+ * netnuke-microbench times the CPU side of a wipe on its own: the fill of
+ * every nuke level as nuke_fill() does it, and the comparisons a verify
+ * pass makes.  Each kernel runs on buffers from 4KB to 64MB, on one and on
+ * several threads, each thread with buffers of its own, and is reported in
+ * GB/s overall and per thread.  A generator well above what the disks take
+ * is never the bottleneck.
+ *
+ * Kernels that pick a SIMD implementation at run time are measured twice:
+ * as picked, and forced onto the portable code with the same environment
+ * variables the wipe honours.  The choice is made once per process, so
+ * each variant runs in a child of its own.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#include "netnuke.h"
+
+#define MICRO_AXIS_MAX 16
+#define MICRO_GB 1e9
+
+typedef enum microkernel
+{
+   MICRO_ZERO=0,
+   MICRO_PATTERN,
+   MICRO_RANDOM,
+   MICRO_AES,
+   MICRO_VERIFY_ZERO,
+   MICRO_VERIFY_COMPARE,
+   MICRO_KERNELS
+} microKernel_t;
+
+static const char *micro_names[] = { "zero", "pattern", "random", "aes", "verify-zero", "verify-compare" };
+
+/* Only these have a portable variant worth comparing */
+static const bool micro_simd[] = { false, false, true, true, true, false };
+
+typedef struct MICROTHREAD_T
+{
+   nukejob_t *job;
+   microKernel_t kernel;
+   uint64_t length;
+   pthread_barrier_t *barrier;
+   uint64_t bytes;
+   uint64_t elapsed;           /* Nanoseconds */
+   int error;
+} microthread_t;
+
+static uint64_t micro_time = 250000000ULL;
+static bool micro_json = false;
+
+/* The pool reports nothing to anyone */
+void clearline(void)
+{
+}
+
+void usage(const char* cmd)
+{
+   printf("usage: %s [options] ...\n", cmd);
+   printf("--help            -h       This message\n");
+   printf("--kernels list             zero, pattern, random, aes, verify-zero, verify-compare (default: all)\n");
+   printf("--sizes list               Buffer sizes in KB (default: 4,16,64,256,1024,4096,16384,65536)\n");
+   printf("--threads list             Threads at once (default: 1 and one per CPU)\n");
+   printf("--time n                   Milliseconds per measurement (default: 250)\n");
+   printf("--native                   Only the implementation this CPU picks, no portable variant\n");
+   printf("--json                     One JSON object per measurement instead of text\n");
+}
+
+static int micro_list(const char *str, const char **names, int32_t nnames, int32_t *values, int32_t *count)
+{
+   char copy[BUFSIZ];
+   char *tok, *save = NULL;
+
+   snprintf(copy, sizeof(copy), "%s", str);
+   *count = 0;
+
+   for(tok = strtok_r(copy, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save))
+   {
+      int32_t value = -1, i;
+
+      if(*count >= MICRO_AXIS_MAX)
+         return 1;
+
+      if(names == NULL)
+      {
+         char *end;
+
+         value = (int32_t)strtol(tok, &end, 10);
+         if(*end != '\0' || value < 1)
+            return 1;
+      }
+      else
+      {
+         for(i = 0; i < nnames; i++)
+            if(strcmp(tok, names[i]) == 0)
+               value = i;
+         if(value < 0)
+            return 1;
+      }
+
+      values[(*count)++] = value;
+   }
+
+   return *count == 0;
+}
+
+/* A job set up the way a wipe at this level would be */
+static int micro_job(nukejob_t *job, microKernel_t kernel, uint64_t length)
+{
+   uint8_t key[32], nonce[8];
+
+   memset(job, 0, sizeof(nukejob_t));
+   job->blocksize = (int32_t)length;
+
+   switch(kernel)
+   {
+      case MICRO_PATTERN:
+         job->nukelevel = NUKE_PATTERN;
+         patternTile(job, 1, &job->tile);
+         break;
+      case MICRO_RANDOM:
+         job->nukelevel = NUKE_RANDOM_SLOW;
+         rng_init(&job->rng, rng_entropy(), 1);
+         break;
+      case MICRO_AES:
+         job->nukelevel = NUKE_RANDOM_CRYPTO;
+         if(aes_keygen(key, 256, nonce) != 0)
+            return 1;
+         aes_init(&job->aes, key, 256, nonce, 1);
+         break;
+      default:
+         job->nukelevel = NUKE_ZERO;
+         break;
+   }
+
+   return 0;
+}
+
+static const char* micro_impl(microKernel_t kernel)
+{
+   switch(kernel)
+   {
+      case MICRO_RANDOM:
+         return rng_impl();
+      case MICRO_AES:
+         return aes_impl();
+      case MICRO_VERIFY_ZERO:
+         return verify_impl();
+      case MICRO_VERIFY_COMPARE:
+         return "memcmp";
+      case MICRO_PATTERN:
+         return "tile";
+      default:
+         return "memset";
+   }
+}
+
+static void* micro_thread(void *arg)
+{
+   microthread_t *t = (microthread_t*)arg;
+   char *buf = NULL, *expect = NULL;
+   uint64_t offset = 0, start, now;
+   bool same = true;
+
+   if(posix_memalign((void**)&buf, 4096, t->length) != 0
+         || posix_memalign((void**)&expect, 4096, t->length) != 0)
+      t->error = 1;
+   else
+   {
+      /* Fault everything in before the clock starts */
+      memset(buf, 0, t->length);
+      memset(expect, 0, t->length);
+   }
+
+   pthread_barrier_wait(t->barrier);
+   if(t->error)
+   {
+      free(buf);
+      free(expect);
+      return NULL;
+   }
+
+   start = latency_now();
+   do
+   {
+      if(t->kernel == MICRO_VERIFY_ZERO)
+         same &= verify_match(buf, NULL, t->length);
+      else if(t->kernel == MICRO_VERIFY_COMPARE)
+         same &= verify_match(buf, expect, t->length);
+      else
+         nuke_fill(t->job, buf, t->length, offset);
+
+      offset += t->length;
+      now = latency_now();
+   } while(now - start < micro_time);
+
+   t->bytes = offset;
+   t->elapsed = now - start;
+
+   /* The comparisons must have looked at the data */
+   if(!same)
+      t->error = 1;
+
+   free(buf);
+   free(expect);
+   return NULL;
+}
+
+/* Time one kernel at one size on some threads, GB/s over all of them */
+static int micro_run(microKernel_t kernel, uint64_t length, int32_t threads, double *rate)
+{
+   microthread_t *t;
+   pthread_t *ids;
+   pthread_barrier_t barrier;
+   nukejob_t *job;
+   int32_t i, started = 0;
+   int error = 0;
+
+   *rate = 0;
+   t = (microthread_t*)calloc(threads, sizeof(microthread_t));
+   ids = (pthread_t*)calloc(threads, sizeof(pthread_t));
+   job = (nukejob_t*)malloc(sizeof(nukejob_t));
+   if(t == NULL || ids == NULL || job == NULL || micro_job(job, kernel, length) != 0)
+   {
+      free(t);
+      free(ids);
+      free(job);
+      return 1;
+   }
+
+   pthread_barrier_init(&barrier, NULL, threads);
+   for(i = 0; i < threads; i++)
+   {
+      t[i].job = job;
+      t[i].kernel = kernel;
+      t[i].length = length;
+      t[i].barrier = &barrier;
+      if(pthread_create(&ids[i], NULL, micro_thread, &t[i]) != 0)
+         break;
+      started++;
+   }
+
+   /* A barrier short of a thread would wait forever */
+   if(started < threads)
+   {
+      fprintf(stderr, "Could not start %d threads\n", threads);
+      exit(1);
+   }
+
+   for(i = 0; i < started; i++)
+   {
+      pthread_join(ids[i], NULL);
+      error |= t[i].error;
+      if(t[i].elapsed > 0)
+         *rate += (double)t[i].bytes / MICRO_GB / ((double)t[i].elapsed / 1e9);
+   }
+
+   pthread_barrier_destroy(&barrier);
+   free(t);
+   free(ids);
+   free(job);
+   return error;
+}
+
+static void micro_print(microKernel_t kernel, uint64_t length, int32_t threads, double rate)
+{
+   if(micro_json)
+      printf("{\"kernel\":\"%s\",\"impl\":\"%s\",\"size\":%ju,\"threads\":%d,\"gbps\":%.2f,\"gbps_per_thread\":%.2f}\n",
+            micro_names[kernel], micro_impl(kernel), (uintmax_t)length, threads, rate, rate / threads);
+   else
+      printf("%-16s %-10s %10ju %8d %10.2f %10.2f\n", micro_names[kernel], micro_impl(kernel),
+            (uintmax_t)length, threads, rate, rate / threads);
+   fflush(stdout);
+}
+
+/* Everything for one implementation choice.  Returns the failures. */
+static int micro_variant(bool portable, const int32_t *kernels, int32_t nkernels,
+      const int32_t *sizes, int32_t nsizes, const int32_t *threads, int32_t nthreads)
+{
+   int32_t k, s, n;
+   int failed = 0;
+
+   for(k = 0; k < nkernels; k++)
+   {
+      if(portable && !micro_simd[kernels[k]])
+         continue;
+
+      for(s = 0; s < nsizes; s++)
+      for(n = 0; n < nthreads; n++)
+      {
+         uint64_t length = (uint64_t)sizes[s] * 1024;
+         double rate;
+
+         if(micro_run(kernels[k], length, threads[n], &rate) != 0)
+         {
+            fprintf(stderr, "%s: %ju bytes on %d threads failed\n", micro_names[kernels[k]],
+                  (uintmax_t)length, threads[n]);
+            failed++;
+            continue;
+         }
+         micro_print(kernels[k], length, threads[n], rate);
+      }
+   }
+
+   return failed;
+}
+
+int main(int argc, char* argv[])
+{
+   int32_t kernels[MICRO_AXIS_MAX] = { MICRO_ZERO, MICRO_PATTERN, MICRO_RANDOM, MICRO_AES,
+      MICRO_VERIFY_ZERO, MICRO_VERIFY_COMPARE };
+   int32_t sizes[MICRO_AXIS_MAX] = { 4, 16, 64, 256, 1024, 4096, 16384, 65536 };
+   int32_t threads[MICRO_AXIS_MAX] = { 1 };
+   int32_t nkernels = MICRO_KERNELS, nsizes = 8, nthreads = 1, cpus;
+   bool native = false;
+   int failed = 0, variant, tok;
+
+   cpus = (int32_t)sysconf(_SC_NPROCESSORS_ONLN);
+   if(cpus > 1)
+      threads[nthreads++] = cpus;
+
+   for(tok = 1; tok < argc; tok++)
+   {
+      int bad = 0;
+
+      if(ARGMATCH("--help") || ARGMATCH("-h"))
+      {
+         usage(argv[0]);
+         exit(0);
+      }
+      else if(ARGMATCH("--native"))
+         native = true;
+      else if(ARGMATCH("--json"))
+         micro_json = true;
+      else
+      {
+         ARGNULL(+1);
+         if(ARGMATCH("--kernels"))
+            bad = micro_list(argv[tok+1], micro_names, MICRO_KERNELS, kernels, &nkernels);
+         else if(ARGMATCH("--sizes"))
+            bad = micro_list(argv[tok+1], NULL, 0, sizes, &nsizes);
+         else if(ARGMATCH("--threads"))
+            bad = micro_list(argv[tok+1], NULL, 0, threads, &nthreads);
+         else if(ARGMATCH("--time"))
+            bad = (micro_time = strtoull(argv[tok+1], NULL, 10) * 1000000ULL) == 0;
+         else
+         {
+            fprintf(stderr, "unknown option %s\n", argv[tok]);
+            exit(1);
+         }
+         tok++;
+      }
+
+      if(bad)
+      {
+         fprintf(stderr, "invalid value for %s\n", argv[tok-1]);
+         exit(1);
+      }
+   }
+
+   if(!micro_json)
+      printf("%-16s %-10s %10s %8s %10s %10s\n", "kernel", "impl", "bytes", "threads", "GB/s", "GB/s/thr");
+   fflush(stdout);
+
+   for(variant = 0; variant < (native ? 1 : 2); variant++)
+   {
+      pid_t child;
+      int status;
+
+      if((child = fork()) < 0)
+      {
+         perror("fork");
+         exit(1);
+      }
+
+      if(child == 0)
+      {
+         if(variant == 1)
+         {
+            setenv("NETNUKE_RNG_SCALAR", "1", 1);
+            setenv("NETNUKE_AES_SOFTWARE", "1", 1);
+            setenv("NETNUKE_VERIFY_SCALAR", "1", 1);
+         }
+         exit(micro_variant(variant == 1, kernels, nkernels, sizes, nsizes, threads, nthreads) ? 1 : 0);
+      }
+
+      if(waitpid(child, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+         failed++;
+   }
+
+   return failed ? 1 : 0;
+}
@@ -30,6 +30,7 @@
 #include <fcntl.h>
 #include <err.h>
 #include <time.h>
+#include <pthread.h>
 #ifdef __FreeBSD__
    #include <libutil.h>
    #include <sys/disk.h>
@@ -50,19 +51,34 @@ int8_t udef_wmode = 0; /* O_SYNC is default */
 int32_t udef_passes = 1;
 bool udef_testmode = true; /* Test mode should always be enabled by default. */
 int32_t udef_blocksize = 512; /* 1 block = 512 bytes*/
-bool skipSignal = false;
-int O_UFLAG = 0;
+int32_t udef_jobs = 0; /* One worker per device */
+int32_t udef_busjobs = 0; /* All devices of a controller at once */
+int32_t udef_ratelimit = 0; /* MB/s per device, 0 is unlimited */
+int32_t udef_totalrate = 0; /* MB/s for all devices together */
+ioType_t udef_iotype = IO_AUTO; /* io_uring when the kernel has it */
+int32_t udef_qdepth = 8;
+bool udef_autotune = false; /* Keep the block size and depth as given */
+bool udef_retune = false;
+bool udef_pin = true; /* Workers stay on the NUMA node of their device */
+bool udef_direct = true; /* Bypass the page cache */
+int32_t udef_aesbits = 256;
+int32_t udef_verify = 0; /* Percent of each pass to read back */
+int32_t udef_samples = 0; /* Random regions of each pass to read back instead */
+int32_t udef_slowpct = 200; /* Slow at twice the peers' latency or half their rate */
+const char *udef_sysfsroot = "/sys"; /* Where devices are discovered */
+int32_t udef_loginterval = 250; /* Milliseconds between log file writes */
+const char *udef_metrics = NULL; /* Metrics file or unix:<socket> */
+metricsFormat_t udef_metricsformat = METRICS_PROM;
+int32_t udef_metricsinterval = 10000; /* Milliseconds between exports */
+const char *udef_journal = "/var/log/netnuke.journal"; /* Checkpoints, "none" keeps none */
+bool udef_resume = false; /* Continue the wipes recorded in the journal */
+pattern_t udef_pattern; /* Empty: rotate through the static pattern table */
+profile_t udef_profile; /* Pass table of --profile */
+bool udef_profiled = false;
 media_t *devices;
+nukejob_t *jobs;
 mediastat_t device_stats;
 
-/* Static pattern array */
-const char sPattern[] = {
-	0xA0, 0xB0, 0xC0, 0xD0, 0xE0, 0xF0,
-	0xA1, 0xB1, 0xC1, 0xD1, 0xE1, 0xF1,
-	0xA2, 0xB2, 0xC2, 0xD2, 0xE2, 0xF2,
-	0xA3, 0xB3, 0xC3, 0xD3, 0xE3, 0xF3
-};
-
 /* List of media types that we can nuke.
  * Also note that if the device is not "supported" by this list you can
  * create a soft-symlink TO a device that is.
@@ -88,319 +104,50 @@ const char sPattern[] = {
       "mlx", //Mylex DAC960 RAID
       "wt",  //Wangtek and Archive QIC-02/QIC-36
    };
-#else
-   const char* mediaList[5] = {
-      "hd",  //ATAPI
-      "sd",  //SCSI
-      "sg",  //SCSI Generic
-      "st",  //SCSI Tape
-   };
 #endif
 
 
-void fillRandom(char buffer[], uint64_t length)
+/* Count a usable device and add it to the array of devices */
+static void addMedia(media_t devices[], media_t device)
 {
-   uint32_t random = 0, random_count = 0;
-   int32_t linebreak = 0;
-
-   /* Initialize random seed */
-   srand(time(NULL) * time(NULL) / 3 + 6201985 * 3.14159); 
-
-   /* Fills the write buffer with random garbage */
-   for(random_count = 0; random_count < length; random_count++)
+   /* This is not the only way to do this.  Especially because it is NOT
+    * dynamic to the mediaList at all... */
+   if(strncmp(device.nameshort, "ad", 2) == 0 ||
+      strncmp(device.nameshort, "hd", 2) == 0)
    {
-      /* Define a single static pattern */
-      if(udef_nukelevel == NUKE_PATTERN)
-      {
-              random = rand() % strlen(sPattern) + 1;
-              //printf("size = %d  STATIC = ### %x ###\n", strlen(sPattern), (int)random);
-              buffer[random_count] = sPattern[random];
-      }      
-
-      if(udef_nukelevel == NUKE_RANDOM_SLOW || udef_nukelevel == NUKE_RANDOM_FAST)
-      {
-         random = rand() % RAND_MAX;
-         //printf("RANDOM = ### %x ###\n", random);
-         buffer[random_count] = random;
-      }
-	  
-      /* This is a debug feature to prove the random generator is functioning */
-      if(udef_verbose_high)
-      {
-         printf("0x%08X  ", (char)random);
-              
-         if(linebreak == 5)
-         {
-            putchar('\n');
-            linebreak = -1;
-         }
-
-         linebreak++;
-      }
+      device_stats.ide++;
    }
-   if(udef_verbose_high)
-      putchar('\n'); 
-
-}
-
-int open_device(const char* media)
-{
-   int fd = 0;
-#ifdef __FreeBSD__
-      fd = open(media, O_RDWR | O_TRUNC | O_UFLAG | O_DIRECT, 0700 );
-#else
-      /* Linux no longer supports O_DIRECT */
-      fd = open(media, O_RDWR | O_TRUNC | O_UFLAG, 0700 );
-#endif
-
-   return fd;
-}
-
-int recycle_device(const char *media, int fd)
-{
-   int fdtmp = fd;
-   if(!fdtmp)
-      return -1;
-
-   close(fdtmp);
-   fdtmp = open_device(media);
-   return fdtmp;
-}
-
-
-int nuke(media_t device)
-{
-   uint64_t size = device.size;
-   char media[BUFSIZ]; 
-   char mediashort[BUFSIZ];
-   memcpy(media, device.name, strlen(device.name)+1);
-   memcpy(mediashort, device.nameshort, strlen(device.nameshort));
-
-   /* test with 10MBs worth of data */
-   if(udef_testmode == true)
-      size = (1024 * 1024) * 10;
-   
-   errno = 0;
-   char mediaSize[BUFSIZ];
-   char writeSize[BUFSIZ];
-   char writePerSecond[BUFSIZ];
-   int32_t pass;
-   uint64_t byteSize = udef_blocksize;
-   uint64_t bytesWritten = 0L;
-   uint32_t  percent_retainer = 0, percent_retainer_watch = 0;
-   uint64_t times, block;
-   char wTable[byteSize];
-   uint32_t startTime, currentTime, endTime; 
-
-   if(wTable == NULL)
+   else if(strncmp(device.nameshort, "da", 2) == 0 ||
+         strncmp(device.nameshort, "sd", 2) == 0 ||
+         strncmp(device.nameshort, "amrd", 4) == 0)
    {
-      fprintf(stderr, "Could not allocate write table buffer at size %jd\n", byteSize);  
-      return 1;
+      device_stats.scsi++;
    }
-
-   /* Set the IO mode */
-   O_UFLAG = udef_wmode ? O_ASYNC : O_SYNC;
-   if(udef_testmode == true)
-          sprintf(media, "%s", "/tmp/testmode.img");
-
-   /* Generate a size string based on the media size. example: 256M */
-   humanize_number(mediaSize, 5, (uint64_t)size, "", 
-      HN_AUTOSCALE, HN_B | HN_NOSPACE | HN_DECIMAL);
-   lwrite("Wiping %s: %ju bytes (%s)\n", media, (intmax_t)size, mediaSize);
-   printf("Wiping %s: %ju bytes (%s)\n", media, (intmax_t)size, mediaSize);
-   
-   /* Dump random garbage to the write table */
-   if(udef_nukelevel == NUKE_RANDOM_SLOW || udef_nukelevel == NUKE_RANDOM_FAST)
-	   fillRandom(wTable, byteSize);
-   else if(udef_nukelevel == NUKE_ZERO)
-	   memset(wTable, 0, byteSize);
    else
-	   staticPattern(wTable, byteSize);
-
-   /* Begin write passes */
-   for( pass = 1; pass <= udef_passes ; pass++ )
    {
-      /* Re-initialize byteSize (block size) for each pass in case an 
-       * error condition has modified it */
-      byteSize = udef_blocksize;
-
-      if(udef_testmode)
-         O_UFLAG |= O_CREAT;
-
-      int fd = open_device(media);
-                
-      if(!fd)
-      {
-         lwrite("nuke open_device: %s\n", strerror(fd));
-         fprintf(stderr, "nuke open_device: %s\n", strerror(fd));
-         break;
-      }
-
-      if(errno != 0)
-      {
-         perror("nuke");
-         lwrite("Skipping %s\n", media);
-         fprintf(stderr, "Skipping %s\n", media);
-         /* The reason we stopped exiting the program here is because other 
-          * devices still may  have to be wiped.  Just skip it */
-         break;
-      }      
-
-      if((lseek(fd, 0L, SEEK_SET)) != 0)
-      {
-         lwrite("%s: Could not seek to the beginning of the device.\n", media);
-         fprintf(stderr, "\nCould not seek to the beginning of the device.\n");
-         break;
-      }
-
-      /* Determine how many writes to perform, and at what byte size */
-      times = size / byteSize;
-      
-      startTime = time(NULL);
-      
-      for( block = 0 ; block <= times; block++)
-      {
-         currentTime = time(NULL);
-         long double bytes = (float)(size / times * block);
-         long double percent = (bytes / (long double) size) * 100L;
-
-	 /* Generate a size string based on bytes written. example: 256M */
-	 humanize_number(writeSize, 5,
-	    bytes, "", HN_AUTOSCALE, HN_B | HN_NOSPACE | HN_DECIMAL);
-         
-         /* Generate a size string based on writes per second. example: 256M */
-	 humanize_number(writePerSecond, 5,
-            (intmax_t)((long double)bytes / ((long double)currentTime - (long double)startTime)), "", 
-            HN_AUTOSCALE, HN_B | HN_NOSPACE | HN_DECIMAL);
-
-         printf("%s: ", (char*)&device.nameshort);
-
-         if(udef_passes > 1)
-         {
-            printf("pass %d ", pass);
-            lwrite("pass %d\n", pass);
-         }
-
-         /* Output our progress */
-         printf("\t%jd of %jd blocks    [ %s / %3.1Lf%% / %s/s ]%c", 
-               block, 
-               times,
-               writeSize,
-               percent,
-               writePerSecond,
-               '\r' //ANSI carriage return
-               );
-
-         if(udef_verbose)
-         {
-            percent_retainer =  (uint32_t)percent / 10;
-            if(percent_retainer_watch < percent_retainer)
-            {
-               lwrite("%s progress: %3.0Lf percent\n", media, percent);
-            }
-            percent_retainer_watch = percent_retainer;
-         }
-
-         /* Recycle the write table with random garbage */
-         if(udef_nukelevel == NUKE_RANDOM_SLOW)
-            fillRandom(wTable, byteSize); 
-
-         /* Break out if we have written all of the data */
-         if(block >= times)
-         {
-             break;
-         }
-
-         /* Poll for the signal to skip the device */
-         if(skipSignal == true)
-         {
-            fflush(stdout);
-
-            clearline();
-            lwrite("Skipping device %s...\n", media);
-            fprintf(stderr, "Skipping device %s...\n", media);
-            skipSignal = false;
-            break;
-         }
-
-         /* Dump data to the device */
-         bytesWritten = write(fd, wTable, byteSize); 
-
-         if(bytesWritten != byteSize)
-         {
-            int64_t current = lseek(fd, 0L, SEEK_CUR);
-
-            /* Usually caused if we are not using a blocksize that is a 
-             * multiple of the devices sector size */
-            if(errno == EINVAL)
-            {
-               lwrite("Possible invalid block size (%jd) defined!  Attempting correction...\n", byteSize);
-               fprintf(stderr, "Possible invalid block size (%jd) defined! Attempting correction...\n", byteSize);
-               
-               byteSize = 512;
-
-               lwrite("Block size is now %jd.\n", byteSize);
-               fprintf(stderr, "Block size is now %jd.\n", byteSize);
-               
-               close(fd);
-               if((fd = open_device(media)) > -1)
-               {
-                  lwrite("Recycling device %s succeeded.\n", media);
-                  fprintf(stderr, "Recycling device %s succeeded.\n", media);
-                  lseek(fd, current, SEEK_SET);
-               }
-               else
-               {
-                  lwrite("Recycling device %s failed. Skipping...\n", media);
-                  fprintf(stderr, "Recycling device %s failed. Skipping...\n", media);
-                  break;
-               }
-            }
-
-            /* If the device resets */
-            if(errno == ENXIO)
-            {
-               lwrite("%s: Lost device at seek position %jd.  ***Manual destruction is necessary***\n", device.nameshort, current);
-               fprintf(stderr, "%s: Lost device at seek position %jd.  ***Manual destruction is necessary***\n", device.nameshort, current);
-               break;
-            }
-
-            /* If it is a physical device error */
-            if(errno == EIO)
-            {
-               int64_t next = lseek(fd, current + 1, SEEK_SET);
-               lwrite("Jumping from byte %jd to %jd.\n", current, next);
-               fprintf(stderr, "Jumping from byte %jd to %jd.\n", current, next);
-
-               int64_t final = lseek(fd, next, SEEK_SET);
-               lwrite("Landed on byte %jd.\n", final);
-               fprintf(stderr, "Landed on byte %jd.\n", final);
-            }
-            
-            if(errno == ENOSPC)
-            {
-               lwrite("%s: No space left on device.  seek position %jd\n", device.nameshort, current);
-               fprintf(stderr, "%s: No space left on device.  seek position %jd\n", device.nameshort, current);
-               break;
-            }
-
-            lwrite("%s: %s, while writing chunk %jd. seek position %jd\n", device.nameshort, strerror(errno), block, current);
-            fprintf(stderr, "%s: %s, while writing chunk %jd. seek position %jd\n", device.nameshort, strerror(errno), block, current);
+      device_stats.unknown++;
+   }
 
-            /* Flush stderr to the screen */
-            fflush(stderr);
-            /* Reset the error code so it doesn't fill up the screen */
-            errno = 0; 
-         }
+   devices[device_stats.total++] = device;
 
-      } /* BLOCK WRITE */
-      
-      endTime = time(NULL);
-      close(fd);
-   } /* PASSES */
-
-   putchar('\n');
-   return 0;
+   if(udef_verbose)
+   {
+#ifdef __FreeBSD__
+      lwrite("%s:\t%s:\t%jd bytes\n", device.nameshort, device.ident, device.size);
+      printf("%s:\t%s:\t%jd bytes\n", device.nameshort, device.ident, device.size);
+#else
+      lwrite("%s:\t%s:\t%ju bytes, %u/%u byte sectors, %s, queue %d%s%s\n",
+            device.nameshort, device.ident[0] ? device.ident : "unknown", (uintmax_t)device.size,
+            device.lsector, device.psector, device.rotational ? "rotational" : "solid state",
+            device.queuedepth, device.discardmax ? ", discard" : "",
+            device.zeroesmax ? ", zero-out" : "");
+      printf("%s:\t%s:\t%ju bytes, %u/%u byte sectors, %s, queue %d%s%s\n",
+            device.nameshort, device.ident[0] ? device.ident : "unknown", (uintmax_t)device.size,
+            device.lsector, device.psector, device.rotational ? "rotational" : "solid state",
+            device.queuedepth, device.discardmax ? ", discard" : "",
+            device.zeroesmax ? ", zero-out" : "");
+#endif
+   }
 }
 
 void buildMediaList(media_t devices[])
@@ -410,27 +157,22 @@ void buildMediaList(media_t devices[])
    device_stats.scsi = 0;
    device_stats.unknown = 0;
 
-   int i = 0;
-   int mt = 0;
-
    if(udef_verbose)
       printf("\n--Device List--\n");
 
+#ifdef __FreeBSD__
+   int i = 0;
+   int mt = 0;
+
    do
    {
       char media[BUFSIZ];
 
       /* Generate a device string based on the current interation*/
-#ifdef __FreeBSD__
       sprintf(media, "/dev/%s%d", mediaList[mt], i);
-#else
-      /* I want to note that SOME devices under linux do not follow this convention */
-      sprintf(media, "/dev/%s%c", mediaList[mt], 'a' + i);
-#endif
 
       media_t device = getMediaInfo(media);
 
-#ifdef __FreeBSD__
       /* Account for SATA devices (FORCED).  mediaList will always have IDE/SATA as position 0 */
       if(device.usable != USABLE_MEDIA && mt == 0 && i < MAX_SCAN)
       {
@@ -444,56 +186,12 @@ void buildMediaList(media_t devices[])
          i++;
          continue;
       }
-#endif
 
       /* Primative statistics collection, also in this case device.usable 
        * must be explicitely checked */
       if(device.usable == USABLE_MEDIA) 
       {
-         /* This is not the only way to do this.  Especially because it is NOT
-          * dynamic to the mediaList at all... */
-         if(strstr(device.name, "ad") != NULL || 
-            strstr(device.name, "hd") != NULL)
-         {
-            device_stats.ide++;
-         }
-
-         else if(strstr(device.name, "da") != NULL || 
-               strstr(device.name, "sd") != NULL ||
-               strstr(device.name, "amrd") != NULL)
-         {
-            device_stats.scsi++;
-         }
-         else
-         {
-            /* This could be BADDDDDDDDDDDD if there is a hiccup, but I think we need it */
-            device_stats.scsi++;
-         }
-
-         device_stats.total = 
-            device_stats.ide + device_stats.scsi;
-
-         /* Assign device to the array of devices */
-         if(device_stats.total > 0)
-         {
-            devices[device_stats.total-1] = device;
-         }
-         else
-         {
-            device_stats.total = 0;
-            devices[device_stats.total] = device;
-         }
-
-         if(udef_verbose)
-         {
-#ifdef __FreeBSD__
-   lwrite("%s:\t%s:\t%jd bytes\n", device.nameshort, device.ident, device.size);
-   printf("%s:\t%s:\t%jd bytes\n", device.nameshort, device.ident, device.size);
-#else
-   lwrite("%s:\t%jd bytes\n", device.nameshort, device.size);
-   printf("%s:\t%jd bytes\n", device.nameshort, device.size);
-#endif    
-         }
+         addMedia(devices, device);
       }
       else
       {
@@ -511,6 +209,25 @@ void buildMediaList(media_t devices[])
       i++;
 
    } while( 1 );
+#else
+   /* The kernel already knows every disk, no need to guess names */
+   media_t *found = (media_t*)calloc(BUFSIZ, sizeof(media_t));
+   int32_t count, i;
+
+   if(found == NULL)
+      return;
+
+   if((count = sysfs_scan(udef_sysfsroot, found, BUFSIZ)) < 0)
+   {
+      lwrite("Could not read %s/block, no devices found\n", udef_sysfsroot);
+      fprintf(stderr, "Could not read %s/block, no devices found\n", udef_sysfsroot);
+   }
+
+   for(i = 0; i < count; i++)
+      addMedia(devices, found[i]);
+
+   free(found);
+#endif
    
    if(udef_verbose)
       putchar('\n');
@@ -523,11 +240,10 @@ media_t getMediaInfo(const char* media)
    media_t mi;
 
    /* Set defaults */
+   memset(&mi, 0, sizeof(media_t));
    mi.usable = !USABLE_MEDIA;
-   mi.size = 0;
-   mi.name[0] = '\0';
-   mi.nameshort[0] = '\0';
-   mi.ident[0] = '\0';
+   mi.rotational = true;
+   mi.numanode = -1;
 
    /* Open media read-only and extract information using ioctl */
    fd = open(media, O_RDONLY);
@@ -540,20 +256,24 @@ media_t getMediaInfo(const char* media)
 #ifdef __FreeBSD__
    if((ioctl(fd, DIOCGMEDIASIZE, &mi.size)) != 0)
 #else
-   if((ioctl(fd, BLKGETSIZE, &mi.size)) != 0)
+   if((ioctl(fd, BLKGETSIZE64, &mi.size)) != 0)
 #endif
    {
       /* Returns in an unusable state */
+      close(fd);
       return mi;
    }
 
+   device_sectors(fd, &mi.lsector, &mi.psector);
+
 #ifdef __FreeBSD__
    if((ioctl(fd, DIOCGIDENT, mi.ident)) != 0)
       mi.ident[0] = '\0';
 #endif
 
-   memcpy(mi.name, media, strlen(media)+1);
-   memcpy(mi.nameshort, &media[5], strlen(media));
+   snprintf(mi.name, sizeof(mi.name), "%s", media);
+   snprintf(mi.nameshort, sizeof(mi.nameshort), "%s", &media[5]);
+   snprintf(mi.host, sizeof(mi.host), "%s", mi.nameshort);
 
    /* Mark the media as usuable or unusable */
    if(mi.size > 0)
@@ -579,9 +299,36 @@ void usage(const char* cmd)
                               1: Static patterns (0xA, 0xB, ...) (default)\n\
                               2: Fast random (single-random buffer)\n\
                               3: Slow random (muli-random buffer)\n\
-                              4: Ultra-slow re-writing method\n");
+                              4: Ultra-slow re-writing method (read, invert, random)\n\
+                              5: Cryptographic random (AES-CTR)\n\
+                              6: Device zero-out (BLKZEROOUT)\n\
+                              7: Discard (BLKDISCARD)\n\
+                              8: Secure discard (BLKSECDISCARD)\n");
+   printf("--pattern hex              Byte pattern for level 1, e.g. 0x92,0x49,0x24\n");
+   printf("--profile s                Multi-pass standard: dod, schneier, gutmann, nist-clear or a file\n");
+   printf("--aes-bits n               AES key size for level 5: 128 or 256 (default)\n");
    printf("--block-size n    -b  n    Blocks at once\n");
    printf("--passes n        -p  n    Number of passes to perform on a single device\n");
+   printf("--jobs n          -j  n    Devices to wipe concurrently (0: all, default)\n");
+   printf("--bus-jobs n               Devices wiped at once per controller (0: all, default; auto: find out)\n");
+   printf("--rate-limit n             Write at most n MB/s per device (0: unlimited, default)\n");
+   printf("--total-rate-limit n       Write at most n MB/s over all devices (0: unlimited, default)\n");
+   printf("--io-backend s             I/O backend: auto (default), uring, sync, splice\n");
+   printf("--queue-depth n   -q  n    Writes kept in flight per device (default: 8)\n");
+   printf("--autotune                 Pick the block size and queue depth per device\n");
+   printf("--retune                   Tune again when the rate drops (implies --autotune)\n");
+   printf("--no-pin                   Let workers run on any CPU, whatever NUMA node the device is on\n");
+   printf("--buffered                 Write through the page cache instead of O_DIRECT\n");
+   printf("--verify n                 Read back n percent of every pass (100: all)\n");
+   printf("--sample-verify n          Read back n random 1MB regions and both ends of every pass\n");
+   printf("--slow-threshold n         Flag devices n%% slower than their peers (default: 200, 0: off)\n");
+   printf("--sysfs-root path          Discover devices under path/block (default: /sys)\n");
+   printf("--journal path             Checkpoint file (default: /var/log/netnuke.journal, none: off)\n");
+   printf("--resume                   Continue the wipes recorded in the journal\n");
+   printf("--metrics-out path         Export metrics to a file, or unix:path for a socket\n");
+   printf("--metrics-format s         Metrics format: prom (default) or json\n");
+   printf("--metrics-interval n       Export metrics every n milliseconds (default: 10000)\n");
+   printf("--log-interval n           Write the log file every n milliseconds (default: 250)\n");
    printf("--disable-test             Disables test-mode, and allows write operations\n");
    printf("--verbose         -v       Extra device information\n");
    printf("--verbose-high    -vv      Debug level verbosity\n");
@@ -647,6 +394,43 @@ int filterArg(const char* key, char* value, short flags)
    return 0;
 }
 
+/* Signals handed to signal_thread() */
+static sigset_t signals_caught;
+static pthread_t signals;
+
+/* The signals that do work are taken here with sigwait(), so skipping and
+ * cleaning up run in normal context: a signal handler may not log,
+ * allocate or take a lock a worker could be holding */
+static void* signal_thread(void *arg)
+{
+   int sig;
+
+   (void)arg;
+   while(1)
+   {
+      if(sigwait(&signals_caught, &sig) != 0)
+         continue;
+      if(sig == SIGUSR1)
+         skip();
+      else
+         cleanup();
+   }
+   return NULL;
+}
+
+/* SIGABRT and SIGILL arrive on the thread that caused them, where nothing
+ * but async-signal-safe calls will do */
+static void fatal(int sig)
+{
+   static const char message[] = "\nFatal signal caught, exiting\n";
+   ssize_t ignored;
+
+   (void)sig;
+   ignored = write(STDERR_FILENO, message, sizeof(message) - 1);
+   (void)ignored;
+   _exit(2);
+}
+
 int main(int argc, char* argv[])
 {
    /* ANSI clear-screen sequence */
@@ -696,15 +480,9 @@ int main(int argc, char* argv[])
          if(filterArg(argv[tok-1], argv[tok+1], NONEGATIVE|NEEDNUM) == 0)
          {;
             ARGVALINT(udef_nukelevel);
-            if(udef_nukelevel > NUKE_REWRITE)
+            if(udef_nukelevel > NUKE_SECURE_DISCARD)
 	       udef_nukelevel = NUKE_PATTERN;
 	 }
-	 /* TODO: Remove this when it is implemented! */
-	 if(udef_nukelevel == NUKE_REWRITE)
-	 {
-	    printf("*** Rewrite mode is not implemented, using default.\n");
-	    udef_nukelevel = NUKE_PATTERN;
-	 }
       }
       if(ARGMATCH("--passes") || ARGMATCH("-p"))
       {
@@ -716,6 +494,182 @@ int main(int argc, char* argv[])
                udef_passes = 1;
          }
       }
+      if(ARGMATCH("--jobs") || ARGMATCH("-j"))
+      {
+         ARGNULL(+1);
+         if(filterArg(argv[tok-1], argv[tok+1], NONEGATIVE|NEEDNUM) == 0)
+         {
+            ARGVALINT(udef_jobs);
+         }
+      }
+      if(ARGMATCH("--bus-jobs"))
+      {
+         ARGNULL(+1);
+         if(strcmp(argv[tok+1], "auto") == 0)
+         {
+            udef_busjobs = SCHED_AUTO;
+            tok++;
+         }
+         else if(filterArg(argv[tok], argv[tok+1], NONEGATIVE|NEEDNUM) == 0)
+         {
+            ARGVALINT(udef_busjobs);
+         }
+      }
+      if(ARGMATCH("--rate-limit"))
+      {
+         ARGNULL(+1);
+         if(filterArg(argv[tok], argv[tok+1], NONEGATIVE|NEEDNUM) == 0)
+         {
+            ARGVALINT(udef_ratelimit);
+         }
+      }
+      if(ARGMATCH("--total-rate-limit"))
+      {
+         ARGNULL(+1);
+         if(filterArg(argv[tok], argv[tok+1], NONEGATIVE|NEEDNUM) == 0)
+         {
+            ARGVALINT(udef_totalrate);
+         }
+      }
+      if(ARGMATCH("--io-backend"))
+      {
+         ARGNULL(+1);
+         if(io_type_parse(argv[tok+1], &udef_iotype) != 0)
+         {
+            printf("argument %s received an unknown backend: %s\n", argv[tok], argv[tok+1]);
+            exit(1);
+         }
+         tok++;
+      }
+      if(ARGMATCH("--queue-depth") || ARGMATCH("-q"))
+      {
+         ARGNULL(+1);
+         if(filterArg(argv[tok-1], argv[tok+1], NONEGATIVE|NOZERO|NEEDNUM) == 0)
+         {
+            ARGVALINT(udef_qdepth);
+            if(udef_qdepth < 1)
+               udef_qdepth = 1;
+         }
+      }
+      if(ARGMATCH("--pattern"))
+      {
+         ARGNULL(+1);
+         if(pattern_parse(argv[tok+1], &udef_pattern) != 0)
+         {
+            printf("argument %s expects up to %d hex bytes: %s\n", argv[tok], PATTERN_MAX, argv[tok+1]);
+            exit(1);
+         }
+         tok++;
+      }
+      if(ARGMATCH("--profile"))
+      {
+         ARGNULL(+1);
+         if(profile_load(argv[tok+1], &udef_profile) != 0)
+            exit(1);
+         udef_profiled = true;
+         tok++;
+      }
+      if(ARGMATCH("--aes-bits"))
+      {
+         ARGNULL(+1);
+         if(filterArg(argv[tok], argv[tok+1], NONEGATIVE|NEEDNUM) == 0)
+         {
+            ARGVALINT(udef_aesbits);
+            if(udef_aesbits != 128 && udef_aesbits != 256)
+            {
+               printf("argument --aes-bits must be 128 or 256\n");
+               exit(1);
+            }
+         }
+      }
+      if(ARGMATCH("--verify"))
+      {
+         ARGNULL(+1);
+         if(filterArg(argv[tok], argv[tok+1], NONEGATIVE|NEEDNUM) == 0)
+         {
+            ARGVALINT(udef_verify);
+            if(udef_verify > 100)
+               udef_verify = 100;
+         }
+      }
+      if(ARGMATCH("--sample-verify"))
+      {
+         ARGNULL(+1);
+         if(filterArg(argv[tok], argv[tok+1], NONEGATIVE|NEEDNUM) == 0)
+         {
+            ARGVALINT(udef_samples);
+         }
+      }
+      if(ARGMATCH("--slow-threshold"))
+      {
+         ARGNULL(+1);
+         if(filterArg(argv[tok], argv[tok+1], NONEGATIVE|NEEDNUM) == 0)
+         {
+            ARGVALINT(udef_slowpct);
+         }
+      }
+      if(ARGMATCH("--sysfs-root"))
+      {
+         ARGNULL(+1);
+         ARGVALSTR(udef_sysfsroot);
+      }
+      if(ARGMATCH("--journal"))
+      {
+         ARGNULL(+1);
+         ARGVALSTR(udef_journal);
+      }
+      if(ARGMATCH("--resume"))
+      {
+         udef_resume = true;
+      }
+      if(ARGMATCH("--metrics-out"))
+      {
+         ARGNULL(+1);
+         ARGVALSTR(udef_metrics);
+      }
+      if(ARGMATCH("--metrics-format"))
+      {
+         ARGNULL(+1);
+         if(metrics_format_parse(argv[tok+1], &udef_metricsformat) != 0)
+         {
+            printf("argument %s received an unknown format: %s\n", argv[tok], argv[tok+1]);
+            exit(1);
+         }
+         tok++;
+      }
+      if(ARGMATCH("--metrics-interval"))
+      {
+         ARGNULL(+1);
+         if(filterArg(argv[tok], argv[tok+1], NONEGATIVE|NEEDNUM) == 0)
+         {
+            ARGVALINT(udef_metricsinterval);
+         }
+      }
+      if(ARGMATCH("--log-interval"))
+      {
+         ARGNULL(+1);
+         if(filterArg(argv[tok], argv[tok+1], NONEGATIVE|NEEDNUM) == 0)
+         {
+            ARGVALINT(udef_loginterval);
+         }
+      }
+      if(ARGMATCH("--autotune"))
+      {
+         udef_autotune = true;
+      }
+      if(ARGMATCH("--retune"))
+      {
+         udef_autotune = true;
+         udef_retune = true;
+      }
+      if(ARGMATCH("--no-pin"))
+      {
+         udef_pin = false;
+      }
+      if(ARGMATCH("--buffered"))
+      {
+         udef_direct = false;
+      }
       if(ARGMATCH("--disable-test"))
       {
          if((getgid()) != 0)
@@ -750,15 +704,30 @@ int main(int argc, char* argv[])
       exit(3);
    }
 
+   /* Blocked before the first thread starts, so every thread inherits
+    * it and only signal_thread() ever takes them */
+   sigemptyset(&signals_caught);
+   sigaddset(&signals_caught, SIGUSR1);
+   sigaddset(&signals_caught, SIGINT);
+   sigaddset(&signals_caught, SIGTERM);
+   pthread_sigmask(SIG_BLOCK, &signals_caught, NULL);
+
+   loginterval(udef_loginterval);
    logopen("/var/log/netnuke.log");
    lwrite(NETNUKE_VERSION_STRING);
    lwrite("Logging started\n");
 
-   signal(SIGUSR1, skip);
-   signal(SIGINT, cleanup);
-   signal(SIGTERM, cleanup);
-   signal(SIGABRT, cleanup);
-   signal(SIGILL, cleanup);
+   if(pthread_create(&signals, NULL, signal_thread, NULL) == 0)
+      pthread_detach(signals);
+   else
+   {
+      /* Better to die on the default action than to ignore ^C */
+      lwrite("Could not start the signal thread, signals are not handled\n");
+      fprintf(stderr, "Could not start the signal thread, signals are not handled\n");
+      pthread_sigmask(SIG_UNBLOCK, &signals_caught, NULL);
+   }
+   signal(SIGABRT, fatal);
+   signal(SIGILL, fatal);
 
    version_short();
    putchar('\n');
@@ -780,6 +749,21 @@ int main(int argc, char* argv[])
          case NUKE_RANDOM_FAST:
             nlstr = "Fast Random";
             break;
+         case NUKE_REWRITE:
+            nlstr = "Rewrite";
+            break;
+         case NUKE_RANDOM_CRYPTO:
+            nlstr = "Crypto Random";
+            break;
+         case NUKE_OFFLOAD_ZERO:
+            nlstr = "Device Zero-out";
+            break;
+         case NUKE_DISCARD:
+            nlstr = "Discard";
+            break;
+         case NUKE_SECURE_DISCARD:
+            nlstr = "Secure Discard";
+            break;
          default:
             nlstr = "Unknown";
             break;
@@ -787,15 +771,43 @@ int main(int argc, char* argv[])
 
        lwrite("Test mode:\t%s\n", udef_testmode ? "ENABLED" : "DISABLED");
        lwrite("Block size:\t%d\n", udef_blocksize);
-       lwrite("Wipe method:\t%s\n", nlstr);
-       lwrite("Num. of passes:\t%u\n", udef_passes);
+       if(udef_profiled)
+       {
+          lwrite("Wipe method:\tProfile %s\n", udef_profile.name);
+          lwrite("Num. of passes:\t%d\n", udef_profile.count);
+       }
+       else
+       {
+          lwrite("Wipe method:\t%s\n", nlstr);
+          lwrite("Num. of passes:\t%u\n", udef_passes);
+       }
        lwrite("Write mode:\t%cSYNC\n", udef_wmode ? 'A' : ' ');
+       lwrite("Jobs:\t\t%d\n", udef_jobs);
+       lwrite("I/O backend:\t%s\n", io_type_str(udef_iotype));
+       lwrite("Queue depth:\t%d\n", udef_qdepth);
+       lwrite("Direct I/O:\t%s\n", udef_direct ? "yes" : "no");
+       lwrite("Verify:\t\t%d%%\n", udef_verify);
+       lwrite("Sampled verify:\t%d regions\n", udef_samples);
 
        printf("Test mode:\t%s\n", udef_testmode ? "ENABLED" : "DISABLED");
        printf("Block size:\t%d\n", udef_blocksize);
-       printf("Wipe method:\t%s\n", nlstr);
-       printf("Num. of passes:\t%u\n", udef_passes);
+       if(udef_profiled)
+       {
+          printf("Wipe method:\tProfile %s\n", udef_profile.name);
+          printf("Num. of passes:\t%d\n", udef_profile.count);
+       }
+       else
+       {
+          printf("Wipe method:\t%s\n", nlstr);
+          printf("Num. of passes:\t%u\n", udef_passes);
+       }
        printf("Write mode:\t%cSYNC\n", udef_wmode ? 'A' : 0);
+       printf("Jobs:\t\t%d\n", udef_jobs);
+       printf("I/O backend:\t%s\n", io_type_str(udef_iotype));
+       printf("Queue depth:\t%d\n", udef_qdepth);
+       printf("Direct I/O:\t%s\n", udef_direct ? "yes" : "no");
+       printf("Verify:\t\t%d%%\n", udef_verify);
+       printf("Sampled verify:\t%d regions\n", udef_samples);
    }
 
    /* Allocate base memory for the device array */
@@ -821,30 +833,110 @@ int main(int argc, char* argv[])
 
    lwrite("IDE Devices:\t%d\n", device_stats.ide);
    lwrite("SCSI Devices:\t%d\n", device_stats.scsi);
+   lwrite("Other Devices:\t%d\n", device_stats.unknown);
    lwrite("Total Devices:\t%d\n", device_stats.total); 
 
-   printf("IDE Devices:\t%d\nSCSI Devices:\t%d\nTotal Devices:\t%d\n", 
-         device_stats.ide, device_stats.scsi, device_stats.total);
+   printf("IDE Devices:\t%d\nSCSI Devices:\t%d\nOther Devices:\t%d\nTotal Devices:\t%d\n", 
+         device_stats.ide, device_stats.scsi, device_stats.unknown, device_stats.total);
    putchar('\n');
    
+   /* Every usable device gets its own job with a private copy of the
+    * options, so the workers never have to consult the globals */
+   jobs = (nukejob_t*)calloc(device_stats.total ? device_stats.total : 1, sizeof(nukejob_t));
+   if(jobs == NULL)
+   {
+      lwrite("Could not allocate %zu bytes of memory for jobs array.\n", device_stats.total * sizeof(nukejob_t));
+      printf("Could not allocate %zu bytes of memory for jobs array.\n", device_stats.total * sizeof(nukejob_t));
+      exit(1);
+   }
+
    int i = 0;
-   do
+   int error;
+   int32_t njobs = 0;
+   for(i = 0; i < device_stats.total; i++)
    {
-      if(devices[i].usable == USABLE_MEDIA && devices[i].name[0] != '\0' && i <= device_stats.total)
+      if(devices[i].usable != USABLE_MEDIA || devices[i].name[0] == '\0')
+         continue;
+
+      nukejob_t *job = &jobs[njobs];
+      job_init(job, devices[i]);
+      job->nukelevel = udef_nukelevel;
+      job->wmode = udef_wmode;
+      job->passes = udef_passes;
+      job->blocksize = udef_blocksize;
+      job->iotype = udef_iotype;
+      job->qdepth = udef_qdepth;
+      job->aesbits = udef_aesbits;
+      job->pattern = udef_pattern;
+      job->verify = udef_verify;
+      job->samples = udef_samples;
+      job->slowpct = udef_slowpct;
+      job->ratelimit = (uint64_t)udef_ratelimit * 1024 * 1024;
+      job->autotune = udef_autotune;
+      job->retune = udef_retune;
+      job->pin = udef_pin;
+      if(udef_direct)
+         job->oflags |= O_DIRECT;
+      job->verbose = udef_verbose;
+      job->verbose_high = udef_verbose_high;
+
+      /* A profile takes over the level and the number of passes */
+      if(udef_profiled)
       {
-         /* Pass control off to the nuker */
-         nuke(devices[i]);
+         job->profile = &udef_profile;
+         job->passes = udef_profile.count;
+         job->nukelevel = job_level(job, 1);
       }
-      else
-         break;
 
-      i++;
+      /* test with 10MBs worth of data, each device gets its own image */
+      if(udef_testmode == true)
+      {
+         job->size = (1024 * 1024) * 10;
+         job->oflags |= O_CREAT;
+         snprintf(job->target, sizeof(job->target), "/tmp/testmode-%s.img", devices[i].nameshort);
+      }
 
-   } while( 1 );
+      njobs++;
+   }
+
+   if(udef_metrics != NULL && (error = metrics_open(udef_metrics, udef_metricsformat, udef_metricsinterval)) != 0)
+   {
+      lwrite("Could not write metrics to %s: %s\n", udef_metrics, strerror(error));
+      fprintf(stderr, "Could not write metrics to %s: %s\n", udef_metrics, strerror(error));
+      exit(1);
+   }
+
+   if(strcmp(udef_journal, "none") != 0 && (error = journal_open(udef_journal, jobs, njobs, udef_resume)) != 0)
+   {
+      lwrite("Could not %s the journal %s: %s\n", udef_resume ? "resume from" : "write", udef_journal, strerror(error));
+      fprintf(stderr, "Could not %s the journal %s: %s\n", udef_resume ? "resume from" : "write", udef_journal, strerror(error));
+
+      /* Better to stop than to start the wipes over unasked */
+      if(udef_resume)
+         exit(1);
+   }
+   else if(udef_resume && strcmp(udef_journal, "none") == 0)
+   {
+      fprintf(stderr, "--resume needs a journal\n");
+      exit(1);
+   }
+
+   /* Pass control off to the nukers */
+   sched_limits(udef_busjobs, (uint64_t)udef_totalrate * 1024 * 1024);
+   pool_run(jobs, njobs, udef_jobs);
+   pool_summary(jobs, njobs);
+   metrics_close();
+   journal_close();
 
    /* Free allocated memory */
+   for(i = 0; i < njobs; i++)
+   {
+      badmap_free(&jobs[i].bad);
+      badmap_free(&jobs[i].skipped);
+   }
+   free(jobs);
    free(devices);
-   
+
    lwrite("Logging ended\n");
    logclose();
 
@@ -880,26 +972,28 @@ void clearline()
    putchar('\n');
 }
 
+/* SIGINT and SIGTERM, run by signal_thread() */
 void cleanup()
 {
    lwrite("Signal caught, cleaning up...\n");
    fprintf(stderr, "\nSignal caught, cleaning up...\n");
 
    clearline();
-   free(devices);
 
+   /* Everything queued so far reaches the log before exiting */
    lwrite("Logging ended\n");
    logclose();
 
    exit(2);
 }
 
+/* SIGUSR1, run by signal_thread() */
 void skip()
 {
    clearline();
    lwrite("Skip signal recieved...\n");
    fprintf(stderr, "Skip signal recieved...\n");
 
-   /* This boolean is referenced in the nuke() function */
-   skipSignal = true;
+   /* Each running job polls its own skip flag */
+   pool_skip();
 }
@@ -2,12 +2,8 @@
 #define NETNUKE_H
 
 /* Prototypes */
-void fillRandom(char buffer[], uint64_t length);
-void staticPattern() __attribute__((alias("fillRandom")));
 uint64_t getSize(const char* media);
-int open_device(const char *media);
 int close_device(int fd);
-//int recycle_device(const char* media, int fd);
 void echoList(void);
 void usage(const char* cmd);
 void version_short(void);
@@ -22,6 +18,8 @@ int humanize_number(char *buf, size_t len, int64_t bytes,
 
 /* log.c */
 int logopen(const char* logfile);
+void loginterval(int interval);
+void logflush(void);
 void logclose(void);
 int lwrite(char* format, ...);
 
@@ -86,7 +84,11 @@ typedef enum nlevel
    NUKE_PATTERN,
    NUKE_RANDOM_FAST,
    NUKE_RANDOM_SLOW,
-   NUKE_REWRITE
+   NUKE_REWRITE,
+   NUKE_RANDOM_CRYPTO,
+   NUKE_OFFLOAD_ZERO,          /* BLKZEROOUT, the device writes the zeros */
+   NUKE_DISCARD,               /* BLKDISCARD */
+   NUKE_SECURE_DISCARD         /* BLKSECDISCARD */
 } nukeLevel_t;
 
 typedef struct MEDIASTAT_T
@@ -101,13 +103,434 @@ typedef struct MEDIA_T
 {
    int usable;
    uint64_t size;
-   char name[30];
-   char nameshort[10];
+   char name[64];
+   char nameshort[32];
    char ident[DISK_IDENT_SIZE];
+   uint32_t lsector;           /* Logical sector size, 0 when unknown */
+   uint32_t psector;           /* Physical sector size */
+   bool rotational;
+   int32_t queuedepth;         /* Requests the block layer queues */
+   uint64_t discardmax;        /* Largest discard, 0 without discard */
+   uint32_t discardgran;       /* Discard granularity */
+   uint64_t zeroesmax;         /* Largest offloaded zero-out */
+   char model[64];
+   char serial[64];
+   char host[256];             /* Controller the device is attached to */
+   int32_t numanode;           /* -1 when unknown */
+   char numacpus[256];         /* CPUs of that node, in cpulist format */
 } media_t;
-int32_t nuke(media_t device);
 void buildMediaList(media_t devices[]);
 media_t getMediaInfo(const char* media);
 
+/* sysfs.c */
+int sysfs_media(const char *root, const char *name, media_t *media);
+int32_t sysfs_scan(const char *root, media_t devices[], int32_t max);
+
+typedef enum jstate
+{
+   JOB_PENDING=0,
+   JOB_RUNNING,
+   JOB_DONE,
+   JOB_SKIPPED,
+   JOB_FAILED
+} jobState_t;
+
+/* Bytes produced per independently seekable piece of the random stream */
+#define RNG_CHUNK 4096
+
+typedef struct RNG_T
+{
+   uint64_t seed;              /* Device seed */
+   uint64_t key;               /* Seed of the current pass */
+} rng_t;
+
+/* Longest user defined pattern */
+#define PATTERN_MAX 64
+
+/* Read-ahead of the rewrite level, in chunks of at least REWRITE_CHUNK */
+#define REWRITE_CHUNK (4 * 1024 * 1024)
+#define REWRITE_BUFFERS 4
+
+/* Generated data is prepared ahead of the writer in chunks of at least
+ * GENERATE_CHUNK, by up to GENERATE_THREADS threads per device, in
+ * GENERATE_BUFFERS or as many more as the queue needs up to the most */
+#define GENERATE_CHUNK (4 * 1024 * 1024)
+#define GENERATE_THREADS 2
+#define GENERATE_BUFFERS 4
+#define GENERATE_BUFFERS_MAX 16
+
+/* Range handed to the device per zero-out or discard request */
+#define OFFLOAD_CHUNK (1024ULL * 1024 * 1024)
+
+/* Nanoseconds between checkpoints of a pass in progress */
+#define JOURNAL_INTERVAL (5 * 1000000000ULL)
+
+/* Most memory spent on pre-tiled write buffers per job */
+#define NUKE_STATIC_MAX (64 * 1024 * 1024)
+
+/* Latency histogram layout: every power of two range of nanoseconds up
+ * to 2^LATENCY_RANGE is split into LATENCY_SUB linear buckets, so any
+ * recorded value is known to within 1/LATENCY_SUB of itself */
+#define LATENCY_SUB_BITS 5
+#define LATENCY_SUB (1 << LATENCY_SUB_BITS)
+#define LATENCY_RANGE 48
+#define LATENCY_BUCKETS ((LATENCY_RANGE - LATENCY_SUB_BITS + 1) * LATENCY_SUB)
+
+/* Write errors counted per errno: EIO, ENXIO, ENOSPC, EINVAL, the rest */
+#define JOB_ERRNOS 5
+
+/* Failed writes within this distance of the last one make a cluster */
+#define BADBLOCK_CLUSTER (16 * 1024 * 1024)
+/* Farthest a clustered failure skips ahead */
+#define BADBLOCK_SKIP_MAX (256 * 1024 * 1024)
+
+/* --bus-jobs auto: every controller finds its own limit, see sched.c */
+#define SCHED_AUTO -1
+
+typedef struct BADRANGE_T
+{
+   uint64_t start;
+   uint64_t end;               /* One past the last byte */
+} badrange_t;
+
+/* Sorted, non-overlapping byte ranges */
+typedef struct BADMAP_T
+{
+   badrange_t *ranges;
+   uint32_t count;
+   uint32_t capacity;
+   uint64_t bytes;             /* Covered by all ranges together */
+} badmap_t;
+
+typedef struct LATENCY_T
+{
+   uint64_t buckets[LATENCY_BUCKETS];
+   uint64_t count;
+   uint64_t sum;               /* Nanoseconds */
+   uint64_t max;
+} latency_t;
+
+typedef struct PATTERN_T
+{
+   uint8_t bytes[PATTERN_MAX];
+   uint32_t length;
+} pattern_t;
+
+/* Most passes a profile may have */
+#define PROFILE_PASSES_MAX 64
+
+typedef struct PROFILEPASS_T
+{
+   nukeLevel_t level;
+   pattern_t pattern;          /* Empty for the static pattern rotation */
+   int32_t verify;             /* Percent read back afterwards, 0 is off */
+} profilepass_t;
+
+/* What every pass of a wipe writes, see profile.c */
+typedef struct PROFILE_T
+{
+   char name[BUFSIZ];
+   profilepass_t passes[PROFILE_PASSES_MAX];
+   int32_t count;
+} profile_t;
+
+typedef struct AESCTR_T
+{
+   int bits;
+   int rounds;
+   uint8_t nonce[8];
+   uint32_t rk[60];            /* Expanded key, big-endian words */
+   uint8_t rkbytes[240];       /* The same key schedule for AES-NI */
+} aesctr_t;
+
+typedef enum iotype
+{
+   IO_AUTO=0,
+   IO_SYNC,
+   IO_URING,
+   IO_SPLICE
+} ioType_t;
+
+/* One request worth of buffer space owned by an I/O backend */
+typedef struct IOSLOT_T
+{
+   char *buf;                  /* The slot's own buffer */
+   char *data;                 /* What is written, buf or the shared buffer */
+   int32_t bufindex;           /* Registered buffer that holds data */
+   uint64_t offset;
+   uint64_t length;
+   int64_t result;             /* Bytes written, or -errno */
+   uint64_t submitted;         /* Monotonic nanoseconds at submission */
+   uint64_t latency;           /* Nanoseconds until it completed */
+   int32_t index;
+   bool busy;
+} ioslot_t;
+
+struct IOBACKEND_T;
+
+typedef struct IOCTX_T
+{
+   const struct IOBACKEND_T *ops;
+   int fd;
+   int32_t depth;              /* Requests kept in flight */
+   uint64_t bufsize;           /* Size of each slot buffer */
+   char *pool;
+   uint64_t poolsize;
+   char *shared;               /* Read-only buffer common to all slots */
+   uint64_t sharedsize;
+   ioslot_t *slots;
+   int32_t inflight;
+   void *priv;
+} ioctx_t;
+
+/* A backend queues writes with submit() and hands back finished slots,
+ * one at a time, from reap() */
+typedef struct IOBACKEND_T
+{
+   const char *name;
+   int (*setup)(ioctx_t *io);
+   void (*teardown)(ioctx_t *io);
+   int (*submit)(ioctx_t *io, ioslot_t *slot);
+   ioslot_t* (*reap)(ioctx_t *io);
+} iobackend_t;
+
+/* One chunk of the device as read by the read-ahead thread */
+typedef struct RACHUNK_T
+{
+   char *buf;
+   uint64_t offset;
+   uint64_t length;
+   int error;                  /* errno of a failed read, 0 on success */
+} rachunk_t;
+
+typedef struct READAHEAD_T readahead_t;
+typedef struct GENERATOR_T generator_t;
+
+/* Everything a worker needs to wipe one device.  Options are copied from
+ * the udef_* globals when the job is created so workers never touch them. */
+typedef struct NUKEJOB_T
+{
+   media_t device;
+   char target[BUFSIZ];        /* Path that is actually written to */
+   uint64_t size;              /* Number of bytes to wipe */
+   nukeLevel_t nukelevel;
+   int8_t wmode;
+   int32_t passes;
+   int32_t blocksize;
+   ioType_t iotype;
+   int32_t qdepth;
+   uint32_t lsector;           /* Logical sector size */
+   uint32_t psector;           /* Physical sector size */
+   uint64_t seed;              /* Random stream seed, 0 picks one */
+   rng_t rng;
+   pattern_t pattern;          /* User pattern, empty for the default */
+   const profile_t *profile;   /* Pass table, NULL writes nukelevel every pass */
+   pattern_t tile;             /* Pattern of the current pass */
+   int aesbits;                /* 128 or 256 */
+   bool aeskeyed;              /* Key and nonce were supplied */
+   uint8_t aeskey[32];
+   uint8_t aesnonce[8];
+   aesctr_t aes;
+   bool verbose;
+   bool verbose_high;
+   bool progress;              /* Shown on the status line */
+   int oflags;                 /* Extra open(2) flags */
+   int32_t verify;             /* Percent read back after a pass, 0 is off */
+   int32_t samples;            /* Random regions read back instead, 0 is off */
+   int32_t slowpct;            /* Slow against peers at this percent, 0 is off */
+   volatile sig_atomic_t skip; /* Set when SIGUSR1 arrives */
+   jobState_t state;
+   int32_t pass;               /* Passes completed */
+   int32_t current;            /* Pass being written, for the reporter */
+   uint64_t passdone;          /* Bytes of that pass written, atomic */
+   uint64_t written;           /* Bytes written across all passes */
+   uint64_t verified;          /* Bytes read back across all passes */
+   uint64_t mismatched;        /* Bytes that did not read back as written */
+   uint32_t badranges;         /* Mismatched ranges */
+   double unwiped;             /* Most of the device a sampled verify could have
+                                  missed, at 95% confidence */
+   int32_t sampled;            /* Regions the last sampled verify read, both ends
+                                  included, 0 for a full one */
+   int32_t sampledbad;         /* Of them mismatched */
+   latency_t latency;          /* Write completion times */
+   uint64_t errors[JOB_ERRNOS];/* Write errors, see metrics_errno() */
+   bool slow;                  /* Flagged as much slower than its peers */
+   badmap_t bad;               /* Sectors that could not be written */
+   badmap_t skipped;           /* Left alone inside clustered bad regions */
+   uint64_t badskip;           /* Current skip across a bad region */
+   uint64_t badlast;           /* End of the last failed write */
+   uint64_t ratelimit;         /* Bytes per second, 0 is unlimited */
+   uint64_t pacenext;          /* When the next write may go, see sched_pace() */
+   bool autotune;              /* Pick block size and depth on the first pass */
+   bool retune;                /* And again when the rate drops */
+   double tunedrate;           /* Bytes per second the tuning found */
+   uint64_t tunestart;         /* Start of the window watched for a drop */
+   uint64_t tunedone;          /* Pass bytes at its start */
+   bool pin;                   /* Work on the NUMA node of the device */
+   bool journal;               /* Checkpoints are kept */
+   int32_t resumepass;         /* Pass to resume, 0 starts from scratch */
+   uint64_t resumeoffset;      /* Where in that pass */
+   int32_t ckpass;             /* Last checkpoint: pass being written */
+   uint64_t ckoffset;          /* and the offset below which it is durable */
+   int error;                  /* Last errno seen */
+   time_t start;
+   time_t end;
+} nukejob_t;
+
+/* nuke.c */
+void nuke_fill(nukejob_t *job, char *buf, uint64_t length, uint64_t offset);
+void fillRandom(nukejob_t *job, char buffer[], uint64_t length, uint64_t offset);
+void staticPattern(nukejob_t *job, char buffer[], uint64_t length, uint64_t offset);
+void patternTile(nukejob_t *job, int32_t pass, pattern_t *tile);
+int open_device(const char *media, int flags);
+int recycle_device(const char* media, int fd, int flags);
+int device_sectors(int fd, uint32_t *logical, uint32_t *physical);
+bool job_zeroes(const nukejob_t *job);
+nukeLevel_t job_level(const nukejob_t *job, int32_t pass);
+bool job_writes(const nukejob_t *job, nukeLevel_t level);
+bool level_generated(nukeLevel_t level);
+void job_init(nukejob_t *job, media_t device);
+int nuke(nukejob_t *job);
+
+/* random.c */
+const char* rng_impl(void);
+uint64_t rng_entropy(void);
+void rng_init(rng_t *rng, uint64_t seed, int32_t pass);
+void rng_fill(const rng_t *rng, void *buffer, uint64_t length, uint64_t offset);
+
+/* readahead.c */
+readahead_t* readahead_open(nukejob_t *job, char *pool, int32_t count, uint64_t chunksize,
+      bool (*want)(void *arg, uint64_t chunk), void *arg);
+rachunk_t* readahead_next(readahead_t *ra);
+void readahead_release(readahead_t *ra);
+void readahead_close(readahead_t *ra);
+
+/* generate.c */
+int32_t generate_threads(void);
+generator_t* generate_open(nukejob_t *job, char *pool, int32_t count, uint64_t chunksize,
+      int32_t pass, uint64_t offset);
+int32_t generate_held(generator_t *gen);
+rachunk_t* generate_chunk(generator_t *gen, int32_t index, int32_t *pass);
+rachunk_t* generate_next(generator_t *gen, int32_t *pass);
+void generate_release(generator_t *gen);
+void generate_close(generator_t *gen);
+
+/* verify.c */
+const char* verify_impl(void);
+bool verify_match(const char *buf, const char *expect, uint64_t length);
+int verify_pass(nukejob_t *job, int32_t pass, int32_t percent);
+
+/* profile.c */
+int profile_parse(const char *line, profilepass_t *pass);
+int profile_load(const char *spec, profile_t *profile);
+void profile_format(const profilepass_t *pass, char *out, size_t size);
+
+/* pattern.c */
+int pattern_parse(const char *spec, pattern_t *pattern);
+void pattern_set(pattern_t *pattern, const uint8_t *bytes, uint32_t length);
+void pattern_format(const pattern_t *pattern, char *out, size_t size);
+void pattern_fill(const uint8_t *tile, uint64_t period, void *buffer, uint64_t length, uint64_t offset);
+
+/* aes.c */
+const char* aes_impl(void);
+int aes_keygen(uint8_t *key, int bits, uint8_t nonce[8]);
+void aes_init(aesctr_t *aes, const uint8_t *key, int bits, const uint8_t nonce[8], int32_t pass);
+void aes_fill(const aesctr_t *aes, void *buffer, uint64_t length, uint64_t offset);
+void aes_hex(const uint8_t *data, size_t length, char *out);
+
+/* iobackend.c */
+const char* io_type_str(ioType_t type);
+int io_type_parse(const char *str, ioType_t *type);
+int io_open(ioctx_t *io, ioType_t type, int fd, int32_t depth, uint64_t bufsize,
+      char *shared, uint64_t sharedsize);
+void io_close(ioctx_t *io);
+ioslot_t* io_slot(ioctx_t *io);
+void io_use_shared(ioctx_t *io, ioslot_t *slot, char *data);
+int io_submit(ioctx_t *io, ioslot_t *slot);
+ioslot_t* io_reap(ioctx_t *io);
+
+/* pool.c */
+const char* job_state_str(jobState_t state);
+int pool_run(nukejob_t jobs[], int32_t count, int32_t workers);
+void pool_skip(void);
+void pool_summary(nukejob_t jobs[], int32_t count);
+
+/* progress.c */
+typedef struct PROGRESS_T
+{
+   int32_t pass;               /* Pass of the last sample */
+   uint64_t done;              /* Bytes of that pass at the last sample */
+   double rate;                /* Bytes per second since the last sample */
+   double average;             /* Moving average of the rate */
+   int32_t decile;             /* Last ten percent mark logged */
+   uint64_t tail;              /* 99th percentile latency of the last window */
+   int32_t windows;            /* Slow device check windows seen */
+} progress_t;
+
+int progress_start(nukejob_t jobs[], int32_t count, bool display);
+void progress_stop(void);
+
+/* sched.c */
+void sched_limits(int32_t busjobs, uint64_t totalrate);
+void sched_unlimit(void);
+int sched_open(nukejob_t jobs[], int32_t count);
+void sched_close(void);
+nukejob_t* sched_claim(void);
+void sched_release(nukejob_t *job);
+void sched_tick(progress_t state[]);
+void sched_pace(nukejob_t *job, uint64_t bytes);
+
+/* autotune.c */
+int autotune_run(nukejob_t *job, int fd, uint64_t *offset);
+bool autotune_wanted(const nukejob_t *job);
+bool autotune_due(nukejob_t *job, uint64_t done);
+
+/* numa.c */
+void* numa_alloc(uint64_t length);
+void numa_free(void *buf, uint64_t length);
+void numa_bind(nukejob_t *job);
+
+/* shared.c */
+char* shared_get(const void *key, uint64_t keylen, uint64_t length,
+      void (*fill)(char *buf, void *arg), void *arg);
+void shared_put(char *buf);
+
+/* badblock.c */
+int badmap_add(badmap_t *map, uint64_t start, uint64_t end);
+void badmap_free(badmap_t *map);
+int badblock_recover(nukejob_t *job, int fd, ioslot_t *slot, uint64_t *offset, uint64_t byteSize);
+
+/* journal.c */
+int journal_open(const char *path, nukejob_t jobs[], int32_t count, bool resume);
+int journal_save(void);
+void journal_checkpoint(nukejob_t *job, int32_t pass, uint64_t offset);
+void journal_close(void);
+
+/* latency.c */
+uint64_t latency_now(void);
+void latency_record(latency_t *latency, uint64_t ns);
+uint64_t latency_bound(int32_t bucket);
+void latency_copy(const latency_t *live, latency_t *copy);
+void latency_add(latency_t *into, const latency_t *from);
+void latency_window(const latency_t *live, latency_t *previous, latency_t *window);
+uint64_t latency_below(const latency_t *latency, uint64_t ns);
+uint64_t latency_percentile(const latency_t *latency, double fraction);
+void latency_format(uint64_t ns, char *out, size_t size);
+
+/* metrics.c */
+typedef enum mformat
+{
+   METRICS_PROM=0,
+   METRICS_JSON
+} metricsFormat_t;
+
+int metrics_format_parse(const char *str, metricsFormat_t *format);
+int metrics_open(const char *target, metricsFormat_t format, int32_t interval);
+bool metrics_due(void);
+void metrics_write(nukejob_t jobs[], const progress_t state[], int32_t count);
+void metrics_close(void);
+int metrics_errno(int error);
+void metrics_error(nukejob_t *job, int error);
+
 
 #endif /* NETNUKE_H */
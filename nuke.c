@@ -0,0 +1,1293 @@
+/**
+ *  NetNuke - Erases all storage media deteced by the system
+ *  Copyright (C) 2009  Joseph Hunkeler <jhunkeler@gmail.com, jhunk@stsci.edu>
+ *
+ *  This file is part of NetNuke.
+ *
+ *  NetNuke is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  NetNuke is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with NetNuke.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#ifdef __FreeBSD__
+   #include <libutil.h>
+   #include <sys/disk.h>
+#else
+   #include "human_readable.h"
+   #include <linux/fs.h>
+   #include <linux/falloc.h>
+#endif
+
+#include "netnuke.h"
+
+/* Static pattern array */
+const char sPattern[] = {
+	0xA0, 0xB0, 0xC0, 0xD0, 0xE0, 0xF0,
+	0xA1, 0xB1, 0xC1, 0xD1, 0xE1, 0xF1,
+	0xA2, 0xB2, 0xC2, 0xD2, 0xE2, 0xF2,
+	0xA3, 0xB3, 0xC3, 0xD3, 0xE3, 0xF3
+};
+
+/* This is a debug feature to prove the random generator is functioning */
+static void dumpBuffer(const char buffer[], uint64_t length)
+{
+   uint64_t i;
+
+   for(i = 0; i < length; i++)
+   {
+      printf("0x%02X  ", (unsigned char)buffer[i]);
+      if(i % 6 == 5)
+         putchar('\n');
+   }
+   putchar('\n');
+}
+
+/* Fills the write buffer with the random stream at the given offset */
+void fillRandom(nukejob_t *job, char buffer[], uint64_t length, uint64_t offset)
+{
+   rng_fill(&job->rng, buffer, length, offset);
+
+   if(job->verbose_high)
+      dumpBuffer(buffer, length);
+}
+
+/* Fills the write buffer with the pattern tile of the current pass */
+void staticPattern(nukejob_t *job, char buffer[], uint64_t length, uint64_t offset)
+{
+   pattern_fill(job->tile.bytes, job->tile.length, buffer, length, offset);
+
+   if(job->verbose_high)
+      dumpBuffer(buffer, length);
+}
+
+/* The tile written by a pattern pass.  Without a user pattern every pass
+ * writes the whole static pattern array, rotated by one byte per pass so
+ * consecutive passes never put the same byte on the same spot */
+void patternTile(nukejob_t *job, int32_t pass, pattern_t *tile)
+{
+   uint8_t bytes[sizeof(sPattern)];
+   size_t i;
+
+   if(job->pattern.length > 0)
+   {
+      *tile = job->pattern;
+      return;
+   }
+
+   for(i = 0; i < sizeof(sPattern); i++)
+      bytes[i] = (uint8_t)sPattern[(i + pass - 1) % sizeof(sPattern)];
+   pattern_set(tile, bytes, sizeof(sPattern));
+}
+
+int open_device(const char* media, int flags)
+{
+   int fd = 0;
+#ifdef __FreeBSD__
+      fd = open(media, O_RDWR | flags | O_DIRECT, 0700 );
+#else
+      /* O_DIRECT is only used when asked for, see nuke_open() */
+      fd = open(media, O_RDWR | flags, 0700 );
+#endif
+
+   return fd;
+}
+
+int recycle_device(const char *media, int fd, int flags)
+{
+   int fdtmp = fd;
+   if(!fdtmp)
+      return -1;
+
+   close(fdtmp);
+   fdtmp = open_device(media, flags);
+   return fdtmp;
+}
+
+/* Query the logical (smallest addressable) and physical (smallest atomic)
+ * sector sizes of whatever fd points at */
+int device_sectors(int fd, uint32_t *logical, uint32_t *physical)
+{
+   struct stat st;
+
+   *logical = 512;
+   *physical = 512;
+
+   if(fstat(fd, &st) != 0)
+      return 1;
+
+   if(S_ISREG(st.st_mode))
+   {
+      /* Direct I/O on a file has to respect the filesystem block */
+      if(st.st_blksize > 0)
+         *logical = *physical = st.st_blksize;
+      return 0;
+   }
+
+#ifdef __FreeBSD__
+   u_int sector = 0;
+   off_t stripe = 0;
+
+   if(ioctl(fd, DIOCGSECTORSIZE, &sector) == 0 && sector > 0)
+      *logical = *physical = sector;
+   if(ioctl(fd, DIOCGSTRIPESIZE, &stripe) == 0 && stripe > *logical)
+      *physical = (uint32_t)stripe;
+#else
+   int lsector = 0;
+   unsigned int psector = 0;
+
+   if(ioctl(fd, BLKSSZGET, &lsector) == 0 && lsector > 0)
+      *logical = *physical = lsector;
+   if(ioctl(fd, BLKPBSZGET, &psector) == 0 && psector > *logical)
+      *physical = psector;
+#endif
+
+   return 0;
+}
+
+/* Levels that leave nothing but zeros behind */
+bool job_zeroes(const nukejob_t *job)
+{
+   return job->nukelevel == NUKE_ZERO || job->nukelevel == NUKE_OFFLOAD_ZERO
+      || job->nukelevel == NUKE_DISCARD || job->nukelevel == NUKE_SECURE_DISCARD;
+}
+
+/* Level written by a pass, the profile's when there is one */
+nukeLevel_t job_level(const nukejob_t *job, int32_t pass)
+{
+   if(job->profile != NULL && pass >= 1 && pass <= job->profile->count)
+      return job->profile->passes[pass - 1].level;
+   return job->nukelevel;
+}
+
+/* Some pass writes this level */
+bool job_writes(const nukejob_t *job, nukeLevel_t level)
+{
+   int32_t pass;
+
+   if(job->profile == NULL)
+      return job->nukelevel == level;
+
+   for(pass = 1; pass <= job->profile->count; pass++)
+   {
+      if(job->profile->passes[pass - 1].level == level)
+         return true;
+   }
+   return false;
+}
+
+/* Levels generated ahead of the writes, see generate.c */
+bool level_generated(nukeLevel_t level)
+{
+   return level == NUKE_RANDOM_SLOW || level == NUKE_RANDOM_CRYPTO;
+}
+
+void job_init(nukejob_t *job, media_t device)
+{
+   memset(job, 0, sizeof(nukejob_t));
+   job->device = device;
+   job->size = device.size;
+   job->state = JOB_PENDING;
+   memcpy(job->target, device.name, strlen(device.name)+1);
+}
+
+/* Fill a write buffer with whatever this nuke level puts on the disk */
+void nuke_fill(nukejob_t *job, char *buf, uint64_t length, uint64_t offset)
+{
+   if(job->nukelevel == NUKE_RANDOM_CRYPTO)
+      aes_fill(&job->aes, buf, length, offset);
+   else if(job->nukelevel == NUKE_RANDOM_SLOW || job->nukelevel == NUKE_REWRITE)
+      fillRandom(job, buf, length, offset);
+   else if(job->nukelevel == NUKE_RANDOM_FAST)
+      fillRandom(job, buf, length, offset % job->blocksize);
+   else if(job_zeroes(job))
+      memset(buf, 0, length);
+   else
+      staticPattern(job, buf, length, offset);
+}
+
+/* Levels whose data depends on where it lands on the device */
+static bool nuke_regenerates(nukejob_t *job)
+{
+   return job->nukelevel == NUKE_RANDOM_SLOW || job->nukelevel == NUKE_RANDOM_CRYPTO
+      || job->nukelevel == NUKE_REWRITE;
+}
+
+static bool nuke_pipelined(nukejob_t *job)
+{
+   return level_generated(job->nukelevel);
+}
+
+static uint64_t gcd(uint64_t a, uint64_t b)
+{
+   while(b != 0)
+   {
+      uint64_t t = a % b;
+      a = b;
+      b = t;
+   }
+   return a;
+}
+
+/* Set the tile the pattern and zero levels repeat in this pass */
+static void nuke_tile(nukejob_t *job, int32_t pass)
+{
+   if(job_zeroes(job))
+      pattern_set(&job->tile, (const uint8_t*)"", 1);
+   else if(job->profile != NULL && job->profile->passes[pass - 1].pattern.length > 0)
+      job->tile = job->profile->passes[pass - 1].pattern;
+   else
+      patternTile(job, pass, &job->tile);
+}
+
+/* Percent of a pass read back, the profile may ask for more */
+static int32_t nuke_verify(nukejob_t *job, int32_t pass)
+{
+   if(job->profile != NULL && job->profile->passes[pass - 1].verify > job->verify)
+      return job->profile->passes[pass - 1].verify;
+   return job->verify;
+}
+
+/* What a statics buffer is built from, see nuke_statics() */
+typedef struct NUKESTATICS_T
+{
+   nukejob_t *job;
+   uint64_t byteSize;
+   uint64_t period;
+   uint64_t step;
+} nukestatics_t;
+
+static void nuke_statics_fill(char *statics, void *arg)
+{
+   nukestatics_t *how = (nukestatics_t*)arg;
+   uint64_t nphase = how->period / how->step;
+   uint64_t i;
+
+   /* One random block written over and over */
+   if(how->job->nukelevel == NUKE_RANDOM_FAST)
+   {
+      fillRandom(how->job, statics, how->byteSize, 0);
+      for(i = 1; i < nphase; i++)
+         memcpy(statics + i * how->byteSize, statics, how->byteSize);
+      return;
+   }
+
+   for(i = 0; i < nphase; i++)
+      pattern_fill(how->job->tile.bytes, how->period, statics + i * how->byteSize, how->byteSize, i * how->step);
+}
+
+/* Build the write buffers of a level whose data repeats.  A tile of period
+ * bytes written in blocks of byteSize only ever starts a block at a multiple
+ * of step = gcd(byteSize, period), so period / step pre-tiled blocks cover
+ * every block of the device and nothing has to be generated while writing.
+ * The block for offset is at (offset % period) / step.  Devices writing the
+ * same data share one buffer, it is given back with shared_put().  Returns
+ * NULL when that would take too much memory and the blocks are filled one
+ * by one. */
+static char* nuke_statics(nukejob_t *job, int32_t pass, uint64_t byteSize,
+      uint64_t *period, uint64_t *step, uint64_t *length)
+{
+   nukestatics_t how;
+   uint64_t key[3 + PATTERN_MAX / sizeof(uint64_t) + 1];
+
+   memset(key, 0, sizeof(key));
+   key[0] = byteSize;
+   key[1] = job->nukelevel == NUKE_RANDOM_FAST;
+
+   if(job->nukelevel == NUKE_RANDOM_FAST)
+   {
+      /* The block follows from the seed and the pass */
+      *period = byteSize;
+      key[2] = job->seed ^ ((uint64_t)pass << 48);
+   }
+   else
+   {
+      char text[PATTERN_MAX * 5 + 1];
+
+      *period = job->tile.length;
+      key[2] = job->tile.length;
+      memcpy(&key[3], job->tile.bytes, job->tile.length);
+
+      pattern_format(&job->tile, text, sizeof(text));
+      lwrite("%s: pass %d pattern %s\n", job->target, pass, text);
+   }
+
+   *step = gcd(byteSize, *period);
+   *length = *period / *step * byteSize;
+   if(*length > NUKE_STATIC_MAX)
+      return NULL;
+
+   how.job = job;
+   how.byteSize = byteSize;
+   how.period = *period;
+   how.step = *step;
+   return shared_get(key, sizeof(key), *length, nuke_statics_fill, &how);
+}
+
+/* Give back the buffer of nuke_statics(), or the rewrite level's chunks.
+ * The ring of generated chunks lasts the whole wipe. */
+static void nuke_release(nukejob_t *job, char *statics, uint64_t length)
+{
+   if(job->nukelevel == NUKE_REWRITE)
+      numa_free(statics, length);
+   else if(!nuke_pipelined(job))
+      shared_put(statics);
+}
+
+/* Finish a short write synchronously.  Returns 0 on success, otherwise
+ * errno is left describing the failure */
+static int nuke_finish(int fd, ioslot_t *slot, uint64_t done)
+{
+   while(done < slot->length)
+   {
+      ssize_t result = pwrite(fd, slot->data + done, slot->length - done, slot->offset + done);
+      if(result <= 0)
+      {
+         if(result == 0)
+            errno = EIO;
+         return 1;
+      }
+      done += result;
+   }
+   return 0;
+}
+
+/* Open the wipe target, falling back to the page cache if the target
+ * refuses direct I/O (tmpfs for example) */
+static int nuke_open(nukejob_t *job)
+{
+   int fd = open_device(job->target, job->oflags);
+
+   if(fd < 0 && errno == EINVAL && (job->oflags & O_DIRECT))
+   {
+      lwrite("%s: Direct I/O is not supported, using buffered writes\n", job->target);
+      job->oflags &= ~O_DIRECT;
+      fd = open_device(job->target, job->oflags);
+   }
+
+   return fd;
+}
+
+/* Swap the descriptor under an I/O context after the open flags changed.
+ * Everything still in flight is drained, and what of it failed is written
+ * again through the new descriptor right away, so nothing is left out and
+ * nothing already done is written twice.  Drained writes are counted the
+ * way the callers count theirs: every one for the block writes, only the
+ * random data for the rewrite level. */
+static int nuke_reopen(nukejob_t *job, ioctx_t *io, bool rewrite)
+{
+   ioslot_t *slot;
+   int fd = nuke_open(job);
+   int error = errno;
+
+   while(io->inflight > 0 && (slot = io_reap(io)) != NULL)
+   {
+      if(fd < 0)
+         continue;
+      latency_record(&job->latency, slot->latency);
+
+      if(nuke_finish(fd, slot, slot->result > 0 ? (uint64_t)slot->result : 0) != 0)
+      {
+         job->error = errno;
+         lwrite("%s: %s, while writing again at seek position %ju\n", job->target, strerror(errno), (uintmax_t)slot->offset);
+         fprintf(stderr, "%s: %s, while writing again at seek position %ju\n", job->target, strerror(errno), (uintmax_t)slot->offset);
+         continue;
+      }
+
+      job->written += slot->length;
+      if(!rewrite || slot->bufindex == slot->index)
+         __atomic_add_fetch(&job->passdone, slot->length, __ATOMIC_RELAXED);
+   }
+
+   if(fd < 0)
+   {
+      job->error = error;
+      lwrite("Recycling device %s failed. Skipping...\n", job->target);
+      fprintf(stderr, "Recycling device %s failed. Skipping...\n", job->target);
+      return 1;
+   }
+
+   close(io->fd);
+   io->fd = fd;
+   return 0;
+}
+
+/* Make everything written so far durable and record it in the journal.
+ * Writes still in flight may land in any order, so the checkpoint is the
+ * lowest of them. */
+static void nuke_checkpoint(nukejob_t *job, ioctx_t *io, int32_t pass, uint64_t offset)
+{
+   uint64_t durable = offset;
+   int32_t i;
+
+   for(i = 0; i < io->depth; i++)
+   {
+      if(io->slots[i].busy && io->slots[i].offset < durable)
+         durable = io->slots[i].offset;
+   }
+
+   if(fdatasync(io->fd) != 0)
+      return;
+   journal_checkpoint(job, pass, durable);
+}
+
+/* Tune block size and queue depth again halfway through a pass.  The
+ * queue has to be empty.  Everything the block size went into is built
+ * anew, generated chunks are only written in smaller pieces.  Returns 0,
+ * or 1 when the writes can not be set up again. */
+static int nuke_retune(nukejob_t *job, ioctx_t *io, int32_t pass, uint64_t *offset,
+      char **statics, uint64_t *staticsize, uint64_t *period, uint64_t *step)
+{
+   int fd = io->fd;
+   uint64_t from = *offset;
+   uint64_t bufsize;
+   int error;
+
+   io_close(io);
+   if(!nuke_regenerates(job))
+   {
+      shared_put(*statics);
+      *statics = NULL;
+      *staticsize = 0;
+   }
+
+   if(autotune_run(job, fd, offset) == 0 && *offset > from)
+      __atomic_add_fetch(&job->passdone, *offset - from, __ATOMIC_RELAXED);
+
+   if(!nuke_regenerates(job))
+      *statics = nuke_statics(job, pass, job->blocksize, period, step, staticsize);
+
+   bufsize = nuke_pipelined(job) && *statics != NULL ? 0 : job->blocksize;
+   if((error = io_open(io, job->iotype, fd, job->qdepth, bufsize, *statics, *staticsize)) != 0)
+   {
+      job->error = -error;
+      lwrite("%s: Could not set up I/O again: %s\n", job->target, strerror(-error));
+      fprintf(stderr, "%s: Could not set up I/O again: %s\n", job->target, strerror(-error));
+      return 1;
+   }
+   return 0;
+}
+
+/* Round the block size up to whole physical sectors so direct I/O is
+ * never refused and the drive never has to read-modify-write */
+static void nuke_geometry(nukejob_t *job, int fd)
+{
+   uint32_t align;
+   uint64_t blocksize = job->blocksize;
+
+   device_sectors(fd, &job->lsector, &job->psector);
+   align = job->psector > job->lsector ? job->psector : job->lsector;
+
+   if(blocksize % align != 0)
+      blocksize = (blocksize / align + 1) * align;
+
+   lwrite("%s: %u byte logical, %u byte physical sectors\n", job->target, job->lsector, job->psector);
+
+   if(blocksize != (uint64_t)job->blocksize)
+   {
+      lwrite("%s: Block size %d rounded up to %ju to match the sector size\n", job->target, job->blocksize, (uintmax_t)blocksize);
+      if(job->verbose)
+         printf("%s: Block size %d rounded up to %ju to match the sector size\n", job->target, job->blocksize, (uintmax_t)blocksize);
+      job->blocksize = (int32_t)blocksize;
+   }
+}
+
+/* Deal with a failed write.  Returns 0 when the wipe can carry on; the
+ * slot's result is its length if the write was done again after all */
+static int nuke_error(nukejob_t *job, ioctx_t *io, ioslot_t *slot, uint64_t byteSize, uint64_t *offset)
+{
+   media_t *device = &job->device;
+   char *media = job->target;
+   int64_t current = slot->offset;
+   int error = errno;
+
+   job->error = error;
+   metrics_error(job, error);
+
+   /* The block size was rounded to the sector size when the device was
+    * opened, so this is a filesystem that accepted O_DIRECT on open(2) but
+    * not for this write.  Carry on through the page cache instead. */
+   if(error == EINVAL && (job->oflags & O_DIRECT))
+   {
+      lwrite("%s: Direct I/O refused at seek position %jd, falling back to buffered writes\n", media, current);
+      fprintf(stderr, "%s: Direct I/O refused at seek position %jd, falling back to buffered writes\n", media, current);
+
+      job->oflags &= ~O_DIRECT;
+      if(nuke_reopen(job, io, offset == NULL) != 0)
+         return 1;
+
+      /* The refused block goes out again in place, rewinding to it would
+       * write again what completed after it */
+      if(nuke_finish(io->fd, slot, 0) == 0)
+      {
+         slot->result = slot->length;
+         return 0;
+      }
+      error = errno;
+      job->error = error;
+   }
+
+   /* If the device resets */
+   if(error == ENXIO)
+   {
+      lwrite("%s: Lost device at seek position %jd.  ***Manual destruction is necessary***\n", device->nameshort, current);
+      fprintf(stderr, "%s: Lost device at seek position %jd.  ***Manual destruction is necessary***\n", device->nameshort, current);
+      return 1;
+   }
+
+   /* If it is a physical device error, salvage what can be written */
+   if(error == EIO)
+   {
+      if(badblock_recover(job, io->fd, slot, offset, byteSize) == 0)
+         return 0;
+      error = errno;
+      if(error == ENXIO || error == ENODEV)
+      {
+         lwrite("%s: Lost device at seek position %jd.  ***Manual destruction is necessary***\n", device->nameshort, current);
+         fprintf(stderr, "%s: Lost device at seek position %jd.  ***Manual destruction is necessary***\n", device->nameshort, current);
+         return 1;
+      }
+   }
+
+   if(error == ENOSPC)
+   {
+      lwrite("%s: No space left on device.  seek position %jd\n", device->nameshort, current);
+      fprintf(stderr, "%s: No space left on device.  seek position %jd\n", device->nameshort, current);
+      return 1;
+   }
+
+   lwrite("%s: %s, while writing chunk %jd. seek position %jd\n", device->nameshort, strerror(error), current / byteSize, current);
+   fprintf(stderr, "%s: %s, while writing chunk %jd. seek position %jd\n", device->nameshort, strerror(error), current / byteSize, current);
+
+   /* Flush stderr to the screen */
+   fflush(stderr);
+   return 0;
+}
+
+/* Flip every bit of a chunk read back from the device */
+static void nuke_invert(char *buf, uint64_t length)
+{
+   uint64_t word, i = 0;
+
+   for(; i + 8 <= length; i += 8)
+   {
+      memcpy(&word, buf + i, sizeof(word));
+      word = ~word;
+      memcpy(buf + i, &word, sizeof(word));
+   }
+   for(; i < length; i++)
+      buf[i] = ~buf[i];
+}
+
+/* True while a write out of the chunk's buffer is still in flight */
+static bool nuke_chunk_busy(ioctx_t *io, rachunk_t *chunk)
+{
+   int32_t i;
+
+   for(i = 0; i < io->depth; i++)
+   {
+      ioslot_t *slot = &io->slots[i];
+
+      if(slot->busy && slot->data >= chunk->buf && slot->data < chunk->buf + chunk->length)
+         return true;
+   }
+   return false;
+}
+
+/* The ring of chunks generated ahead of the writes */
+typedef struct NUKEPIPE_T
+{
+   generator_t *gen;
+   char *pool;
+   uint64_t poolsize;
+   int32_t count;
+   uint64_t chunksize;
+   bool none;                  /* Every write is generated on its own */
+} nukepipe_t;
+
+/* Size the ring for the block size and depth the first pass writes with:
+ * a queue full of writes and a little more */
+static int nuke_pipe_alloc(nukejob_t *job, nukepipe_t *pipe, uint64_t byteSize)
+{
+   pipe->chunksize = (GENERATE_CHUNK + byteSize - 1) / byteSize * byteSize;
+   pipe->count = (int32_t)(((uint64_t)job->qdepth * byteSize + pipe->chunksize - 1) / pipe->chunksize) + 2;
+   if(pipe->count < GENERATE_BUFFERS)
+      pipe->count = GENERATE_BUFFERS;
+   if(pipe->count > GENERATE_BUFFERS_MAX)
+      pipe->count = GENERATE_BUFFERS_MAX;
+
+   pipe->poolsize = (uint64_t)pipe->count * pipe->chunksize;
+   if((pipe->pool = (char*)numa_alloc(pipe->poolsize)) == NULL)
+   {
+      pipe->poolsize = 0;
+      return 1;
+   }
+   return 0;
+}
+
+/* The generated data for a write at offset of pass, and in *length how
+ * much of it follows in one piece.  Chunks every write has moved past go
+ * back to the generator first.  Returns NULL while the data is held up
+ * behind writes in flight.  Should the writes ever go back further than
+ * the chunks at hand the generator starts over once the queue is empty;
+ * NULL with an empty queue means that failed. */
+static char* nuke_generated(nukejob_t *job, ioctx_t *io, nukepipe_t *pipe, int32_t pass, uint64_t offset,
+      uint64_t *length)
+{
+   rachunk_t *chunk;
+   int32_t i, chunkpass;
+
+   while(1)
+   {
+      while((chunk = generate_chunk(pipe->gen, 0, &chunkpass)) != NULL
+            && (chunkpass < pass || chunk->offset + chunk->length <= offset) && !nuke_chunk_busy(io, chunk))
+         generate_release(pipe->gen);
+
+      for(i = 0; (chunk = generate_chunk(pipe->gen, i, &chunkpass)) != NULL; i++)
+      {
+         if(chunkpass == pass && offset >= chunk->offset && offset < chunk->offset + chunk->length)
+         {
+            *length = chunk->offset + chunk->length - offset;
+            return chunk->buf + (offset - chunk->offset);
+         }
+      }
+
+      /* Further ahead, take the next chunk unless all are still written from */
+      chunk = generate_chunk(pipe->gen, generate_held(pipe->gen) - 1, &chunkpass);
+      if(chunk == NULL || chunkpass < pass || (chunkpass == pass && chunk->offset < offset))
+      {
+         if(generate_held(pipe->gen) >= pipe->count)
+            return NULL;
+         if(generate_next(pipe->gen, &chunkpass) != NULL)
+            continue;
+      }
+
+      if(io->inflight > 0)
+         return NULL;
+
+      lwrite("%s: Generating again from pass %d byte %ju\n", job->target, pass, (uintmax_t)offset);
+      generate_close(pipe->gen);
+      if((pipe->gen = generate_open(job, pipe->pool, pipe->count, pipe->chunksize, pass, offset)) == NULL)
+      {
+         job->error = errno;
+         lwrite("%s: Could not start generating: %s\n", job->target, strerror(errno));
+         fprintf(stderr, "%s: Could not start generating: %s\n", job->target, strerror(errno));
+         job->state = JOB_FAILED;
+         return NULL;
+      }
+   }
+}
+
+/* One pass of the rewrite level.  Every chunk of the device is read, its
+ * complement written back, and then the random stream written over it.
+ * The read-ahead thread reads the next chunks while the current one is
+ * written, and the random writes of a chunk go out together with the
+ * complement writes of the next one, so the three traversals overlap
+ * instead of taking three times the latency.  The random writes of a
+ * chunk are only queued once its complement is on the disk: queued
+ * writes to the same sectors may complete in any order. */
+static int nuke_rewrite(nukejob_t *job, ioctx_t *io, readahead_t *ra, int32_t pass, uint64_t byteSize)
+{
+   rachunk_t *chunk = NULL;
+   uint64_t invert = 0;           /* Next complement write in chunk */
+   uint64_t random = 0;           /* Next random write */
+   uint64_t randomEnd = 0;        /* Random writes are allowed up to here */
+   bool eof = false, stalled = false;
+   ioslot_t *slot;
+
+   while(1)
+   {
+      /* Complement the next chunk as soon as the reader has it */
+      if(chunk == NULL && !eof && !job->skip)
+      {
+         if((chunk = readahead_next(ra)) == NULL)
+            eof = true;
+         else if(chunk->error != 0)
+         {
+            /* Nothing to complement, the random data still goes out */
+            job->error = chunk->error;
+            lwrite("%s: Could not read %ju bytes at %ju: %s\n", job->target,
+                  (uintmax_t)chunk->length, (uintmax_t)chunk->offset, strerror(chunk->error));
+            fprintf(stderr, "%s: Could not read %ju bytes at %ju: %s\n", job->target,
+                  (uintmax_t)chunk->length, (uintmax_t)chunk->offset, strerror(chunk->error));
+            invert = chunk->length;
+         }
+         else
+         {
+            nuke_invert(chunk->buf, chunk->length);
+            invert = 0;
+         }
+      }
+
+      /* Keep the device queue full, random writes first so chunk buffers
+       * are not held up behind them */
+      while(!job->skip && (slot = io_slot(io)) != NULL)
+      {
+         uint64_t length;
+
+         if(random < randomEnd)
+         {
+            length = randomEnd - random < byteSize ? randomEnd - random : byteSize;
+            slot->offset = random;
+            slot->length = length;
+            nuke_fill(job, slot->buf, length, random);
+            sched_pace(job, length);
+            if((stalled = io_submit(io, slot) != 0))
+               break;
+            random += length;
+         }
+         else if(chunk != NULL && invert < chunk->length)
+         {
+            length = chunk->length - invert < byteSize ? chunk->length - invert : byteSize;
+            slot->offset = chunk->offset + invert;
+            slot->length = length;
+            io_use_shared(io, slot, chunk->buf + invert);
+            sched_pace(job, length);
+            if((stalled = io_submit(io, slot) != 0))
+               break;
+            invert += length;
+         }
+         else
+            break;
+      }
+
+      /* Once the complement of a chunk is on the disk its buffer goes back
+       * to the reader and the random data may follow */
+      if(chunk != NULL && invert >= chunk->length && !nuke_chunk_busy(io, chunk))
+      {
+         randomEnd = chunk->offset + chunk->length;
+         readahead_release(ra);
+         chunk = NULL;
+         continue;
+      }
+
+      if(io->inflight == 0)
+      {
+         if(job->skip || (eof && random >= randomEnd))
+            break;
+         if(stalled)
+         {
+            job->error = errno;
+            lwrite("%s: Could not queue a write: %s\n", job->target, strerror(errno));
+            fprintf(stderr, "%s: Could not queue a write: %s\n", job->target, strerror(errno));
+            return 1;
+         }
+         continue;
+      }
+
+      if((slot = io_reap(io)) == NULL)
+      {
+         job->error = errno;
+         lwrite("%s: Lost track of queued writes: %s\n", job->target, strerror(errno));
+         fprintf(stderr, "%s: Lost track of queued writes: %s\n", job->target, strerror(errno));
+         return 1;
+      }
+      latency_record(&job->latency, slot->latency);
+
+      if(slot->result >= 0 && (uint64_t)slot->result < slot->length)
+      {
+         if(nuke_finish(io->fd, slot, slot->result) == 0)
+            slot->result = slot->length;
+      }
+      else if(slot->result < 0)
+         errno = (int)-slot->result;
+
+      /* Blocks are read back in order, nothing can be skipped */
+      if(slot->result != (int64_t)slot->length && nuke_error(job, io, slot, byteSize, NULL) != 0)
+         return 1;
+
+      job->written += slot->result > 0 ? slot->result : 0;
+
+      /* Progress follows the random data, that is what stays behind */
+      if(slot->bufindex != slot->index)
+         continue;
+
+      if(slot->result == (int64_t)slot->length)
+         __atomic_add_fetch(&job->passdone, slot->length, __ATOMIC_RELAXED);
+   }
+
+   return 0;
+}
+
+/* Let the device erase itself, a range of OFFLOAD_CHUNK at a time.  File
+ * targets get the fallocate(2) equivalent.  Returns 0 when the device was
+ * erased, 1 on a hard error and -1 when the device or filesystem can not
+ * do it, in which case the caller writes zeros instead. */
+static int nuke_offload(nukejob_t *job, int fd, int32_t pass)
+{
+#ifdef __linux__
+   uint64_t size = job->size;
+   uint64_t offset = 0;
+   time_t startTime = time(NULL);
+   unsigned long request = BLKZEROOUT;
+   int mode = FALLOC_FL_ZERO_RANGE;
+   const char *how = "zeroed";
+   struct stat st;
+   bool file;
+
+   if(fstat(fd, &st) != 0)
+      return -1;
+   file = S_ISREG(st.st_mode);
+
+   if(job->nukelevel == NUKE_DISCARD || job->nukelevel == NUKE_SECURE_DISCARD)
+   {
+      request = job->nukelevel == NUKE_SECURE_DISCARD ? BLKSECDISCARD : BLKDISCARD;
+      mode = FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE;
+      how = job->nukelevel == NUKE_SECURE_DISCARD ? "securely discarded" : "discarded";
+
+      /* Files have no secure variant, a hole is as good as it gets */
+      if(file)
+         how = "punched";
+   }
+
+   /* A hole only reads back as zeros inside the file */
+   if(file && (uint64_t)st.st_size < size && ftruncate(fd, size) != 0)
+      return -1;
+
+   while(offset < size && !job->skip)
+   {
+      uint64_t length = size - offset < OFFLOAD_CHUNK ? size - offset : OFFLOAD_CHUNK;
+      uint64_t range[2] = { offset, length };
+      int result;
+
+      if(file)
+         result = fallocate(fd, mode, offset, length);
+      else
+         result = ioctl(fd, request, range);
+
+      if(result != 0)
+      {
+         int error = errno;
+
+         if(error == EOPNOTSUPP || error == ENOTTY || error == ENOSYS || error == EINVAL)
+         {
+            lwrite("%s: The device can not erase itself (%s), writing zeros instead\n", job->target, strerror(error));
+            if(job->verbose)
+               printf("%s: The device can not erase itself (%s), writing zeros instead\n", job->target, strerror(error));
+
+            /* The zeros are written over the whole device, count them once */
+            job->written -= offset;
+            __atomic_sub_fetch(&job->passdone, offset, __ATOMIC_RELAXED);
+            return -1;
+         }
+
+         job->error = error;
+         metrics_error(job, error);
+         lwrite("%s: %s, while erasing bytes %ju-%ju\n", job->device.nameshort, strerror(error),
+               (uintmax_t)offset, (uintmax_t)(offset + length - 1));
+         fprintf(stderr, "%s: %s, while erasing bytes %ju-%ju\n", job->device.nameshort, strerror(error),
+               (uintmax_t)offset, (uintmax_t)(offset + length - 1));
+         return 1;
+      }
+
+      offset += length;
+      job->written += length;
+      __atomic_add_fetch(&job->passdone, length, __ATOMIC_RELAXED);
+   }
+
+   lwrite("%s: pass %d %s %ju bytes in %jd seconds\n", job->target, pass, how,
+         (uintmax_t)offset, (intmax_t)(time(NULL) - startTime));
+   return 0;
+#else
+   (void)job;
+   (void)fd;
+   (void)pass;
+   return -1;
+#endif
+}
+
+int nuke(nukejob_t *job)
+{
+   uint64_t size = job->size;
+   char *media = job->target;
+
+   char mediaSize[BUFSIZ];
+   int32_t pass, first;
+   uint64_t byteSize;
+   uint64_t offset, checkpoint;
+   ioctx_t io;
+   ioslot_t *slot;
+   nukepipe_t pipe;
+   char *statics;
+   uint64_t period = 1, step = 1, staticsize;
+   readahead_t *ra;
+   uint64_t chunkSize;
+   uint64_t tuned;
+   bool retune, generated;
+   int32_t verify;
+   int offload;
+   int fd;
+   int error;
+
+   /* Everything was written before the wipe was interrupted */
+   if(job->resumepass > job->passes)
+   {
+      lwrite("%s: Already wiped according to the journal\n", media);
+      printf("%s: Already wiped according to the journal\n", media);
+      job->state = JOB_DONE;
+      job->pass = job->passes;
+      return 0;
+   }
+   first = job->resumepass > 0 ? job->resumepass : 1;
+
+   /* Set the IO mode */
+   job->oflags |= job->wmode ? O_ASYNC : O_SYNC;
+
+   /* Generate a size string based on the media size. example: 256M */
+   humanize_number(mediaSize, 5, (uint64_t)size, "",
+      HN_AUTOSCALE, HN_B | HN_NOSPACE | HN_DECIMAL);
+   lwrite("Wiping %s: %ju bytes (%s)\n", media, (intmax_t)size, mediaSize);
+   printf("Wiping %s: %ju bytes (%s)\n", media, (intmax_t)size, mediaSize);
+
+   /* One seed per device.  It is logged so the random stream of every
+    * pass can be regenerated later from nothing but the offset */
+   if(job->seed == 0)
+      job->seed = rng_entropy();
+   lwrite("%s: random seed %016jx (%s generator)\n", media, (uintmax_t)job->seed, rng_impl());
+
+   /* The same goes for the key and nonce of the cryptographic stream */
+   if(job_writes(job, NUKE_RANDOM_CRYPTO))
+   {
+      char key[65], nonce[17];
+
+      if(job->aesbits != 128 && job->aesbits != 256)
+         job->aesbits = 256;
+
+      if(!job->aeskeyed)
+      {
+         if(aes_keygen(job->aeskey, job->aesbits, job->aesnonce) != 0)
+         {
+            lwrite("%s: Could not read a key from the kernel, refusing to wipe\n", media);
+            fprintf(stderr, "%s: Could not read a key from the kernel, refusing to wipe\n", media);
+            job->state = JOB_FAILED;
+            return 1;
+         }
+         job->aeskeyed = true;
+      }
+
+      aes_hex(job->aeskey, job->aesbits / 8, key);
+      aes_hex(job->aesnonce, sizeof(job->aesnonce), nonce);
+      lwrite("%s: AES-%d-CTR key %s nonce %s (%s)\n", media, job->aesbits, key, nonce, aes_impl());
+      memset(key, 0, sizeof(key));
+   }
+
+   job->state = JOB_RUNNING;
+   job->start = time(NULL);
+   job->pass = first - 1;
+
+   /* The seed and key have to be on record before anything is written */
+   journal_checkpoint(job, first, job->resumeoffset);
+
+   memset(&pipe, 0, sizeof(nukepipe_t));
+
+   /* The device is opened once, every pass follows straight on */
+   if((fd = nuke_open(job)) < 0)
+   {
+      job->error = errno;
+      lwrite("nuke open_device: %s: %s\n", media, strerror(errno));
+      fprintf(stderr, "nuke open_device: %s: %s\n", media, strerror(errno));
+      job->state = JOB_FAILED;
+   }
+
+   /* Begin write passes */
+   for( pass = first; pass <= job->passes && job->state == JOB_RUNNING; pass++ )
+   {
+      /* A profile decides what every pass writes */
+      job->nukelevel = job_level(job, pass);
+      verify = nuke_verify(job, pass);
+      if(job->profile != NULL)
+      {
+         char what[PATTERN_MAX * 5 + 32];
+
+         profile_format(&job->profile->passes[pass - 1], what, sizeof(what));
+         lwrite("%s: pass %d of profile %s: %s\n", media, pass, job->profile->name, what);
+      }
+
+      rng_init(&job->rng, job->seed, pass);
+      if(job->nukelevel == NUKE_RANDOM_CRYPTO)
+         aes_init(&job->aes, job->aeskey, job->aesbits, job->aesnonce, pass);
+      if(!nuke_regenerates(job) && job->nukelevel != NUKE_RANDOM_FAST)
+         nuke_tile(job, pass);
+      /* Every pass gets through a bad region on its own */
+      job->badskip = job->badlast = 0;
+
+      if(pass == first)
+         nuke_geometry(job, fd);
+
+      /* Zero-out and discard are left to the device when it can */
+      offload = -1;
+      if(job->nukelevel >= NUKE_OFFLOAD_ZERO)
+         offload = nuke_offload(job, fd, pass);
+      if(offload > 0)
+         job->state = JOB_FAILED;
+
+      /* The start of the first pass is where block size and depth are
+       * tried.  A resumed pass keeps what the journal says. */
+      tuned = 0;
+      if(pass == first && offload < 0 && autotune_wanted(job)
+            && !(pass == job->resumepass && job->resumeoffset > 0)
+            && autotune_run(job, fd, &tuned) != 0)
+      {
+         lwrite("%s: Could not tune, writing %d byte blocks at queue depth %d\n", media, job->blocksize, job->qdepth);
+         tuned = 0;
+      }
+      byteSize = job->blocksize;
+
+      /* Levels that repeat themselves are generated once per pass.  Only
+       * the slow and crypto random levels generate data for every write */
+      statics = NULL;
+      staticsize = 0;
+      if(!nuke_regenerates(job) && offload < 0)
+         statics = nuke_statics(job, pass, byteSize, &period, &step, &staticsize);
+
+      /* The others are generated ahead into a ring that lasts all passes,
+       * given a spare CPU and the memory for it */
+      if(nuke_pipelined(job) && pipe.pool == NULL && !pipe.none)
+      {
+         if(generate_threads() == 0)
+            lwrite("%s: One CPU, every write is generated on its own\n", media);
+         else if(nuke_pipe_alloc(job, &pipe, byteSize) != 0)
+            lwrite("%s: Could not allocate generator buffers, every write is generated on its own\n", media);
+         pipe.none = pipe.pool == NULL;
+      }
+      generated = pipe.pool != NULL && nuke_pipelined(job);
+      if(generated)
+      {
+         statics = pipe.pool;
+         staticsize = pipe.poolsize;
+      }
+
+      /* The rewrite level writes the complement straight out of the chunks
+       * it read, so they are the shared buffer */
+      chunkSize = (REWRITE_CHUNK + byteSize - 1) / byteSize * byteSize;
+      if(job->nukelevel == NUKE_REWRITE)
+      {
+         staticsize = REWRITE_BUFFERS * chunkSize;
+         if((statics = (char*)numa_alloc(staticsize)) == NULL)
+         {
+            job->error = ENOMEM;
+            lwrite("%s: Could not allocate rewrite buffers\n", media);
+            fprintf(stderr, "%s: Could not allocate rewrite buffers\n", media);
+            job->state = JOB_FAILED;
+            break;
+         }
+      }
+
+      if((error = io_open(&io, job->iotype, fd, job->qdepth, generated ? 0 : byteSize,
+                  statics, staticsize)) != 0)
+      {
+         job->error = -error;
+         lwrite("%s: Could not set up I/O: %s\n", media, strerror(-error));
+         fprintf(stderr, "%s: Could not set up I/O: %s\n", media, strerror(-error));
+         job->state = JOB_FAILED;
+         nuke_release(job, statics, staticsize);
+         break;
+      }
+
+      ra = NULL;
+      if(job->nukelevel == NUKE_REWRITE
+            && (ra = readahead_open(job, statics, REWRITE_BUFFERS, chunkSize, NULL, NULL)) == NULL)
+      {
+         job->error = errno;
+         lwrite("%s: Could not start reading: %s\n", media, strerror(errno));
+         fprintf(stderr, "%s: Could not start reading: %s\n", media, strerror(errno));
+         job->state = JOB_FAILED;
+      }
+
+      if(pass == first)
+         lwrite("%s: %s%s writes, queue depth %d\n", media,
+               (job->oflags & O_DIRECT) ? "direct " : "", io.ops->name, io.depth);
+
+      /* The progress reporter picks the new pass up from here */
+      offset = tuned;
+      __atomic_store_n(&job->passdone, tuned, __ATOMIC_RELAXED);
+      __atomic_store_n(&job->current, pass, __ATOMIC_RELEASE);
+
+      /* Carry on from the checkpoint, the data for any offset can be
+       * generated on its own */
+      if(pass == job->resumepass && job->resumeoffset > 0)
+      {
+         if(ra == NULL && offload < 0)
+         {
+            offset = job->resumeoffset / byteSize * byteSize;
+            if(offset > size)
+               offset = size;
+            lwrite("%s: Resuming pass %d at byte %ju\n", media, pass, (uintmax_t)offset);
+            printf("%s: Resuming pass %d at byte %ju\n", media, pass, (uintmax_t)offset);
+            __atomic_store_n(&job->passdone, offset, __ATOMIC_RELAXED);
+         }
+         else
+            lwrite("%s: Pass %d is started over, this level can not resume halfway\n", media, pass);
+         job->resumeoffset = 0;
+      }
+      checkpoint = latency_now() + JOURNAL_INTERVAL;
+
+      /* Generation starts where the first pass writes and then keeps on
+       * into the passes after it */
+      if(generated && pipe.gen == NULL && job->state == JOB_RUNNING
+            && (pipe.gen = generate_open(job, pipe.pool, pipe.count, pipe.chunksize, pass, offset)) == NULL)
+      {
+         job->error = errno;
+         lwrite("%s: Could not start generating: %s\n", media, strerror(errno));
+         fprintf(stderr, "%s: Could not start generating: %s\n", media, strerror(errno));
+         job->state = JOB_FAILED;
+      }
+
+      /* The rewrite level runs its own read, invert and write pipeline */
+      if(ra != NULL && nuke_rewrite(job, &io, ra, pass, byteSize) != 0)
+         job->state = JOB_FAILED;
+
+      retune = false;
+      while(ra == NULL && offload < 0 && job->state == JOB_RUNNING)
+      {
+         /* The queue ran dry for another round of tuning */
+         if(retune && io.inflight == 0)
+         {
+            if(nuke_retune(job, &io, pass, &offset, &statics, &staticsize, &period, &step) != 0)
+            {
+               job->state = JOB_FAILED;
+               break;
+            }
+            byteSize = job->blocksize;
+            retune = false;
+         }
+
+         /* Keep the device queue full */
+         while(!retune && offset < size && !job->skip && (slot = io_slot(&io)) != NULL)
+         {
+            char *data = NULL;
+            uint64_t piece = byteSize;
+
+            if(generated && pipe.gen != NULL && (data = nuke_generated(job, &io, &pipe, pass, offset, &piece)) == NULL)
+               break;
+
+            slot->offset = offset;
+            slot->length = size - offset < byteSize ? size - offset : byteSize;
+            if(slot->length > piece)
+               slot->length = piece;
+
+            /* Point at the generated chunk, the pre-tiled block, or recycle
+             * the write table */
+            if(data != NULL)
+               io_use_shared(&io, slot, data);
+            else if(statics != NULL)
+               io_use_shared(&io, slot, statics + (offset % period) / step * byteSize);
+            else
+               nuke_fill(job, slot->buf, slot->length, slot->offset);
+
+            sched_pace(job, slot->length);
+            if(io_submit(&io, slot) != 0)
+               break;
+            offset += slot->length;
+         }
+
+         /* Break out if we have written all of the data */
+         if(io.inflight == 0)
+            break;
+
+         /* Dump data to the device */
+         if((slot = io_reap(&io)) == NULL)
+         {
+            job->error = errno;
+            lwrite("%s: Lost track of queued writes: %s\n", media, strerror(errno));
+            fprintf(stderr, "%s: Lost track of queued writes: %s\n", media, strerror(errno));
+            job->state = JOB_FAILED;
+            break;
+         }
+         latency_record(&job->latency, slot->latency);
+
+         if(slot->result >= 0 && (uint64_t)slot->result < slot->length)
+         {
+            /* A short write is not an error, finish it off */
+            if(nuke_finish(io.fd, slot, slot->result) == 0)
+               slot->result = slot->length;
+         }
+         else if(slot->result < 0)
+            errno = (int)-slot->result;
+
+         if(slot->result != (int64_t)slot->length && nuke_error(job, &io, slot, byteSize, &offset) != 0)
+         {
+            job->state = JOB_FAILED;
+            break;
+         }
+
+         /* Also when the error handling wrote it again */
+         if(slot->result == (int64_t)slot->length)
+         {
+            job->written += slot->length;
+            __atomic_add_fetch(&job->passdone, slot->length, __ATOMIC_RELAXED);
+         }
+
+         if(!retune && offset < size && autotune_due(job, __atomic_load_n(&job->passdone, __ATOMIC_RELAXED)))
+            retune = true;
+
+         if(job->journal && latency_now() >= checkpoint)
+         {
+            nuke_checkpoint(job, &io, pass, offset);
+            checkpoint = latency_now() + JOURNAL_INTERVAL;
+         }
+      } /* BLOCK WRITE */
+
+      /* The descriptor may have been swapped by an error recovery */
+      fd = io.fd;
+      io_close(&io);
+      readahead_close(ra);
+      if((verify || job->samples) && job->state == JOB_RUNNING && !job->skip)
+         fsync(fd);
+      nuke_release(job, statics, staticsize);
+
+      /* Read the pass back before the next one overwrites it */
+      if((verify || job->samples) && job->state == JOB_RUNNING && !job->skip)
+         verify_pass(job, pass, verify);
+
+      /* Poll for the signal to skip the device */
+      if(job->state == JOB_RUNNING && job->skip)
+      {
+         fflush(stdout);
+
+         if(job->progress)
+            clearline();
+         lwrite("Skipping device %s...\n", media);
+         fprintf(stderr, "Skipping device %s...\n", media);
+         job->state = JOB_SKIPPED;
+      }
+
+      if(job->state != JOB_RUNNING)
+         break;
+
+      job->pass = pass;
+      journal_checkpoint(job, pass + 1, 0);
+   } /* PASSES */
+
+   generate_close(pipe.gen);
+   numa_free(pipe.pool, pipe.poolsize);
+   if(fd >= 0)
+      close(fd);
+
+   job->end = time(NULL);
+   if(job->state == JOB_RUNNING)
+      job->state = job->mismatched ? JOB_FAILED : JOB_DONE;
+
+   return job->state == JOB_DONE ? 0 : 1;
+}
@@ -0,0 +1,175 @@
+/**
+ *  NetNuke - Erases all storage media deteced by the system
+ *  Copyright (C) 2009  Joseph Hunkeler <jhunkeler@gmail.com, jhunk@stsci.edu>
+ *
+ *  This file is part of NetNuke.
+ *
+ *  NetNuke is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  NetNuke is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with NetNuke.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * Buffer placement
+ *
+ * On a machine with more than one socket a disk hangs off the PCI root of
+ * one of them, and every byte written to it crosses the interconnect when
+ * the buffer, or the thread filling it, lives on the other one.  A worker
+ * moves onto the CPUs of its disk's NUMA node, as sysfs reported it, and
+ * asks the kernel to put its memory there before it allocates anything.
+ * Large buffers come from huge pages when some are reserved, transparent
+ * huge pages otherwise.  None of this needs libnuma, and whatever the
+ * system does not have is skipped.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#ifndef __FreeBSD__
+   #include <sched.h>
+   #include <sys/syscall.h>
+#endif
+
+#include "netnuke.h"
+
+/* Mappings are made in whole huge pages so they can be backed by them */
+#define NUMA_HUGEPAGE (2 * 1024 * 1024)
+/* set_mempolicy(2) modes, from linux/mempolicy.h */
+#define NUMA_MPOL_DEFAULT 0
+#define NUMA_MPOL_PREFERRED 1
+
+static bool numa_nohuge = false;       /* No huge pages are reserved */
+
+static uint64_t numa_maplen(uint64_t length)
+{
+   return (length + NUMA_HUGEPAGE - 1) / NUMA_HUGEPAGE * NUMA_HUGEPAGE;
+}
+
+/* A zeroed, page aligned buffer of length bytes on the calling thread's
+ * node.  Returns NULL when it can not be mapped. */
+void* numa_alloc(uint64_t length)
+{
+   uint64_t maplen = numa_maplen(length);
+   void *buf = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+   if(!__atomic_load_n(&numa_nohuge, __ATOMIC_RELAXED))
+   {
+      buf = mmap(NULL, maplen, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+      if(buf == MAP_FAILED)
+         __atomic_store_n(&numa_nohuge, true, __ATOMIC_RELAXED);
+   }
+#endif
+
+   if(buf == MAP_FAILED)
+   {
+      buf = mmap(NULL, maplen, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if(buf == MAP_FAILED)
+         return NULL;
+#ifdef MADV_HUGEPAGE
+      madvise(buf, maplen, MADV_HUGEPAGE);
+#endif
+   }
+
+   return buf;
+}
+
+void numa_free(void *buf, uint64_t length)
+{
+   if(buf != NULL)
+      munmap(buf, numa_maplen(length));
+}
+
+#ifndef __FreeBSD__
+static cpu_set_t numa_all;              /* Where the process was allowed to run */
+static pthread_once_t numa_once = PTHREAD_ONCE_INIT;
+
+static void numa_init(void)
+{
+   if(sched_getaffinity(0, sizeof(numa_all), &numa_all) != 0)
+      CPU_ZERO(&numa_all);
+}
+
+/* Parse a sysfs cpulist such as 0-15,32-47.  Returns the CPUs found. */
+static int numa_cpulist(const char *list, cpu_set_t *set)
+{
+   const char *p = list;
+   int count = 0;
+
+   CPU_ZERO(set);
+   while(*p != '\0')
+   {
+      char *end;
+      long first = strtol(p, &end, 10), last;
+
+      if(end == p)
+         break;
+      last = first;
+      if(*end == '-')
+      {
+         p = end + 1;
+         last = strtol(p, &end, 10);
+      }
+      for(; first <= last && first < CPU_SETSIZE; first++, count++)
+         CPU_SET(first, set);
+
+      p = *end == ',' ? end + 1 : end;
+   }
+   return count;
+}
+#endif
+
+/* Keep the calling worker, and the memory it allocates from now on, on
+ * the NUMA node of job's disk.  A disk without a known node sets the
+ * worker free again. */
+void numa_bind(nukejob_t *job)
+{
+#ifndef __FreeBSD__
+   int node = job->device.numanode;
+   cpu_set_t set;
+   unsigned long mask[16];
+
+   pthread_once(&numa_once, numa_init);
+
+   if(!job->pin || node < 0 || node >= (int)(sizeof(mask) * 8)
+         || numa_cpulist(job->device.numacpus, &set) == 0)
+   {
+      if(CPU_COUNT(&numa_all) > 0)
+         pthread_setaffinity_np(pthread_self(), sizeof(numa_all), &numa_all);
+      syscall(__NR_set_mempolicy, NUMA_MPOL_DEFAULT, NULL, 0);
+      return;
+   }
+
+   /* Never outside of what the process was given */
+   if(CPU_COUNT(&numa_all) > 0)
+      CPU_AND(&set, &set, &numa_all);
+   if(CPU_COUNT(&set) > 0 && pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+      lwrite("%s: Could not move to the CPUs of NUMA node %d\n", job->target, node);
+
+   memset(mask, 0, sizeof(mask));
+   mask[node / (sizeof(unsigned long) * 8)] = 1UL << (node % (sizeof(unsigned long) * 8));
+   if(syscall(__NR_set_mempolicy, NUMA_MPOL_PREFERRED, mask, sizeof(mask) * 8) != 0)
+      lwrite("%s: Could not prefer memory of NUMA node %d: %s\n", job->target, node, strerror(errno));
+
+   lwrite("%s: Working on NUMA node %d, CPUs %s\n", job->target, node, job->device.numacpus);
+#else
+   (void)job;
+#endif
+}
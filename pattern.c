@@ -0,0 +1,145 @@
+/**
+ *  NetNuke - Erases all storage media deteced by the system
+ *  Copyright (C) 2009  Joseph Hunkeler <jhunkeler@gmail.com, jhunk@stsci.edu>
+ *
+ *  This file is part of NetNuke.
+ *
+ *  NetNuke is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  NetNuke is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with NetNuke.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * Static patterns
+ *
+ * A pattern is a short tile of bytes repeated across the whole device, so
+ * the byte at any offset is tile[offset % length].  Buffers are filled by
+ * writing one period and then doubling it with memcpy, which runs at
+ * memory speed no matter how short the tile is.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <string.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include <time.h>
+
+#include "netnuke.h"
+
+static int hexval(int c)
+{
+   if(c >= '0' && c <= '9')
+      return c - '0';
+   c = tolower(c);
+   if(c >= 'a' && c <= 'f')
+      return c - 'a' + 10;
+   return -1;
+}
+
+/* Accepts "0x92,0x49,0x24", "92 49 24" or "924924" */
+int pattern_parse(const char *spec, pattern_t *pattern)
+{
+   const char *p = spec;
+
+   memset(pattern, 0, sizeof(pattern_t));
+
+   while(*p != '\0')
+   {
+      int hi, lo;
+
+      if(*p == ',' || *p == ' ' || *p == ':' || *p == '-')
+      {
+         p++;
+         continue;
+      }
+      if(p[0] == '0' && (p[1] == 'x' || p[1] == 'X'))
+         p += 2;
+
+      hi = hexval(p[0]);
+      lo = hi < 0 ? -1 : hexval(p[1]);
+      if(hi < 0)
+         return 1;
+
+      if(pattern->length >= PATTERN_MAX)
+         return 1;
+
+      /* A lone digit ("0x5") is a whole byte */
+      if(lo < 0)
+      {
+         pattern->bytes[pattern->length++] = (uint8_t)hi;
+         p++;
+      }
+      else
+      {
+         pattern->bytes[pattern->length++] = (uint8_t)(hi << 4 | lo);
+         p += 2;
+      }
+   }
+
+   return pattern->length == 0;
+}
+
+void pattern_set(pattern_t *pattern, const uint8_t *bytes, uint32_t length)
+{
+   if(length > PATTERN_MAX)
+      length = PATTERN_MAX;
+   memcpy(pattern->bytes, bytes, length);
+   pattern->length = length;
+}
+
+void pattern_format(const pattern_t *pattern, char *out, size_t size)
+{
+   size_t used = 0;
+   uint32_t i;
+
+   out[0] = '\0';
+   for(i = 0; i < pattern->length && used + 6 < size; i++)
+      used += snprintf(out + used, size - used, "%s0x%02X", i ? " " : "", pattern->bytes[i]);
+}
+
+/* Fill length bytes of buffer with the tiled data that belongs at offset */
+void pattern_fill(const uint8_t *tile, uint64_t period, void *buffer, uint64_t length, uint64_t offset)
+{
+   char *dest = (char*)buffer;
+   uint64_t phase = offset % period;
+   uint64_t done;
+
+   if(length == 0)
+      return;
+
+   if(period == 1)
+   {
+      memset(dest, tile[0], length);
+      return;
+   }
+
+   /* One period starting at the right phase */
+   done = period - phase < length ? period - phase : length;
+   memcpy(dest, tile + phase, done);
+   if(done < length)
+   {
+      uint64_t rest = phase < length - done ? phase : length - done;
+      memcpy(dest + done, tile, rest);
+      done += rest;
+   }
+
+   /* Everything after that is a copy of what is already there */
+   while(done < length)
+   {
+      uint64_t count = done < length - done ? done : length - done;
+      memcpy(dest + done, dest, count);
+      done += count;
+   }
+}
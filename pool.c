@@ -0,0 +1,281 @@
+/**
+ *  NetNuke - Erases all storage media deteced by the system
+ *  Copyright (C) 2009  Joseph Hunkeler <jhunkeler@gmail.com, jhunk@stsci.edu>
+ *
+ *  This file is part of NetNuke.
+ *
+ *  NetNuke is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  NetNuke is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with NetNuke.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#ifdef __FreeBSD__
+   #include <libutil.h>
+#else
+   #include "human_readable.h"
+#endif
+
+#include "netnuke.h"
+
+/* Bad ranges shown per device in the summary, the log gets all of them */
+#define POOL_BADRANGES 16
+
+/* The job table currently being worked on.  Kept here so the signal
+ * thread can reach the running jobs without any other globals. */
+static nukejob_t *pool_jobs = NULL;
+static int32_t pool_count = 0;
+
+const char* job_state_str(jobState_t state)
+{
+   switch(state)
+   {
+      case JOB_PENDING:
+         return "pending";
+      case JOB_RUNNING:
+         return "running";
+      case JOB_DONE:
+         return "done";
+      case JOB_SKIPPED:
+         return "skipped";
+      case JOB_FAILED:
+         return "failed";
+   }
+   return "unknown";
+}
+
+static void* pool_worker(void *arg)
+{
+   nukejob_t *job;
+   (void)arg;
+
+   /* Claim the next device whose controller has room for it */
+   while((job = sched_claim()) != NULL)
+   {
+      numa_bind(job);
+      nuke(job);
+      sched_release(job);
+   }
+
+   return NULL;
+}
+
+int pool_run(nukejob_t jobs[], int32_t count, int32_t workers)
+{
+   pthread_t *threads;
+   int32_t i, started = 0;
+   bool display;
+
+   if(count < 1)
+      return 0;
+
+   /* Zero workers means one per device */
+   if(workers < 1 || workers > count)
+      workers = count;
+
+   pool_jobs = jobs;
+   pool_count = count;
+
+   /* The status line only makes sense on a terminal */
+   display = isatty(STDOUT_FILENO);
+   for(i = 0; i < count; i++)
+      jobs[i].progress = display;
+
+   threads = (pthread_t*)calloc(workers, sizeof(pthread_t));
+   if(threads == NULL)
+   {
+      lwrite("Could not allocate %d worker threads\n", workers);
+      fprintf(stderr, "Could not allocate %d worker threads\n", workers);
+      return 1;
+   }
+
+   if(sched_open(jobs, count) != 0)
+   {
+      lwrite("Could not group the devices by controller\n");
+      fprintf(stderr, "Could not group the devices by controller\n");
+      free(threads);
+      return 1;
+   }
+
+   lwrite("Starting %d worker(s) for %d device(s)\n", workers, count);
+
+   if(progress_start(jobs, count, display) != 0)
+   {
+      lwrite("Could not start the progress reporter, no progress will be shown\n");
+      fprintf(stderr, "Could not start the progress reporter, no progress will be shown\n");
+      sched_unlimit();
+   }
+
+   for(i = 0; i < workers; i++)
+   {
+      if(pthread_create(&threads[i], NULL, pool_worker, NULL) != 0)
+      {
+         lwrite("Could not start worker %d\n", i);
+         fprintf(stderr, "Could not start worker %d\n", i);
+         break;
+      }
+      started++;
+   }
+
+   /* If no thread could be started do the work ourselves */
+   if(started == 0)
+      pool_worker(NULL);
+
+   for(i = 0; i < started; i++)
+      pthread_join(threads[i], NULL);
+   progress_stop();
+   sched_close();
+
+   free(threads);
+   return 0;
+}
+
+void pool_skip(void)
+{
+   int32_t i;
+
+   /* Only devices that are actively being wiped can be skipped */
+   for(i = 0; i < pool_count; i++)
+   {
+      if(pool_jobs[i].state == JOB_RUNNING)
+         pool_jobs[i].skip = 1;
+   }
+}
+
+/* List the ranges of a bad block map, the first POOL_BADRANGES of them */
+static void pool_badmap(nukejob_t *job, badmap_t *map, const char *what)
+{
+   uint32_t i;
+
+   for(i = 0; i < map->count; i++)
+   {
+      badrange_t *range = &map->ranges[i];
+
+      lwrite("%s: bytes %ju-%ju %s\n", job->device.nameshort, (uintmax_t)range->start,
+            (uintmax_t)range->end - 1, what);
+      if(i < POOL_BADRANGES)
+         printf("%s: bytes %ju-%ju %s\n", job->device.nameshort, (uintmax_t)range->start,
+               (uintmax_t)range->end - 1, what);
+   }
+   if(map->count > POOL_BADRANGES)
+      printf("%s: %u more ranges %s, see the log\n", job->device.nameshort, map->count - POOL_BADRANGES, what);
+}
+
+void pool_summary(nukejob_t jobs[], int32_t count)
+{
+   int32_t i;
+
+   lwrite("--Summary--\n");
+   printf("\n--Summary--\n");
+   printf("%-12s %-8s %-7s %-8s %-8s %-9s %-22s %s\n",
+         "Device", "State", "Passes", "Written", "Time", "Rate", "Latency p50/p99/p999", "Verify");
+
+   for(i = 0; i < count; i++)
+   {
+      nukejob_t *job = &jobs[i];
+      char written[BUFSIZ];
+      char rate[BUFSIZ];
+      char verify[BUFSIZ];
+      char bad[BUFSIZ];
+      char column[BUFSIZ];
+      char p50[16], p99[16], p999[16];
+      char latency[64];
+      char unwritable[96];
+      time_t elapsed = 0;
+
+      if(job->start && job->end)
+         elapsed = job->end - job->start;
+
+      humanize_number(written, 5, (int64_t)job->written, "",
+            HN_AUTOSCALE, HN_B | HN_NOSPACE | HN_DECIMAL);
+      humanize_number(rate, 5, (int64_t)(elapsed ? job->written / elapsed : job->written), "",
+            HN_AUTOSCALE, HN_B | HN_NOSPACE | HN_DECIMAL);
+
+      latency_format(latency_percentile(&job->latency, 0.5), p50, sizeof(p50));
+      latency_format(latency_percentile(&job->latency, 0.99), p99, sizeof(p99));
+      latency_format(latency_percentile(&job->latency, 0.999), p999, sizeof(p999));
+      if(job->latency.count > 0)
+         snprintf(latency, sizeof(latency), "%s/%s/%s", p50, p99, p999);
+      else
+         snprintf(latency, sizeof(latency), "-");
+
+      /* Verification result, if the job read anything back */
+      verify[0] = '\0';
+      bad[0] = '\0';
+      if(job->verified > 0)
+      {
+         snprintf(verify, sizeof(verify), ", verified %ju bytes, %ju mismatched in %u range(s)",
+               (uintmax_t)job->verified, (uintmax_t)job->mismatched, job->badranges);
+         /* A sample is never shown like a full read-back */
+         if(job->sampled > 0 && job->sampledbad > 0)
+            snprintf(verify + strlen(verify), sizeof(verify) - strlen(verify),
+                  ", sampled, no bound: %d of %d regions (both ends included) mismatched",
+                  job->sampledbad, job->sampled);
+         else if(job->sampled > 0)
+            snprintf(verify + strlen(verify), sizeof(verify) - strlen(verify),
+                  ", sampled, at most %.4f%% missed at 95%% confidence", job->unwiped * 100);
+         if(job->mismatched)
+            humanize_number(bad, 5, (int64_t)job->mismatched, "",
+                  HN_AUTOSCALE, HN_B | HN_NOSPACE | HN_DECIMAL);
+      }
+
+      /* The table says so too when only a sample was read */
+      if(job->verified == 0)
+         snprintf(column, sizeof(column), "-");
+      else if(job->sampled > 0 && job->sampledbad > 0)
+         snprintf(column, sizeof(column), "sampled %d/%d bad", job->sampledbad, job->sampled);
+      else if(job->sampled > 0)
+         snprintf(column, sizeof(column), "sampled <=%.4f%%", job->unwiped * 100);
+      else if(job->mismatched)
+         snprintf(column, sizeof(column), "%s bad", bad);
+      else
+         snprintf(column, sizeof(column), "ok");
+
+      unwritable[0] = '\0';
+      if(job->bad.count > 0 || job->skipped.count > 0)
+         snprintf(unwritable, sizeof(unwritable), ", %ju bytes unwritable, %ju skipped",
+               (uintmax_t)job->bad.bytes, (uintmax_t)job->skipped.bytes);
+
+      lwrite("%s: %s, %d of %d passes, %ju bytes in %jd seconds, write latency p50/p99/p999 %s%s%s%s%s%s\n",
+            job->device.nameshort, job_state_str(job->state),
+            job->pass, job->passes, (uintmax_t)job->written, (intmax_t)elapsed, latency, verify,
+            job->slow ? ", flagged slow" : "", unwritable,
+            job->error ? ", last error: " : "",
+            job->error ? strerror(job->error) : "");
+      printf("%-12s %-8s %3d/%-3d %-8s %-8jd %-9s %-22s %s\n",
+            job->device.nameshort, job_state_str(job->state),
+            job->pass, job->passes, written, (intmax_t)elapsed, strcat(rate, "/s"), latency, column);
+   }
+
+   /* Drives worth pulling before the next batch */
+   for(i = 0; i < count; i++)
+   {
+      if(jobs[i].slow)
+         printf("%s was much slower than its peers, consider replacing it\n", jobs[i].device.nameshort);
+   }
+
+   /* What is still on the media */
+   for(i = 0; i < count; i++)
+   {
+      pool_badmap(&jobs[i], &jobs[i].bad, "could not be written");
+      pool_badmap(&jobs[i], &jobs[i].skipped, "skipped in a bad region");
+   }
+   putchar('\n');
+}
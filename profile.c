@@ -0,0 +1,307 @@
+/**
+ *  NetNuke - Erases all storage media deteced by the system
+ *  Copyright (C) 2009  Joseph Hunkeler <jhunkeler@gmail.com, jhunk@stsci.edu>
+ *
+ *  This file is part of NetNuke.
+ *
+ *  NetNuke is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  NetNuke is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with NetNuke.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * Wipe profiles
+ *
+ * A profile is a table of passes, each with a level of its own, an
+ * optional pattern and whether it is read back afterwards.  Profiles are
+ * written one pass per line:
+ *
+ *    # DoD 5220.22-M
+ *    zero
+ *    pattern 0xFF
+ *    random verify
+ *
+ * The first word is what the pass writes, see profile_kinds.  A pattern
+ * pass may name its bytes, otherwise it rotates through the static
+ * patterns.  "verify" reads the whole pass back, "verify=n" n percent.
+ * The standard schemes are built in, in the very same form.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <string.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+
+#include "netnuke.h"
+
+typedef struct PROFILEKIND_T
+{
+   const char *name;
+   nukeLevel_t level;
+} profilekind_t;
+
+static const profilekind_t profile_kinds[] =
+{
+   { "zero", NUKE_ZERO },
+   { "pattern", NUKE_PATTERN },
+   { "fast-random", NUKE_RANDOM_FAST },
+   { "random", NUKE_RANDOM_SLOW },
+   { "rewrite", NUKE_REWRITE },
+   { "crypto", NUKE_RANDOM_CRYPTO },
+   { "device-zero", NUKE_OFFLOAD_ZERO },
+   { "discard", NUKE_DISCARD },
+   { "secure-discard", NUKE_SECURE_DISCARD },
+   { NULL, NUKE_ZERO }
+};
+
+typedef struct PROFILEBUILTIN_T
+{
+   const char *name;
+   const char *passes;         /* Lines of a profile file */
+} profilebuiltin_t;
+
+static const profilebuiltin_t profile_builtins[] =
+{
+   /* DoD 5220.22-M: a character, its complement, then random data */
+   { "dod",
+      "zero\n"
+      "pattern 0xFF\n"
+      "random verify\n" },
+
+   /* Bruce Schneier, Applied Cryptography */
+   { "schneier",
+      "pattern 0xFF\n"
+      "zero\n"
+      "random\nrandom\nrandom\nrandom\nrandom\n" },
+
+   /* Peter Gutmann: four random passes around the 27 patterns aimed at MFM
+    * and RLL encodings */
+   { "gutmann",
+      "random\nrandom\nrandom\nrandom\n"
+      "pattern 0x55\n"
+      "pattern 0xAA\n"
+      "pattern 0x92,0x49,0x24\n"
+      "pattern 0x49,0x24,0x92\n"
+      "pattern 0x24,0x92,0x49\n"
+      "pattern 0x00\n"
+      "pattern 0x11\n"
+      "pattern 0x22\n"
+      "pattern 0x33\n"
+      "pattern 0x44\n"
+      "pattern 0x55\n"
+      "pattern 0x66\n"
+      "pattern 0x77\n"
+      "pattern 0x88\n"
+      "pattern 0x99\n"
+      "pattern 0xAA\n"
+      "pattern 0xBB\n"
+      "pattern 0xCC\n"
+      "pattern 0xDD\n"
+      "pattern 0xEE\n"
+      "pattern 0xFF\n"
+      "pattern 0x92,0x49,0x24\n"
+      "pattern 0x49,0x24,0x92\n"
+      "pattern 0x24,0x92,0x49\n"
+      "pattern 0x6D,0xB6,0xDB\n"
+      "pattern 0xB6,0xDB,0x6D\n"
+      "pattern 0xDB,0x6D,0xB6\n"
+      "random\nrandom\nrandom\nrandom\n" },
+
+   /* NIST SP 800-88 Clear: one overwrite, verified */
+   { "nist-clear",
+      "zero verify\n" },
+
+   { NULL, NULL }
+};
+
+/* Parse one line into a pass.  Returns 0 for a pass, -1 for a blank line
+ * or a comment and 1 when the line makes no sense. */
+int profile_parse(const char *line, profilepass_t *pass)
+{
+   char copy[BUFSIZ];
+   char *word, *save = NULL;
+   int32_t i;
+
+   memset(pass, 0, sizeof(profilepass_t));
+   snprintf(copy, sizeof(copy), "%s", line);
+   copy[strcspn(copy, "#")] = '\0';
+
+   if((word = strtok_r(copy, " \t\r\n", &save)) == NULL)
+      return -1;
+
+   for(i = 0; profile_kinds[i].name != NULL; i++)
+   {
+      if(strcmp(word, profile_kinds[i].name) == 0)
+         break;
+   }
+   if(profile_kinds[i].name == NULL)
+      return 1;
+   pass->level = profile_kinds[i].level;
+
+   while((word = strtok_r(NULL, " \t\r\n", &save)) != NULL)
+   {
+      if(strcmp(word, "verify") == 0)
+         pass->verify = 100;
+      else if(strncmp(word, "verify=", 7) == 0)
+      {
+         pass->verify = atoi(word + 7);
+         if(pass->verify < 1 || pass->verify > 100 || !isdigit((unsigned char)word[7]))
+            return 1;
+      }
+      else if(pass->level == NUKE_PATTERN && pass->pattern.length == 0)
+      {
+         if(pattern_parse(word, &pass->pattern) != 0)
+            return 1;
+      }
+      else
+         return 1;
+   }
+
+   return 0;
+}
+
+/* Add the pass on one line to profile.  source and number name it in
+ * error messages.  Returns 0 when the line was understood. */
+static int profile_line(const char *source, int32_t number, const char *line, profile_t *profile)
+{
+   profilepass_t pass;
+   int result;
+
+   if((result = profile_parse(line, &pass)) < 0)
+      return 0;
+   if(result > 0)
+   {
+      fprintf(stderr, "%s:%d: not a pass: %s\n", source, number, line);
+      return 1;
+   }
+   if(profile->count == PROFILE_PASSES_MAX)
+   {
+      fprintf(stderr, "%s:%d: more than %d passes\n", source, number, PROFILE_PASSES_MAX);
+      return 1;
+   }
+   profile->passes[profile->count++] = pass;
+   return 0;
+}
+
+static int profile_done(const char *source, profile_t *profile)
+{
+   if(profile->count == 0)
+   {
+      fprintf(stderr, "%s: no passes\n", source);
+      return 1;
+   }
+   return 0;
+}
+
+/* Add the passes of a built-in profile */
+static int profile_read(const char *source, const char *text, profile_t *profile)
+{
+   const char *line = text;
+   int32_t number = 0;
+
+   while(*line != '\0')
+   {
+      size_t length = strcspn(line, "\n");
+      char buf[BUFSIZ];
+
+      snprintf(buf, sizeof(buf), "%.*s", (int)length, line);
+      line += length + (line[length] == '\n');
+      if(profile_line(source, ++number, buf, profile) != 0)
+         return 1;
+   }
+
+   return profile_done(source, profile);
+}
+
+/* Add the passes of a profile file, a line at a time so nothing of it is
+ * ever cut off */
+static int profile_file(const char *source, FILE *fp, profile_t *profile)
+{
+   char buf[BUFSIZ];
+   int32_t number = 0;
+
+   while(fgets(buf, sizeof(buf), fp) != NULL)
+   {
+      number++;
+      if(strchr(buf, '\n') == NULL && !feof(fp))
+      {
+         fprintf(stderr, "%s:%d: line longer than %d bytes\n", source, number, BUFSIZ - 2);
+         return 1;
+      }
+      buf[strcspn(buf, "\n")] = '\0';
+      if(profile_line(source, number, buf, profile) != 0)
+         return 1;
+   }
+   if(ferror(fp))
+   {
+      fprintf(stderr, "%s: %s\n", source, strerror(errno));
+      return 1;
+   }
+
+   return profile_done(source, profile);
+}
+
+/* Load a built-in profile by name, or a profile file.  Returns 0 on
+ * success, otherwise the reason was printed. */
+int profile_load(const char *spec, profile_t *profile)
+{
+   FILE *fp;
+   int32_t i;
+   int error;
+
+   memset(profile, 0, sizeof(profile_t));
+   snprintf(profile->name, sizeof(profile->name), "%s", spec);
+
+   for(i = 0; profile_builtins[i].name != NULL; i++)
+   {
+      if(strcmp(spec, profile_builtins[i].name) == 0)
+         return profile_read(spec, profile_builtins[i].passes, profile);
+   }
+
+   if((fp = fopen(spec, "r")) == NULL)
+   {
+      fprintf(stderr, "%s: not a built-in profile (", spec);
+      for(i = 0; profile_builtins[i].name != NULL; i++)
+         fprintf(stderr, "%s%s", i ? ", " : "", profile_builtins[i].name);
+      fprintf(stderr, ") nor a readable file\n");
+      return 1;
+   }
+   error = profile_file(spec, fp, profile);
+   fclose(fp);
+
+   return error;
+}
+
+/* What a pass writes, the way a profile file says it */
+void profile_format(const profilepass_t *pass, char *out, size_t size)
+{
+   char pattern[PATTERN_MAX * 5 + 1] = "";
+   char verify[16] = "";
+   int32_t i;
+
+   for(i = 0; profile_kinds[i].name != NULL && profile_kinds[i].level != pass->level; i++)
+      ;
+   if(pass->pattern.length > 0)
+      pattern_format(&pass->pattern, pattern, sizeof(pattern));
+   if(pass->verify >= 100)
+      snprintf(verify, sizeof(verify), "verify");
+   else if(pass->verify > 0)
+      snprintf(verify, sizeof(verify), "verify=%d", pass->verify);
+
+   snprintf(out, size, "%s%s%s%s%s", profile_kinds[i].name ? profile_kinds[i].name : "?",
+         pattern[0] ? " " : "", pattern, verify[0] ? " " : "", verify);
+}
@@ -0,0 +1,417 @@
+/**
+ *  NetNuke - Erases all storage media deteced by the system
+ *  Copyright (C) 2009  Joseph Hunkeler <jhunkeler@gmail.com, jhunk@stsci.edu>
+ *
+ *  This file is part of NetNuke.
+ *
+ *  NetNuke is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  NetNuke is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with NetNuke.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * Progress reporting
+ *
+ * The write loops do nothing for progress but add the bytes of every
+ * finished write to job->passdone.  A reporter thread samples those
+ * counters every PROGRESS_INTERVAL milliseconds, works out the current
+ * and the average rate of every device against the monotonic clock, and
+ * draws a single status line covering all of the devices being wiped.
+ * The same samples feed the metrics export, and every few seconds each
+ * device's write latency and rate are held against its peers to catch a
+ * dying drive before it holds up the whole batch.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#ifdef __FreeBSD__
+   #include <libutil.h>
+#else
+   #include "human_readable.h"
+#endif
+
+#include "netnuke.h"
+
+/* Milliseconds between samples */
+#define PROGRESS_INTERVAL 250
+/* Seconds the average rate reaches back, roughly */
+#define PROGRESS_WINDOW 5.0
+/* Samples between slow device checks */
+#define PROGRESS_SLOW_TICKS 40
+/* Devices of a model needed before any of them can be called slow */
+#define PROGRESS_SLOW_PEERS 3
+/* Writes a check window needs before its latency tail means anything */
+#define PROGRESS_SLOW_WRITES 64
+
+static nukejob_t *progress_jobs = NULL;
+static progress_t *progress_state = NULL;
+static int32_t progress_count = 0;
+static bool progress_display = false;
+static size_t progress_drawn = 0;
+static int progress_quit;
+static latency_t *progress_previous = NULL;   /* Histograms at the last check */
+static latency_t progress_window;
+static double *progress_values = NULL;
+static bool progress_running = false;
+static pthread_t progress_thread;
+static pthread_mutex_t progress_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t progress_wake = PTHREAD_COND_INITIALIZER;
+
+static double progress_seconds(const struct timespec *from, const struct timespec *to)
+{
+   return (double)(to->tv_sec - from->tv_sec) + (double)(to->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+static void progress_human(char *out, double bytes)
+{
+   humanize_number(out, 5, (int64_t)bytes, "", HN_AUTOSCALE, HN_B | HN_NOSPACE | HN_DECIMAL);
+}
+
+/* Take one sample of a device */
+static void progress_sample(nukejob_t *job, progress_t *state, double elapsed)
+{
+   int32_t pass = __atomic_load_n(&job->current, __ATOMIC_ACQUIRE);
+   uint64_t done = __atomic_load_n(&job->passdone, __ATOMIC_RELAXED);
+   uint64_t delta;
+   double alpha;
+
+   /* A finished device keeps its last numbers */
+   if(__atomic_load_n(&job->state, __ATOMIC_ACQUIRE) != JOB_RUNNING)
+   {
+      state->pass = pass;
+      state->done = done;
+      state->rate = 0;
+      return;
+   }
+
+   /* A new pass, or a pass rewound by an error, starts counting over */
+   if(pass != state->pass || done < state->done)
+   {
+      state->pass = pass;
+      state->done = 0;
+      state->decile = 0;
+   }
+
+   delta = done - state->done;
+   state->done = done;
+   state->rate = elapsed > 0 ? (double)delta / elapsed : 0;
+
+   alpha = elapsed / PROGRESS_WINDOW;
+   if(alpha > 1 || state->average == 0)
+      alpha = 1;
+   state->average += alpha * (state->rate - state->average);
+
+   if(job->verbose && job->size)
+   {
+      int32_t decile = (int32_t)(done * 10 / job->size);
+
+      if(decile > state->decile)
+      {
+         lwrite("%s pass %d progress: %3.0f percent\n", job->target, pass,
+               (double)done / (double)job->size * 100.0);
+         state->decile = decile;
+      }
+   }
+}
+
+static int progress_order(const void *a, const void *b)
+{
+   double x = *(const double*)a, y = *(const double*)b;
+
+   return (x > y) - (x < y);
+}
+
+static double progress_median(double values[], int32_t count)
+{
+   qsort(values, count, sizeof(double), progress_order);
+   return count % 2 ? values[count / 2] : (values[count / 2 - 1] + values[count / 2]) / 2;
+}
+
+static bool progress_settled(int32_t i)
+{
+   /* The first window covers the ramp up */
+   return __atomic_load_n(&progress_jobs[i].state, __ATOMIC_ACQUIRE) == JOB_RUNNING
+      && progress_state[i].windows >= 2 && progress_state[i].tail > 0;
+}
+
+/* Blank the status line so a message can be printed */
+static void progress_clear(void)
+{
+   if(progress_display && progress_drawn)
+   {
+      printf("\r%*s\r", (int)progress_drawn, "");
+      fflush(stdout);
+      progress_drawn = 0;
+   }
+}
+
+/* Compare every device with the others of the same model, over the last
+ * PROGRESS_SLOW_TICKS samples.  A device is flagged once its 99th
+ * percentile write latency is above, or its average rate below, slowpct
+ * percent of what the median device of the model does. */
+static void progress_slow(void)
+{
+   int32_t i, j, peers;
+
+   for(i = 0; i < progress_count; i++)
+   {
+      if(__atomic_load_n(&progress_jobs[i].state, __ATOMIC_ACQUIRE) != JOB_RUNNING)
+         continue;
+
+      latency_window(&progress_jobs[i].latency, &progress_previous[i], &progress_window);
+      progress_state[i].tail = progress_window.count >= PROGRESS_SLOW_WRITES
+         ? latency_percentile(&progress_window, 0.99) : 0;
+      progress_state[i].windows++;
+   }
+
+   for(i = 0; i < progress_count; i++)
+   {
+      nukejob_t *job = &progress_jobs[i];
+      progress_t *state = &progress_state[i];
+      double factor = job->slowpct / 100.0;
+      double tail, average;
+      char mine[16], theirs[16];
+
+      if(job->slowpct <= 0 || job->slow || !progress_settled(i))
+         continue;
+
+      for(j = 0, peers = 0; j < progress_count; j++)
+      {
+         if(progress_settled(j) && strcmp(progress_jobs[j].device.model, job->device.model) == 0)
+            progress_values[peers++] = (double)progress_state[j].tail;
+      }
+      if(peers < PROGRESS_SLOW_PEERS)
+         continue;
+      tail = progress_median(progress_values, peers);
+
+      for(j = 0, peers = 0; j < progress_count; j++)
+      {
+         if(progress_settled(j) && strcmp(progress_jobs[j].device.model, job->device.model) == 0)
+            progress_values[peers++] = progress_state[j].average;
+      }
+      average = progress_median(progress_values, peers);
+
+      if((double)state->tail > tail * factor)
+      {
+         latency_format(state->tail, mine, sizeof(mine));
+         latency_format((uint64_t)tail, theirs, sizeof(theirs));
+         job->slow = true;
+         progress_clear();
+         lwrite("%s: flagged slow, 99th percentile write latency %s against %s on %d peers\n",
+               job->target, mine, theirs, peers - 1);
+         fprintf(stderr, "%s: flagged slow, 99th percentile write latency %s against %s on %d peers\n",
+               job->target, mine, theirs, peers - 1);
+      }
+      else if(state->average * factor < average)
+      {
+         progress_human(mine, state->average);
+         progress_human(theirs, average);
+         job->slow = true;
+         progress_clear();
+         lwrite("%s: flagged slow, writing %s/s against %s/s on %d peers\n",
+               job->target, mine, theirs, peers - 1);
+         fprintf(stderr, "%s: flagged slow, writing %s/s against %s/s on %d peers\n",
+               job->target, mine, theirs, peers - 1);
+      }
+   }
+}
+
+static int progress_columns(void)
+{
+   struct winsize ws;
+
+   if(ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 1)
+      return ws.ws_col;
+   return 80;
+}
+
+/* Redraw the status line.  A lone device gets the detailed line, several
+ * share it with a total at the end. */
+static void progress_draw(void)
+{
+   char line[BUFSIZ];
+   char done[16], size[16], rate[16], average[16];
+   size_t used = 0, width = (size_t)progress_columns() - 1;
+   double total = 0;
+   int32_t i, running = 0;
+
+   line[0] = '\0';
+   for(i = 0; i < progress_count; i++)
+   {
+      nukejob_t *job = &progress_jobs[i];
+      progress_t *state = &progress_state[i];
+      double percent;
+
+      if(__atomic_load_n(&job->state, __ATOMIC_ACQUIRE) != JOB_RUNNING || state->pass == 0)
+         continue;
+
+      percent = job->size ? (double)state->done / (double)job->size * 100.0 : 100.0;
+      if(percent > 100.0)
+         percent = 100.0;
+      total += state->rate;
+      running++;
+
+      progress_human(done, (double)state->done);
+      progress_human(rate, state->rate);
+      if(progress_count == 1)
+      {
+         progress_human(size, (double)job->size);
+         progress_human(average, state->average);
+         used += snprintf(line + used, sizeof(line) - used, "%s: pass %d of %d    [ %s of %s / %3.1f%% / %s/s, avg %s/s ]",
+               job->device.nameshort, state->pass, job->passes, done, size, percent, rate, average);
+      }
+      else
+         used += snprintf(line + used, sizeof(line) - used, "%s%s p%d %3.0f%% %s/s",
+               running > 1 ? " | " : "", job->device.nameshort, state->pass, percent, rate);
+
+      if(used >= sizeof(line))
+         used = sizeof(line) - 1;
+   }
+
+   if(progress_count > 1 && running > 1)
+   {
+      progress_human(rate, total);
+      snprintf(line + used, sizeof(line) - used, " | total %s/s", rate);
+   }
+
+   /* Never wrap, and blank out whatever the last line left behind */
+   used = strlen(line);
+   if(used > width)
+      line[used = width] = '\0';
+   printf("\r%s%*s\r", line, progress_drawn > used ? (int)(progress_drawn - used) : 0, "");
+   fflush(stdout);
+   progress_drawn = used;
+}
+
+static void* progress_main(void *arg)
+{
+   struct timespec last, now;
+   sigset_t all;
+   int32_t i, ticks = 0;
+   (void)arg;
+
+   /* Signals belong to the workers */
+   sigfillset(&all);
+   pthread_sigmask(SIG_BLOCK, &all, NULL);
+
+   clock_gettime(CLOCK_MONOTONIC, &last);
+   pthread_mutex_lock(&progress_lock);
+   while(!progress_quit)
+   {
+      struct timespec until;
+
+      clock_gettime(CLOCK_REALTIME, &until);
+      until.tv_nsec += PROGRESS_INTERVAL * 1000000L;
+      if(until.tv_nsec >= 1000000000L)
+      {
+         until.tv_sec++;
+         until.tv_nsec -= 1000000000L;
+      }
+      pthread_cond_timedwait(&progress_wake, &progress_lock, &until);
+      if(progress_quit)
+         break;
+
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      for(i = 0; i < progress_count; i++)
+      {
+         if(__atomic_load_n(&progress_jobs[i].current, __ATOMIC_ACQUIRE) > 0)
+            progress_sample(&progress_jobs[i], &progress_state[i], progress_seconds(&last, &now));
+      }
+      last = now;
+      sched_tick(progress_state);
+
+      if(++ticks % PROGRESS_SLOW_TICKS == 0)
+         progress_slow();
+
+      if(progress_display)
+         progress_draw();
+      if(metrics_due())
+         metrics_write(progress_jobs, progress_state, progress_count);
+   }
+   pthread_mutex_unlock(&progress_lock);
+
+   return NULL;
+}
+
+static void progress_free(void)
+{
+   free(progress_state);
+   free(progress_previous);
+   free(progress_values);
+   progress_state = NULL;
+   progress_previous = NULL;
+   progress_values = NULL;
+}
+
+/* Start sampling the jobs.  With display set the status line is drawn,
+ * otherwise only the verbose progress marks are logged. */
+int progress_start(nukejob_t jobs[], int32_t count, bool display)
+{
+   int error;
+
+   progress_state = (progress_t*)calloc(count, sizeof(progress_t));
+   progress_previous = (latency_t*)calloc(count, sizeof(latency_t));
+   progress_values = (double*)calloc(count, sizeof(double));
+   if(progress_state == NULL || progress_previous == NULL || progress_values == NULL)
+   {
+      progress_free();
+      return ENOMEM;
+   }
+
+   progress_jobs = jobs;
+   progress_count = count;
+   progress_display = display;
+   progress_drawn = 0;
+   progress_quit = 0;
+
+   if((error = pthread_create(&progress_thread, NULL, progress_main, NULL)) != 0)
+   {
+      progress_free();
+      return error;
+   }
+
+   progress_running = true;
+   return 0;
+}
+
+void progress_stop(void)
+{
+   int32_t i;
+
+   if(!progress_running)
+      return;
+
+   pthread_mutex_lock(&progress_lock);
+   progress_quit = 1;
+   pthread_cond_signal(&progress_wake);
+   pthread_mutex_unlock(&progress_lock);
+   pthread_join(progress_thread, NULL);
+   progress_running = false;
+
+   /* The final state of every device */
+   for(i = 0; i < progress_count; i++)
+      progress_sample(&progress_jobs[i], &progress_state[i], 0);
+   metrics_write(progress_jobs, progress_state, progress_count);
+
+   /* Leave the terminal clean for the summary */
+   progress_clear();
+   progress_free();
+}
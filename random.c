@@ -0,0 +1,298 @@
+/**
+ *  NetNuke - Erases all storage media deteced by the system
+ *  Copyright (C) 2009  Joseph Hunkeler <jhunkeler@gmail.com, jhunk@stsci.edu>
+ *
+ *  This file is part of NetNuke.
+ *
+ *  NetNuke is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  NetNuke is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with NetNuke.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * Random stream generator
+ *
+ * The stream is cut into RNG_CHUNK byte chunks.  Every chunk is produced by
+ * four interleaved xoshiro256** generators whose states are derived from
+ * the seed and the chunk number with splitmix64, so any byte of the stream
+ * can be regenerated from its offset alone.  That is what lets a verify or
+ * a resumed wipe pick the stream up in the middle of a device.
+ *
+ * The four lanes map directly onto one AVX2 register, or two NEON
+ * registers, and all implementations produce identical output.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#ifdef __linux__
+   #include <sys/random.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+   #include <immintrin.h>
+   #define RNG_HAVE_AVX2
+#endif
+#if defined(__ARM_NEON) || defined(__aarch64__)
+   #include <arm_neon.h>
+   #define RNG_HAVE_NEON
+#endif
+
+#include "netnuke.h"
+
+#define RNG_LANES 4
+#define RNG_WORDS (RNG_CHUNK / sizeof(uint64_t))
+
+static void (*rng_chunk)(uint64_t seed, uint64_t chunk, void *out) = NULL;
+static const char *rng_name = "scalar";
+static pthread_once_t rng_once = PTHREAD_ONCE_INIT;
+
+static inline uint64_t splitmix64(uint64_t *x)
+{
+   uint64_t z = (*x += 0x9E3779B97F4A7C15ULL);
+   z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+   z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+   return z ^ (z >> 31);
+}
+
+static inline uint64_t rotl(uint64_t x, int k)
+{
+   return (x << k) | (x >> (64 - k));
+}
+
+/* Derive the four lane states of one chunk */
+static void rng_lanes(uint64_t seed, uint64_t chunk, uint64_t s[4][RNG_LANES])
+{
+   int lane;
+
+   for(lane = 0; lane < RNG_LANES; lane++)
+   {
+      uint64_t x = seed ^ ((chunk * RNG_LANES + lane) * 0xD1B54A32D192ED03ULL);
+
+      s[0][lane] = splitmix64(&x);
+      s[1][lane] = splitmix64(&x);
+      s[2][lane] = splitmix64(&x);
+      s[3][lane] = splitmix64(&x);
+   }
+}
+
+static void rng_chunk_scalar(uint64_t seed, uint64_t chunk, void *out)
+{
+   uint64_t s[4][RNG_LANES];
+   uint64_t *dest = (uint64_t*)out;
+   size_t i;
+   int lane;
+
+   rng_lanes(seed, chunk, s);
+
+   for(i = 0; i < RNG_WORDS; i += RNG_LANES)
+   {
+      for(lane = 0; lane < RNG_LANES; lane++)
+      {
+         uint64_t result = rotl(s[1][lane] * 5, 7) * 9;
+         uint64_t t = s[1][lane] << 17;
+
+         s[2][lane] ^= s[0][lane];
+         s[3][lane] ^= s[1][lane];
+         s[1][lane] ^= s[2][lane];
+         s[0][lane] ^= s[3][lane];
+         s[2][lane] ^= t;
+         s[3][lane] = rotl(s[3][lane], 45);
+
+         memcpy(&dest[i + lane], &result, sizeof(result));
+      }
+   }
+}
+
+#ifdef RNG_HAVE_AVX2
+__attribute__((target("avx2")))
+static void rng_chunk_avx2(uint64_t seed, uint64_t chunk, void *out)
+{
+   uint64_t s[4][RNG_LANES];
+   __m256i s0, s1, s2, s3, result, t;
+   char *dest = (char*)out;
+   size_t i;
+
+   rng_lanes(seed, chunk, s);
+   s0 = _mm256_loadu_si256((const __m256i*)s[0]);
+   s1 = _mm256_loadu_si256((const __m256i*)s[1]);
+   s2 = _mm256_loadu_si256((const __m256i*)s[2]);
+   s3 = _mm256_loadu_si256((const __m256i*)s[3]);
+
+   for(i = 0; i < RNG_WORDS; i += RNG_LANES)
+   {
+      /* rotl(s1 * 5, 7) * 9, the multiplies are shifts and adds */
+      result = _mm256_add_epi64(_mm256_slli_epi64(s1, 2), s1);
+      result = _mm256_or_si256(_mm256_slli_epi64(result, 7), _mm256_srli_epi64(result, 57));
+      result = _mm256_add_epi64(_mm256_slli_epi64(result, 3), result);
+      t = _mm256_slli_epi64(s1, 17);
+
+      s2 = _mm256_xor_si256(s2, s0);
+      s3 = _mm256_xor_si256(s3, s1);
+      s1 = _mm256_xor_si256(s1, s2);
+      s0 = _mm256_xor_si256(s0, s3);
+      s2 = _mm256_xor_si256(s2, t);
+      s3 = _mm256_or_si256(_mm256_slli_epi64(s3, 45), _mm256_srli_epi64(s3, 19));
+
+      _mm256_storeu_si256((__m256i*)(dest + i * sizeof(uint64_t)), result);
+   }
+}
+#endif
+
+#ifdef RNG_HAVE_NEON
+static void rng_chunk_neon(uint64_t seed, uint64_t chunk, void *out)
+{
+   uint64_t s[4][RNG_LANES];
+   uint64x2_t s0[2], s1[2], s2[2], s3[2], result, t;
+   uint64_t *dest = (uint64_t*)out;
+   size_t i;
+   int half;
+
+   rng_lanes(seed, chunk, s);
+   for(half = 0; half < 2; half++)
+   {
+      s0[half] = vld1q_u64(&s[0][half * 2]);
+      s1[half] = vld1q_u64(&s[1][half * 2]);
+      s2[half] = vld1q_u64(&s[2][half * 2]);
+      s3[half] = vld1q_u64(&s[3][half * 2]);
+   }
+
+   for(i = 0; i < RNG_WORDS; i += RNG_LANES)
+   {
+      for(half = 0; half < 2; half++)
+      {
+         result = vaddq_u64(vshlq_n_u64(s1[half], 2), s1[half]);
+         result = vorrq_u64(vshlq_n_u64(result, 7), vshrq_n_u64(result, 57));
+         result = vaddq_u64(vshlq_n_u64(result, 3), result);
+         t = vshlq_n_u64(s1[half], 17);
+
+         s2[half] = veorq_u64(s2[half], s0[half]);
+         s3[half] = veorq_u64(s3[half], s1[half]);
+         s1[half] = veorq_u64(s1[half], s2[half]);
+         s0[half] = veorq_u64(s0[half], s3[half]);
+         s2[half] = veorq_u64(s2[half], t);
+         s3[half] = vorrq_u64(vshlq_n_u64(s3[half], 45), vshrq_n_u64(s3[half], 19));
+
+         vst1q_u64(&dest[i + half * 2], result);
+      }
+   }
+}
+#endif
+
+/* Pick the fastest implementation this CPU can run */
+static void rng_select(void)
+{
+   rng_chunk = rng_chunk_scalar;
+   rng_name = "scalar";
+
+#ifdef RNG_HAVE_AVX2
+   __builtin_cpu_init();
+   if(__builtin_cpu_supports("avx2"))
+   {
+      rng_chunk = rng_chunk_avx2;
+      rng_name = "avx2";
+   }
+#endif
+#ifdef RNG_HAVE_NEON
+   rng_chunk = rng_chunk_neon;
+   rng_name = "neon";
+#endif
+
+   /* Allow the benchmarks and the paranoid to force the portable path */
+   if(getenv("NETNUKE_RNG_SCALAR") != NULL)
+   {
+      rng_chunk = rng_chunk_scalar;
+      rng_name = "scalar";
+   }
+}
+
+const char* rng_impl(void)
+{
+   pthread_once(&rng_once, rng_select);
+   return rng_name;
+}
+
+/* Read a seed from the kernel.  Only falls back to the clock when there is
+ * no entropy source at all. */
+uint64_t rng_entropy(void)
+{
+   uint64_t seed = 0;
+   ssize_t got = -1;
+   int fd;
+
+#ifdef __linux__
+   got = getrandom(&seed, sizeof(seed), 0);
+#endif
+   if(got != (ssize_t)sizeof(seed))
+   {
+      if((fd = open("/dev/urandom", O_RDONLY)) > -1)
+      {
+         got = read(fd, &seed, sizeof(seed));
+         close(fd);
+      }
+   }
+   if(got != (ssize_t)sizeof(seed))
+   {
+      struct timespec ts;
+      clock_gettime(CLOCK_REALTIME, &ts);
+      seed = ((uint64_t)ts.tv_sec << 32) ^ (uint64_t)ts.tv_nsec ^ ((uint64_t)getpid() << 16);
+   }
+
+   return seed;
+}
+
+void rng_init(rng_t *rng, uint64_t seed, int32_t pass)
+{
+   uint64_t x = seed ^ ((uint64_t)pass << 32);
+
+   pthread_once(&rng_once, rng_select);
+
+   /* Every pass gets its own stream derived from the device seed */
+   rng->seed = seed;
+   rng->key = splitmix64(&x);
+}
+
+void rng_fill(const rng_t *rng, void *buffer, uint64_t length, uint64_t offset)
+{
+   char *dest = (char*)buffer;
+   char tmp[RNG_CHUNK] __attribute__((aligned(32)));
+
+   while(length > 0)
+   {
+      uint64_t chunk = offset / RNG_CHUNK;
+      uint64_t skip = offset % RNG_CHUNK;
+      uint64_t count = RNG_CHUNK - skip;
+
+      if(count > length)
+         count = length;
+
+      if(count == RNG_CHUNK)
+         rng_chunk(rng->key, chunk, dest);
+      else
+      {
+         /* Partial chunk at either end of the buffer */
+         rng_chunk(rng->key, chunk, tmp);
+         memcpy(dest, tmp + skip, count);
+      }
+
+      dest += count;
+      offset += count;
+      length -= count;
+   }
+}
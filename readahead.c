@@ -0,0 +1,250 @@
+/**
+ *  NetNuke - Erases all storage media deteced by the system
+ *  Copyright (C) 2009  Joseph Hunkeler <jhunkeler@gmail.com, jhunk@stsci.edu>
+ *
+ *  This file is part of NetNuke.
+ *
+ *  NetNuke is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  NetNuke is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with NetNuke.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * Sequential read-ahead
+ *
+ * A reader thread walks the device in fixed size chunks and fills a ring
+ * of caller supplied buffers, staying as many chunks ahead of the consumer
+ * as there are buffers.  The consumer takes chunks in device order with
+ * readahead_next() and hands each buffer back with readahead_release()
+ * once it is done with it.  Used by verification and the rewrite level.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "netnuke.h"
+
+struct READAHEAD_T
+{
+   nukejob_t *job;
+   int fd;
+   int fdbuffered;             /* Opened when direct reads are refused */
+   uint64_t chunksize;
+   uint64_t nchunks;
+   bool (*want)(void *arg, uint64_t chunk);
+   void *arg;
+
+   pthread_t thread;
+   pthread_mutex_t lock;
+   pthread_cond_t cond;
+   rachunk_t *ring;
+   int32_t count;
+   uint64_t produced;          /* Chunks read */
+   uint64_t taken;             /* Chunks handed to the consumer */
+   uint64_t consumed;          /* Chunks released by the consumer */
+   bool finished;              /* Reader has nothing left to read */
+   bool stop;
+};
+
+/* Read a whole chunk, retrying through the page cache when the target
+ * refuses a direct read (the unaligned tail of a file for example) */
+static int readahead_read(readahead_t *ra, rachunk_t *chunk)
+{
+   uint64_t done = 0;
+   int fd = ra->fd;
+
+   while(done < chunk->length)
+   {
+      ssize_t result = pread(fd, chunk->buf + done, chunk->length - done, chunk->offset + done);
+
+      if(result < 0 && errno == EINVAL && fd == ra->fd && (ra->job->oflags & O_DIRECT))
+      {
+         if(ra->fdbuffered < 0)
+            ra->fdbuffered = open(ra->job->target, O_RDONLY);
+         if(ra->fdbuffered < 0)
+            return errno;
+         fd = ra->fdbuffered;
+         continue;
+      }
+      /* Past the end of a file everything reads as zeros */
+      if(result == 0)
+      {
+         memset(chunk->buf + done, 0, chunk->length - done);
+         break;
+      }
+      if(result < 0)
+         return errno;
+
+      done += result;
+   }
+
+   return 0;
+}
+
+static void* readahead_thread(void *arg)
+{
+   readahead_t *ra = (readahead_t*)arg;
+   uint64_t chunk;
+
+   for(chunk = 0; chunk < ra->nchunks; chunk++)
+   {
+      rachunk_t *slot;
+
+      if(ra->want != NULL && !ra->want(ra->arg, chunk))
+         continue;
+
+      /* Wait for a free buffer */
+      pthread_mutex_lock(&ra->lock);
+      while(ra->produced - ra->consumed >= (uint64_t)ra->count && !ra->stop)
+         pthread_cond_wait(&ra->cond, &ra->lock);
+      if(ra->stop)
+      {
+         pthread_mutex_unlock(&ra->lock);
+         break;
+      }
+      slot = &ra->ring[ra->produced % ra->count];
+      pthread_mutex_unlock(&ra->lock);
+
+      slot->offset = chunk * ra->chunksize;
+      slot->length = ra->job->size - slot->offset < ra->chunksize ? ra->job->size - slot->offset : ra->chunksize;
+      slot->error = readahead_read(ra, slot);
+
+      pthread_mutex_lock(&ra->lock);
+      ra->produced++;
+      pthread_cond_broadcast(&ra->cond);
+      pthread_mutex_unlock(&ra->lock);
+   }
+
+   pthread_mutex_lock(&ra->lock);
+   ra->finished = true;
+   pthread_cond_broadcast(&ra->cond);
+   pthread_mutex_unlock(&ra->lock);
+
+   return NULL;
+}
+
+/* Start reading job->target into count buffers of chunksize bytes laid
+ * out back to back in pool.  want() may skip chunks, NULL reads them all.
+ * Returns NULL and sets errno on failure. */
+readahead_t* readahead_open(nukejob_t *job, char *pool, int32_t count, uint64_t chunksize,
+      bool (*want)(void *arg, uint64_t chunk), void *arg)
+{
+   readahead_t *ra;
+   int32_t i;
+   int error;
+
+   if((ra = (readahead_t*)calloc(1, sizeof(readahead_t))) == NULL)
+      return NULL;
+   if((ra->ring = (rachunk_t*)calloc(count, sizeof(rachunk_t))) == NULL)
+   {
+      free(ra);
+      return NULL;
+   }
+
+   ra->job = job;
+   ra->fdbuffered = -1;
+   ra->chunksize = chunksize;
+   ra->nchunks = (job->size + chunksize - 1) / chunksize;
+   ra->want = want;
+   ra->arg = arg;
+   ra->count = count;
+   for(i = 0; i < count; i++)
+      ra->ring[i].buf = pool + (size_t)i * chunksize;
+
+   /* Read the media, not the page cache */
+   ra->fd = open(job->target, O_RDONLY | (job->oflags & O_DIRECT));
+   if(ra->fd < 0 && errno == EINVAL && (job->oflags & O_DIRECT))
+      ra->fd = open(job->target, O_RDONLY);
+   if(ra->fd < 0)
+   {
+      error = errno;
+      free(ra->ring);
+      free(ra);
+      errno = error;
+      return NULL;
+   }
+#ifdef POSIX_FADV_DONTNEED
+   posix_fadvise(ra->fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+
+   pthread_mutex_init(&ra->lock, NULL);
+   pthread_cond_init(&ra->cond, NULL);
+
+   if((error = pthread_create(&ra->thread, NULL, readahead_thread, ra)) != 0)
+   {
+      pthread_cond_destroy(&ra->cond);
+      pthread_mutex_destroy(&ra->lock);
+      close(ra->fd);
+      free(ra->ring);
+      free(ra);
+      errno = error;
+      return NULL;
+   }
+
+   return ra;
+}
+
+/* The next chunk in device order, NULL once everything was read.  Blocks
+ * until the reader has it. */
+rachunk_t* readahead_next(readahead_t *ra)
+{
+   rachunk_t *chunk = NULL;
+
+   pthread_mutex_lock(&ra->lock);
+   while(ra->taken == ra->produced && !ra->finished)
+      pthread_cond_wait(&ra->cond, &ra->lock);
+   if(ra->taken < ra->produced)
+      chunk = &ra->ring[ra->taken++ % ra->count];
+   pthread_mutex_unlock(&ra->lock);
+
+   return chunk;
+}
+
+/* Hand the oldest chunk's buffer back to the reader */
+void readahead_release(readahead_t *ra)
+{
+   pthread_mutex_lock(&ra->lock);
+   if(ra->consumed < ra->taken)
+      ra->consumed++;
+   pthread_cond_broadcast(&ra->cond);
+   pthread_mutex_unlock(&ra->lock);
+}
+
+void readahead_close(readahead_t *ra)
+{
+   if(ra == NULL)
+      return;
+
+   pthread_mutex_lock(&ra->lock);
+   ra->stop = true;
+   pthread_cond_broadcast(&ra->cond);
+   pthread_mutex_unlock(&ra->lock);
+
+   pthread_join(ra->thread, NULL);
+
+   pthread_cond_destroy(&ra->cond);
+   pthread_mutex_destroy(&ra->lock);
+   if(ra->fdbuffered >= 0)
+      close(ra->fdbuffered);
+   close(ra->fd);
+   free(ra->ring);
+   free(ra);
+}
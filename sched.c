@@ -0,0 +1,345 @@
+/**
+ *  NetNuke - Erases all storage media deteced by the system
+ *  Copyright (C) 2009  Joseph Hunkeler <jhunkeler@gmail.com, jhunk@stsci.edu>
+ *
+ *  This file is part of NetNuke.
+ *
+ *  NetNuke is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  NetNuke is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with NetNuke.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * Controller aware scheduling
+ *
+ * Disks behind one HBA or expander share its link, and past a point every
+ * extra wipe on it only slows the others down.  Devices are grouped by the
+ * controller sysfs found them on, and each group admits a limited number
+ * of wipes at a time, by default all of its devices.  The limit can be
+ * fixed with --bus-jobs, or with --bus-jobs auto it is found by climbing: the progress thread reports the combined rate of each
+ * group, and as long as one more wipe added at least SCHED_GAIN of what
+ * each of the others was doing another one is admitted.  The gain is
+ * measured against a single device, not the whole group, so a controller
+ * with headroom keeps climbing however many wipes it already runs.  When
+ * it did not pay off, the group goes back to the best count.
+ *
+ * Writes can also be paced, per device and for all devices together, so a
+ * wipe can share the machine with other work.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#ifdef __FreeBSD__
+   #include <libutil.h>
+#else
+   #include "human_readable.h"
+#endif
+
+#include "netnuke.h"
+
+/* Wipes an adaptive group starts with */
+#define SCHED_START 2
+/* Samples after a change before the group rate is trusted */
+#define SCHED_SETTLE 8
+/* Samples the group rate is averaged over before a decision */
+#define SCHED_WINDOW 40
+/* Part of the average device's rate one more wipe has to add */
+#define SCHED_GAIN 0.25
+
+typedef struct SCHEDGROUP_T
+{
+   const char *host;
+   int32_t members;
+   int32_t pending;            /* Members not claimed yet */
+   int32_t running;
+   int32_t limit;              /* Wipes admitted at once */
+   bool settled;               /* Done climbing */
+   int32_t ticks;              /* Samples since the last change */
+   double sum;                 /* Of the group rate since settling */
+   int32_t samples;
+   double previous;            /* Rate with one wipe less */
+} schedgroup_t;
+
+static nukejob_t *sched_jobs = NULL;
+static int32_t sched_count = 0;
+static schedgroup_t *sched_groups = NULL;
+static int32_t sched_ngroups = 0;
+static int32_t *sched_group = NULL;      /* Group of every job */
+static bool *sched_claimed = NULL;
+static int32_t sched_busjobs = 0;        /* 0 is no limit, SCHED_AUTO finds it per group */
+static uint64_t sched_totalrate = 0;     /* Bytes per second, 0 is unlimited */
+static uint64_t sched_totalnext = 0;
+static pthread_mutex_t sched_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sched_wake = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t sched_pacelock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Set before sched_open().  busjobs fixes the wipes per controller, 0
+ * leaves them unlimited and SCHED_AUTO lets each controller find its own.  totalrate caps all devices together
+ * in bytes per second, 0 leaves them unlimited. */
+void sched_limits(int32_t busjobs, uint64_t totalrate)
+{
+   sched_busjobs = busjobs;
+   sched_totalrate = totalrate;
+}
+
+/* Devices without a known controller are a group of their own */
+static const char* sched_host(nukejob_t *job)
+{
+   return job->device.host[0] ? job->device.host : job->target;
+}
+
+static void sched_free(void)
+{
+   free(sched_groups);
+   free(sched_group);
+   free(sched_claimed);
+   sched_groups = NULL;
+   sched_group = NULL;
+   sched_claimed = NULL;
+   sched_jobs = NULL;
+   sched_count = sched_ngroups = 0;
+}
+
+/* Group the jobs by controller.  Returns 0, or ENOMEM. */
+int sched_open(nukejob_t jobs[], int32_t count)
+{
+   int32_t i, g;
+
+   sched_groups = (schedgroup_t*)calloc(count ? count : 1, sizeof(schedgroup_t));
+   sched_group = (int32_t*)calloc(count ? count : 1, sizeof(int32_t));
+   sched_claimed = (bool*)calloc(count ? count : 1, sizeof(bool));
+   if(sched_groups == NULL || sched_group == NULL || sched_claimed == NULL)
+   {
+      sched_free();
+      return ENOMEM;
+   }
+
+   sched_jobs = jobs;
+   sched_count = count;
+   sched_ngroups = 0;
+   sched_totalnext = 0;
+
+   for(i = 0; i < count; i++)
+   {
+      for(g = 0; g < sched_ngroups; g++)
+      {
+         if(strcmp(sched_groups[g].host, sched_host(&jobs[i])) == 0)
+            break;
+      }
+      if(g == sched_ngroups)
+         sched_groups[sched_ngroups++].host = sched_host(&jobs[i]);
+
+      sched_group[i] = g;
+      sched_groups[g].members++;
+      sched_groups[g].pending++;
+   }
+
+   for(g = 0; g < sched_ngroups; g++)
+   {
+      schedgroup_t *group = &sched_groups[g];
+
+      group->settled = sched_busjobs != SCHED_AUTO || group->members <= SCHED_START;
+      if(sched_busjobs > 0)
+         group->limit = sched_busjobs;
+      else if(group->settled)
+         group->limit = group->members;
+      else
+         group->limit = SCHED_START;
+      if(group->members > 1)
+         lwrite("Controller %s: %d devices, %s%d at a time\n", group->host, group->members,
+               group->settled ? "" : "starting with ", group->limit);
+   }
+
+   return 0;
+}
+
+void sched_close(void)
+{
+   sched_free();
+}
+
+/* The next device to wipe, waiting for its controller to have room.
+ * NULL once every device was handed out. */
+nukejob_t* sched_claim(void)
+{
+   nukejob_t *job = NULL;
+
+   pthread_mutex_lock(&sched_lock);
+   while(job == NULL)
+   {
+      bool left = false;
+      int32_t i;
+
+      for(i = 0; i < sched_count; i++)
+      {
+         schedgroup_t *group = &sched_groups[sched_group[i]];
+
+         if(sched_claimed[i])
+            continue;
+         left = true;
+         if(group->running >= group->limit)
+            continue;
+
+         sched_claimed[i] = true;
+         group->pending--;
+         group->running++;
+         group->ticks = group->samples = 0;
+         group->sum = 0;
+         job = &sched_jobs[i];
+         break;
+      }
+
+      if(!left)
+         break;
+      if(job == NULL)
+         pthread_cond_wait(&sched_wake, &sched_lock);
+   }
+   pthread_mutex_unlock(&sched_lock);
+
+   return job;
+}
+
+/* A wipe is over, make room for the next one on its controller */
+void sched_release(nukejob_t *job)
+{
+   schedgroup_t *group = &sched_groups[sched_group[job - sched_jobs]];
+
+   pthread_mutex_lock(&sched_lock);
+   group->running--;
+   group->ticks = group->samples = 0;
+   group->sum = 0;
+   pthread_cond_broadcast(&sched_wake);
+   pthread_mutex_unlock(&sched_lock);
+}
+
+/* Without the progress thread no group can climb, so none is held back */
+void sched_unlimit(void)
+{
+   int32_t g;
+
+   if(sched_groups == NULL)
+      return;
+
+   pthread_mutex_lock(&sched_lock);
+   for(g = 0; g < sched_ngroups; g++)
+   {
+      schedgroup_t *group = &sched_groups[g];
+
+      if(group->settled)
+         continue;
+      group->limit = group->members;
+      group->settled = true;
+      lwrite("Controller %s: no rates to go by, wiping all %d devices at once\n", group->host, group->members);
+   }
+   pthread_cond_broadcast(&sched_wake);
+   pthread_mutex_unlock(&sched_lock);
+}
+
+/* Called by the progress thread with fresh samples of every device */
+void sched_tick(progress_t state[])
+{
+   int32_t i, g;
+
+   if(sched_groups == NULL)
+      return;
+
+   pthread_mutex_lock(&sched_lock);
+   for(g = 0; g < sched_ngroups; g++)
+   {
+      schedgroup_t *group = &sched_groups[g];
+      double rate = 0;
+      char human[16];
+
+      if(group->settled || group->pending == 0 || group->running < group->limit)
+         continue;
+      if(++group->ticks <= SCHED_SETTLE)
+         continue;
+
+      for(i = 0; i < sched_count; i++)
+      {
+         if(sched_group[i] == g && __atomic_load_n(&sched_jobs[i].state, __ATOMIC_ACQUIRE) == JOB_RUNNING)
+            rate += state[i].rate;
+      }
+      group->sum += rate;
+      if(++group->samples < SCHED_WINDOW)
+         continue;
+
+      rate = group->sum / group->samples;
+      humanize_number(human, 5, (int64_t)rate, "", HN_AUTOSCALE, HN_B | HN_NOSPACE | HN_DECIMAL);
+
+      /* previous was measured with one wipe less */
+      if(group->previous == 0 || group->running < 2
+            || rate - group->previous > SCHED_GAIN * group->previous / (group->running - 1))
+      {
+         group->previous = rate;
+         group->limit++;
+         lwrite("Controller %s: %s/s with %d wipes, trying %d\n", group->host, human, group->running, group->limit);
+         pthread_cond_broadcast(&sched_wake);
+      }
+      else
+      {
+         /* The last one did not pay off, running ones finish undisturbed */
+         group->limit--;
+         group->settled = true;
+         lwrite("Controller %s: %s/s with %d wipes is no better, keeping %d\n", group->host, human, group->running, group->limit);
+      }
+      group->ticks = group->samples = 0;
+      group->sum = 0;
+   }
+   pthread_mutex_unlock(&sched_lock);
+}
+
+/* Take bytes at rate from a pacing clock.  Returns when they may go. */
+static uint64_t sched_reserve(uint64_t *next, uint64_t now, uint64_t bytes, uint64_t rate)
+{
+   uint64_t start = *next > now ? *next : now;
+
+   *next = start + (uint64_t)((double)bytes * 1e9 / (double)rate);
+   return start;
+}
+
+/* Hold a write of bytes back until the device and the global caps allow it */
+void sched_pace(nukejob_t *job, uint64_t bytes)
+{
+   uint64_t now, until = 0, start;
+
+   if(job->ratelimit == 0 && sched_totalrate == 0)
+      return;
+
+   now = latency_now();
+   if(job->ratelimit > 0)
+      until = sched_reserve(&job->pacenext, now, bytes, job->ratelimit);
+   if(sched_totalrate > 0)
+   {
+      pthread_mutex_lock(&sched_pacelock);
+      start = sched_reserve(&sched_totalnext, now, bytes, sched_totalrate);
+      pthread_mutex_unlock(&sched_pacelock);
+      if(start > until)
+         until = start;
+   }
+
+   if(until > now)
+   {
+      struct timespec wait;
+
+      wait.tv_sec = (until - now) / 1000000000ULL;
+      wait.tv_nsec = (until - now) % 1000000000ULL;
+      nanosleep(&wait, NULL);
+   }
+}
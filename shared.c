@@ -0,0 +1,144 @@
+/**
+ *  NetNuke - Erases all storage media deteced by the system
+ *  Copyright (C) 2009  Joseph Hunkeler <jhunkeler@gmail.com, jhunk@stsci.edu>
+ *
+ *  This file is part of NetNuke.
+ *
+ *  NetNuke is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  NetNuke is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with NetNuke.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * Shared write buffers
+ *
+ * The zero, pattern and fast random levels write the same pre-tiled
+ * blocks over and over, and with many devices on the same level every
+ * worker used to build and hold its own copy.  Buffers are kept here by
+ * what they hold instead: the first job to ask builds one, everybody
+ * else with the same data gets the same memory, and the last one to let
+ * go frees it.  N wipes then read one buffer out of the cache instead of
+ * streaming N copies through memory.
+ *
+ * Buffers come from numa_alloc(), in huge pages when there are any, so
+ * the kernel pins and maps a few large pages instead of thousands of
+ * small ones.  They stay writable because io_uring will not register
+ * read-only memory, but nothing writes them once they are built.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "netnuke.h"
+
+typedef struct SHARED_T
+{
+   char *key;                  /* What the buffer holds */
+   uint64_t keylen;
+   char *buf;
+   uint64_t length;
+   bool ready;                 /* Built, safe to write from */
+   int32_t refs;
+   struct SHARED_T *next;
+} shared_t;
+
+static shared_t *shared_list = NULL;
+static pthread_mutex_t shared_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t shared_built = PTHREAD_COND_INITIALIZER;
+
+/* The buffer of length bytes that holds what key describes.  The first
+ * caller builds it with fill(buf, arg), the others wait for that and get
+ * the same memory.  Returns NULL when it can not be mapped. */
+char* shared_get(const void *key, uint64_t keylen, uint64_t length,
+      void (*fill)(char *buf, void *arg), void *arg)
+{
+   shared_t *entry;
+
+   pthread_mutex_lock(&shared_lock);
+   for(entry = shared_list; entry != NULL; entry = entry->next)
+   {
+      if(entry->keylen == keylen && memcmp(entry->key, key, keylen) == 0)
+         break;
+   }
+
+   if(entry != NULL)
+   {
+      entry->refs++;
+      while(!entry->ready)
+         pthread_cond_wait(&shared_built, &shared_lock);
+      pthread_mutex_unlock(&shared_lock);
+      return entry->buf;
+   }
+
+   if((entry = (shared_t*)calloc(1, sizeof(shared_t))) == NULL
+         || (entry->key = (char*)malloc(keylen)) == NULL
+         || (entry->buf = (char*)numa_alloc(length)) == NULL)
+   {
+      if(entry != NULL)
+         free(entry->key);
+      free(entry);
+      pthread_mutex_unlock(&shared_lock);
+      return NULL;
+   }
+   memcpy(entry->key, key, keylen);
+   entry->keylen = keylen;
+   entry->length = length;
+   entry->refs = 1;
+   entry->next = shared_list;
+   shared_list = entry;
+   pthread_mutex_unlock(&shared_lock);
+
+   /* Built outside the lock, other buffers are not held up by it */
+   fill(entry->buf, arg);
+
+   pthread_mutex_lock(&shared_lock);
+   entry->ready = true;
+   pthread_cond_broadcast(&shared_built);
+   pthread_mutex_unlock(&shared_lock);
+
+   lwrite("Built a %ju byte shared write buffer\n", (uintmax_t)length);
+   return entry->buf;
+}
+
+/* Let go of a buffer from shared_get(), the last user unmaps it */
+void shared_put(char *buf)
+{
+   shared_t **link, *entry;
+
+   if(buf == NULL)
+      return;
+
+   pthread_mutex_lock(&shared_lock);
+   for(link = &shared_list; (entry = *link) != NULL; link = &entry->next)
+   {
+      if(entry->buf != buf)
+         continue;
+
+      if(--entry->refs == 0)
+      {
+         *link = entry->next;
+         numa_free(entry->buf, entry->length);
+         free(entry->key);
+         free(entry);
+      }
+      break;
+   }
+   pthread_mutex_unlock(&shared_lock);
+}
@@ -0,0 +1,240 @@
+/**
+ *  NetNuke - Erases all storage media deteced by the system
+ *  Copyright (C) 2009  Joseph Hunkeler <jhunkeler@gmail.com, jhunk@stsci.edu>
+ *
+ *  This file is part of NetNuke.
+ *
+ *  NetNuke is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  NetNuke is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with NetNuke.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * Device discovery through sysfs
+ *
+ * Every disk the kernel knows about has a directory under <root>/block, so
+ * one readdir finds sd*, nvme*, vd*, mmcblk* and anything else without
+ * guessing names or opening devices.  Everything a wipe wants to know is
+ * a small text attribute in that directory.  The root is configurable so
+ * discovery can be pointed at a fake tree.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <string.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include <limits.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "netnuke.h"
+
+/* Read one attribute of a block device, trailing whitespace removed.
+ * Returns 0 when the attribute exists. */
+static int sysfs_read(const char *root, const char *name, const char *attr, char *out, size_t size)
+{
+   char path[PATH_MAX];
+   FILE *fp;
+   size_t length;
+
+   out[0] = '\0';
+   snprintf(path, sizeof(path), "%s/block/%s/%s", root, name, attr);
+   if((fp = fopen(path, "r")) == NULL)
+      return 1;
+
+   if(fgets(out, size, fp) == NULL)
+      out[0] = '\0';
+   fclose(fp);
+
+   length = strlen(out);
+   while(length > 0 && isspace((unsigned char)out[length - 1]))
+      out[--length] = '\0';
+
+   return 0;
+}
+
+static uint64_t sysfs_u64(const char *root, const char *name, const char *attr, uint64_t fallback)
+{
+   char value[64];
+
+   if(sysfs_read(root, name, attr, value, sizeof(value)) != 0 || value[0] == '\0')
+      return fallback;
+   return strtoull(value, NULL, 10);
+}
+
+/* A PCI function address such as 0000:00:1f.2 */
+static bool sysfs_pci(const char *component)
+{
+   unsigned int domain, bus, slot, function;
+   char end;
+
+   return sscanf(component, "%x:%x:%x.%x%c", &domain, &bus, &slot, &function, &end) == 4;
+}
+
+/* Find the controller a disk hangs off, and the NUMA node it belongs to,
+ * by walking the device path.  Disks behind the same PCI function share
+ * a host. */
+static void sysfs_host(const char *root, const char *name, media_t *media)
+{
+   char path[PATH_MAX + 16];
+   char device[PATH_MAX];
+   char *slash;
+   size_t rootlen;
+
+   media->numanode = -1;
+   snprintf(media->host, sizeof(media->host), "%s", name);
+
+   /* Links are resolved, so the root has to be as well */
+   if(realpath(root, path) == NULL)
+      return;
+   rootlen = strlen(path);
+
+   snprintf(path, sizeof(path), "%s/block/%s/device", root, name);
+   if(realpath(path, device) == NULL)
+      return;
+
+   /* Deepest PCI function on the path */
+   while((slash = strrchr(device, '/')) != NULL && (size_t)(slash - device) > rootlen)
+   {
+      FILE *fp;
+
+      if(sysfs_pci(slash + 1))
+      {
+         snprintf(path, sizeof(path), "%s/numa_node", device);
+         if((fp = fopen(path, "r")) != NULL)
+         {
+            if(fscanf(fp, "%d", &media->numanode) != 1)
+               media->numanode = -1;
+            fclose(fp);
+         }
+
+         /* The CPUs a worker for this disk is best kept on */
+         snprintf(path, sizeof(path), "%s/devices/system/node/node%d/cpulist", root, media->numanode);
+         if(media->numanode >= 0 && (fp = fopen(path, "r")) != NULL)
+         {
+            if(fgets(media->numacpus, sizeof(media->numacpus), fp) == NULL)
+               media->numacpus[0] = '\0';
+            media->numacpus[strcspn(media->numacpus, " \n")] = '\0';
+            fclose(fp);
+         }
+
+         snprintf(media->host, sizeof(media->host), "%s", device + rootlen);
+         return;
+      }
+      *slash = '\0';
+   }
+
+   /* No PCI parent, the device itself is the host */
+   snprintf(path, sizeof(path), "%s/block/%s/device", root, name);
+   if(realpath(path, device) != NULL && strlen(device) > rootlen)
+      snprintf(media->host, sizeof(media->host), "%s", device + rootlen);
+}
+
+/* Fill in everything sysfs knows about one block device.  Returns 0 when
+ * it is a disk worth wiping. */
+int sysfs_media(const char *root, const char *name, media_t *media)
+{
+   char path[PATH_MAX];
+   char *p;
+
+   memset(media, 0, sizeof(media_t));
+   media->usable = !USABLE_MEDIA;
+
+   /* Virtual devices (loop, ram, zram, dm, md) have no device link */
+   snprintf(path, sizeof(path), "%s/block/%s/device", root, name);
+   if(access(path, F_OK) != 0)
+      return 1;
+
+   /* Optical drives and floppies */
+   if(strncmp(name, "sr", 2) == 0 || strncmp(name, "fd", 2) == 0)
+      return 1;
+
+   if(sysfs_u64(root, name, "ro", 0) != 0)
+      return 1;
+
+   /* The size is always in 512 byte units, whatever the sector size */
+   media->size = sysfs_u64(root, name, "size", 0) * 512;
+   if(media->size == 0)
+      return 1;
+
+   /* Slashes in kernel names are '!' in sysfs, and udev puts those
+    * devices in a subdirectory: cciss!c0d0 is /dev/cciss/c0d0 */
+   snprintf(media->name, sizeof(media->name), "/dev/%s", name);
+   snprintf(media->nameshort, sizeof(media->nameshort), "%s", name);
+   for(p = media->name; (p = strchr(p, '!')) != NULL; p++)
+      *p = '/';
+
+   media->lsector = (uint32_t)sysfs_u64(root, name, "queue/logical_block_size", 512);
+   media->psector = (uint32_t)sysfs_u64(root, name, "queue/physical_block_size", media->lsector);
+   media->rotational = sysfs_u64(root, name, "queue/rotational", 1) != 0;
+   media->queuedepth = (int32_t)sysfs_u64(root, name, "queue/nr_requests", 0);
+   media->discardmax = sysfs_u64(root, name, "queue/discard_max_bytes", 0);
+   media->discardgran = (uint32_t)sysfs_u64(root, name, "queue/discard_granularity", 0);
+   media->zeroesmax = sysfs_u64(root, name, "queue/write_zeroes_max_bytes", 0);
+
+   sysfs_read(root, name, "device/model", media->model, sizeof(media->model));
+   if(sysfs_read(root, name, "device/serial", media->serial, sizeof(media->serial)) != 0)
+      sysfs_read(root, name, "serial", media->serial, sizeof(media->serial));
+
+   /* The identity string the FreeBSD side gets from DIOCGIDENT */
+   snprintf(media->ident, sizeof(media->ident), "%s%s%s", media->model,
+         media->model[0] && media->serial[0] ? " " : "", media->serial);
+
+   sysfs_host(root, name, media);
+
+   media->usable = USABLE_MEDIA;
+   return 0;
+}
+
+/* Shorter names first, so sdz comes before sdaa */
+static int sysfs_order(const struct dirent **a, const struct dirent **b)
+{
+   size_t la = strlen((*a)->d_name);
+   size_t lb = strlen((*b)->d_name);
+
+   if(la != lb)
+      return la < lb ? -1 : 1;
+   return strcmp((*a)->d_name, (*b)->d_name);
+}
+
+static int sysfs_visible(const struct dirent *entry)
+{
+   return entry->d_name[0] != '.';
+}
+
+/* Collect up to max disks from <root>/block.  Returns how many were found,
+ * or -1 when the directory can not be read. */
+int32_t sysfs_scan(const char *root, media_t devices[], int32_t max)
+{
+   char path[PATH_MAX];
+   struct dirent **list;
+   int32_t found = 0;
+   int count, i;
+
+   snprintf(path, sizeof(path), "%s/block", root);
+   if((count = scandir(path, &list, sysfs_visible, sysfs_order)) < 0)
+      return -1;
+
+   for(i = 0; i < count; i++)
+   {
+      if(found < max && sysfs_media(root, list[i]->d_name, &devices[found]) == 0)
+         found++;
+      free(list[i]);
+   }
+   free(list);
+
+   return found;
+}
@@ -0,0 +1,691 @@
+/**
+ *  NetNuke - Erases all storage media deteced by the system
+ *  Copyright (C) 2009  Joseph Hunkeler <jhunkeler@gmail.com, jhunk@stsci.edu>
+ *
+ *  This file is part of NetNuke.
+ *
+ *  NetNuke is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  NetNuke is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with NetNuke.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+/*
+ * Read-back verification
+ *
+ * After a pass the device is read back in VERIFY_CHUNK sized sequential
+ * reads and compared with what the pass should have left behind.  Nothing
+ * is stored: zeros are checked directly, patterns and the fast random block
+ * are compared against one pre-tiled reference, and the seeded random and
+ * AES streams are regenerated from the offset.
+ *
+ * The read-ahead thread keeps VERIFY_BUFFERS reads ahead of the
+ * comparison so the device never waits for the CPU.  Mismatches are narrowed down to
+ * logical sectors and reported as ranges.
+ *
+ * A full read takes as long as the pass did.  Sampled verification reads
+ * a fixed number of VERIFY_REGION sized regions instead, one picked at
+ * random from each of as many equal stretches of the device, plus both
+ * ends where the partition tables live.  Random reads want a deep queue,
+ * so several readers share the list.  The number of regions, not the
+ * size of the device, decides how much of it could have been missed, and
+ * that bound is reported.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#if defined(__x86_64__) || defined(__i386__)
+   #include <immintrin.h>
+   #define VERIFY_HAVE_AVX2
+#endif
+
+#include "netnuke.h"
+
+#define VERIFY_CHUNK (4 * 1024 * 1024)
+#define VERIFY_BUFFERS 4
+/* Sampled verification reads regions this large */
+#define VERIFY_REGION (1024 * 1024)
+/* Always read at both ends: the MBR, the GPT and its backup copy */
+#define VERIFY_EDGE (1024 * 1024)
+#define VERIFY_READERS_MAX 16
+/* Confidence of the reported bound, as the chance of missing */
+#define VERIFY_MISS 0.05
+/* Mismatched ranges written to the log per pass, the rest are counted */
+#define VERIFY_RANGES_LOGGED 32
+
+typedef struct VERIFY_T
+{
+   nukejob_t *job;
+   int32_t pass;
+   int32_t percent;            /* Of the chunks read back */
+   uint64_t nchunks;
+
+   char *ref;                  /* Pre-tiled expected data, or NULL */
+   uint64_t period;
+   char *expect;               /* Regenerated expected data */
+
+   uint64_t badstart, badend;  /* Open mismatch range */
+   uint64_t mismatched;
+   uint32_t ranges;
+   double unwiped;             /* Bound of a sampled verification */
+   int32_t regions;            /* Regions it read, the ends too */
+   int32_t failed;             /* Of them mismatched */
+} verify_t;
+
+typedef struct VERIFYREGION_T
+{
+   uint64_t offset;
+   uint64_t length;
+} verifyregion_t;
+
+/* The regions of a sampled verification and the readers going through them */
+typedef struct VERIFYSAMPLE_T
+{
+   verify_t *v;
+   verifyregion_t *regions;
+   int32_t count;
+   int32_t random;             /* Regions before this one are the ends */
+   int32_t next;               /* Region to read next, atomic */
+   int32_t started;            /* Readers that took their buffers, atomic */
+   char *pool;                 /* Read and expected buffer of every reader */
+   int fd;
+   int fdbuffered;             /* For what a direct read refuses, or -1 */
+   uint64_t checked;           /* Atomic */
+   int32_t bad;                /* Regions that mismatched, the ends too */
+   pthread_mutex_t lock;       /* Around the mismatch ranges */
+} verifysample_t;
+
+static bool (*verify_zero)(const char *buf, uint64_t length) = NULL;
+static const char *verify_name = "scalar";
+static pthread_once_t verify_once = PTHREAD_ONCE_INIT;
+
+static bool verify_zero_scalar(const char *buf, uint64_t length)
+{
+   uint64_t acc = 0, word, i = 0;
+
+   for(; i + 8 <= length; i += 8)
+   {
+      memcpy(&word, buf + i, sizeof(word));
+      acc |= word;
+   }
+   for(; i < length; i++)
+      acc |= (unsigned char)buf[i];
+
+   return acc == 0;
+}
+
+#ifdef VERIFY_HAVE_AVX2
+__attribute__((target("avx2")))
+static bool verify_zero_avx2(const char *buf, uint64_t length)
+{
+   __m256i acc = _mm256_setzero_si256();
+   uint64_t i = 0;
+
+   /* Four loads per test keeps the loop bound by memory bandwidth */
+   for(; i + 128 <= length; i += 128)
+   {
+      acc = _mm256_or_si256(acc, _mm256_loadu_si256((const __m256i*)(buf + i)));
+      acc = _mm256_or_si256(acc, _mm256_loadu_si256((const __m256i*)(buf + i + 32)));
+      acc = _mm256_or_si256(acc, _mm256_loadu_si256((const __m256i*)(buf + i + 64)));
+      acc = _mm256_or_si256(acc, _mm256_loadu_si256((const __m256i*)(buf + i + 96)));
+      if(!_mm256_testz_si256(acc, acc))
+         return false;
+   }
+
+   return verify_zero_scalar(buf + i, length - i);
+}
+#endif
+
+static void verify_select(void)
+{
+   verify_zero = verify_zero_scalar;
+   verify_name = "scalar";
+
+#ifdef VERIFY_HAVE_AVX2
+   __builtin_cpu_init();
+   if(__builtin_cpu_supports("avx2"))
+   {
+      verify_zero = verify_zero_avx2;
+      verify_name = "avx2";
+   }
+#endif
+
+   if(getenv("NETNUKE_VERIFY_SCALAR") != NULL)
+   {
+      verify_zero = verify_zero_scalar;
+      verify_name = "scalar";
+   }
+}
+
+const char* verify_impl(void)
+{
+   pthread_once(&verify_once, verify_select);
+   return verify_name;
+}
+
+/* Sampled verification picks chunks with a hash of the seed, the pass and
+ * the chunk number, so a rerun checks the same places.  The first and the
+ * last chunk are always read. */
+static uint64_t verify_hash(verify_t *v, uint64_t index)
+{
+   uint64_t z = v->job->seed ^ ((uint64_t)v->pass << 48) ^ (index * 0x9E3779B97F4A7C15ULL);
+
+   z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+   z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+   return z ^ (z >> 31);
+}
+
+static bool verify_sampled(void *arg, uint64_t chunk)
+{
+   verify_t *v = (verify_t*)arg;
+
+   if(v->percent >= 100 || chunk == 0 || chunk == v->nchunks - 1)
+      return true;
+
+   return verify_hash(v, chunk) % 100 < (uint64_t)v->percent;
+}
+
+/* Close the open mismatch range and report it */
+static void verify_flush(verify_t *v)
+{
+   uint64_t length = v->badend - v->badstart;
+
+   if(length == 0)
+      return;
+
+   v->mismatched += length;
+   v->ranges++;
+
+   if(v->ranges <= VERIFY_RANGES_LOGGED)
+   {
+      lwrite("%s: pass %d verify mismatch at bytes %ju-%ju (%ju bytes)\n", v->job->target, v->pass,
+            (uintmax_t)v->badstart, (uintmax_t)v->badend - 1, (uintmax_t)length);
+      if(v->job->verbose)
+         fprintf(stderr, "%s: pass %d verify mismatch at bytes %ju-%ju (%ju bytes)\n", v->job->target, v->pass,
+               (uintmax_t)v->badstart, (uintmax_t)v->badend - 1, (uintmax_t)length);
+   }
+   else if(v->ranges == VERIFY_RANGES_LOGGED + 1)
+      lwrite("%s: pass %d further mismatches are counted but not logged\n", v->job->target, v->pass);
+
+   v->badstart = v->badend = 0;
+}
+
+static void verify_bad(verify_t *v, uint64_t offset, uint64_t length)
+{
+   if(v->badend != v->badstart && v->badend == offset)
+   {
+      v->badend += length;
+      return;
+   }
+
+   verify_flush(v);
+   v->badstart = offset;
+   v->badend = offset + length;
+}
+
+/* Compare one piece of the device with what should be there */
+static bool verify_same(const char *buf, const char *expect, uint64_t length)
+{
+   if(expect == NULL)
+      return verify_zero(buf, length);
+   return memcmp(buf, expect, length) == 0;
+}
+
+/* The comparison a pass is verified with, expect NULL checks for zeros */
+bool verify_match(const char *buf, const char *expect, uint64_t length)
+{
+   pthread_once(&verify_once, verify_select);
+   return verify_same(buf, expect, length);
+}
+
+/* What the pass left at offset, regenerated into scratch when it has to
+ * be.  NULL stands for zeros. */
+static const char* verify_expected(verify_t *v, char *scratch, uint64_t offset, uint64_t length)
+{
+   nukejob_t *job = v->job;
+
+   if(v->ref != NULL)
+      return v->ref + offset % v->period;
+   if(job->nukelevel == NUKE_RANDOM_SLOW || job->nukelevel == NUKE_REWRITE)
+   {
+      rng_fill(&job->rng, scratch, length, offset);
+      return scratch;
+   }
+   if(job->nukelevel == NUKE_RANDOM_CRYPTO)
+   {
+      aes_fill(&job->aes, scratch, length, offset);
+      return scratch;
+   }
+   return NULL;
+}
+
+/* Narrow a piece that did not match down to the sectors that differ */
+static void verify_sectors(verify_t *v, const char *buf, const char *expect, uint64_t offset, uint64_t length)
+{
+   uint64_t sector = v->job->lsector ? v->job->lsector : 512;
+   uint64_t i;
+
+   for(i = 0; i < length; i += sector)
+   {
+      uint64_t piece = length - i < sector ? length - i : sector;
+
+      if(!verify_same(buf + i, expect ? expect + i : NULL, piece))
+         verify_bad(v, offset + i, piece);
+   }
+}
+
+static void verify_chunk(verify_t *v, rachunk_t *chunk)
+{
+   nukejob_t *job = v->job;
+   const char *expect;
+
+   if(chunk->error != 0)
+   {
+      lwrite("%s: pass %d verify read failed at byte %ju: %s\n", job->target, v->pass,
+            (uintmax_t)chunk->offset, strerror(chunk->error));
+      job->error = chunk->error;
+      verify_bad(v, chunk->offset, chunk->length);
+      return;
+   }
+
+   expect = verify_expected(v, v->expect, chunk->offset, chunk->length);
+
+   /* The whole chunk matches almost every time */
+   if(verify_same(chunk->buf, expect, chunk->length))
+      return;
+
+   verify_sectors(v, chunk->buf, expect, chunk->offset, chunk->length);
+}
+
+/* Build the reference the tiled levels are compared against.  Any chunk
+ * offset is at phase offset % period of it. */
+static int verify_reference(verify_t *v)
+{
+   nukejob_t *job = v->job;
+   char *tile = NULL;
+
+   if(job_zeroes(job))
+      return 0;
+
+   if(job->nukelevel == NUKE_RANDOM_SLOW || job->nukelevel == NUKE_RANDOM_CRYPTO
+         || job->nukelevel == NUKE_REWRITE)
+      return posix_memalign((void**)&v->expect, 4096, VERIFY_CHUNK);
+
+   if(job->nukelevel == NUKE_RANDOM_FAST)
+   {
+      v->period = job->blocksize;
+      if((tile = (char*)malloc(v->period)) == NULL)
+         return ENOMEM;
+      rng_fill(&job->rng, tile, v->period, 0);
+   }
+   else
+      v->period = job->tile.length;
+
+   if(posix_memalign((void**)&v->ref, 4096, VERIFY_CHUNK + v->period) != 0)
+   {
+      free(tile);
+      return ENOMEM;
+   }
+
+   pattern_fill(tile ? (const uint8_t*)tile : job->tile.bytes, v->period, v->ref, VERIFY_CHUNK + v->period, 0);
+   free(tile);
+   return 0;
+}
+
+/* Read every chunk verify_sampled() wants, in order.  Returns 0 when it
+ * could be read at all. */
+static int verify_sequential(verify_t *v, uint64_t *checked)
+{
+   nukejob_t *job = v->job;
+   readahead_t *ra;
+   rachunk_t *chunk;
+   char *pool;
+
+   if((pool = (char*)numa_alloc((uint64_t)VERIFY_BUFFERS * VERIFY_CHUNK)) == NULL)
+   {
+      job->error = ENOMEM;
+      lwrite("%s: Could not allocate verification buffers\n", job->target);
+      fprintf(stderr, "%s: Could not allocate verification buffers\n", job->target);
+      return 1;
+   }
+
+   if((ra = readahead_open(job, pool, VERIFY_BUFFERS, VERIFY_CHUNK, verify_sampled, v)) == NULL)
+   {
+      job->error = errno;
+      lwrite("%s: Could not open for verification: %s\n", job->target, strerror(errno));
+      fprintf(stderr, "%s: Could not open for verification: %s\n", job->target, strerror(errno));
+      numa_free(pool, (uint64_t)VERIFY_BUFFERS * VERIFY_CHUNK);
+      return 1;
+   }
+
+   while(!job->skip && (chunk = readahead_next(ra)) != NULL)
+   {
+      verify_chunk(v, chunk);
+      *checked += chunk->length;
+      readahead_release(ra);
+   }
+
+   readahead_close(ra);
+   numa_free(pool, (uint64_t)VERIFY_BUFFERS * VERIFY_CHUNK);
+   return 0;
+}
+
+/* Read a whole region, through the page cache when a direct read is refused */
+static int verify_read(verifysample_t *s, char *buf, uint64_t offset, uint64_t length)
+{
+   uint64_t done = 0;
+   int fd = s->fd;
+
+   while(done < length)
+   {
+      ssize_t result = pread(fd, buf + done, length - done, offset + done);
+
+      if(result < 0 && errno == EINVAL && fd == s->fd && s->fdbuffered >= 0)
+      {
+         fd = s->fdbuffered;
+         continue;
+      }
+      if(result == 0)
+      {
+         memset(buf + done, 0, length - done);
+         break;
+      }
+      if(result < 0)
+         return errno;
+
+      done += result;
+   }
+
+   return 0;
+}
+
+static void* verify_reader(void *arg)
+{
+   verifysample_t *s = (verifysample_t*)arg;
+   verify_t *v = s->v;
+   nukejob_t *job = v->job;
+   int32_t me = __atomic_fetch_add(&s->started, 1, __ATOMIC_RELAXED);
+   char *buf = s->pool + (size_t)me * 2 * VERIFY_REGION;
+   char *scratch = buf + VERIFY_REGION;
+   int32_t i;
+
+   while(!job->skip && (i = __atomic_fetch_add(&s->next, 1, __ATOMIC_RELAXED)) < s->count)
+   {
+      verifyregion_t *region = &s->regions[i];
+      const char *expect = NULL;
+      int error;
+
+      __atomic_add_fetch(&s->checked, region->length, __ATOMIC_RELAXED);
+      if((error = verify_read(s, buf, region->offset, region->length)) == 0)
+      {
+         expect = verify_expected(v, scratch, region->offset, region->length);
+         if(verify_same(buf, expect, region->length))
+            continue;
+      }
+
+      /* Ranges are only ever open inside one region */
+      pthread_mutex_lock(&s->lock);
+      if(error != 0)
+      {
+         lwrite("%s: pass %d verify read failed at byte %ju: %s\n", job->target, v->pass,
+               (uintmax_t)region->offset, strerror(error));
+         job->error = error;
+         verify_bad(v, region->offset, region->length);
+      }
+      else
+         verify_sectors(v, buf, expect, region->offset, region->length);
+      verify_flush(v);
+      s->bad++;
+      pthread_mutex_unlock(&s->lock);
+   }
+
+   return NULL;
+}
+
+/* The largest part of the device that n regions, each picked uniformly
+ * from its own stretch, miss entirely with a chance of VERIFY_MISS.  One
+ * pick per stretch never misses more often than n independent picks,
+ * so this is the bound for (1 - p)^n = VERIFY_MISS. */
+static double verify_bound(int32_t n)
+{
+   double low = 0, high = 1;
+   int i;
+
+   for(i = 0; i < 64; i++)
+   {
+      double p = (low + high) / 2;
+      double base = 1 - p, miss = 1;
+      int32_t e;
+
+      for(e = n; e > 0; e >>= 1)
+      {
+         if(e & 1)
+            miss *= base;
+         base *= base;
+      }
+
+      if(miss > VERIFY_MISS)
+         low = p;
+      else
+         high = p;
+   }
+
+   return high;
+}
+
+/* Start of the end of the device the backup partition table is in */
+static uint64_t verify_tail(nukejob_t *job)
+{
+   uint64_t sector = job->lsector ? job->lsector : 512;
+
+   if(job->size < VERIFY_EDGE)
+      return 0;
+   return (job->size - VERIFY_EDGE) / sector * sector;
+}
+
+/* Whole regions between the two ends, where the samples are picked from */
+static uint64_t verify_interior(nukejob_t *job)
+{
+   uint64_t tail = verify_tail(job);
+
+   return tail > VERIFY_EDGE ? (tail - VERIFY_EDGE) / VERIFY_REGION : 0;
+}
+
+/* Read job->samples random regions and both ends of the device with up to
+ * a queue depth of readers.  Returns 0 when it could be read at all. */
+static int verify_regions(verify_t *v, uint64_t *checked)
+{
+   nukejob_t *job = v->job;
+   verifysample_t s;
+   pthread_t threads[VERIFY_READERS_MAX];
+   uint64_t nregions = verify_interior(job);
+   int32_t readers, started = 0, i;
+   int error = 0;
+
+   memset(&s, 0, sizeof(verifysample_t));
+   s.v = v;
+   s.fdbuffered = -1;
+   s.count = job->samples + 2;
+   s.random = 2;
+
+   readers = job->qdepth;
+   if(readers > VERIFY_READERS_MAX)
+      readers = VERIFY_READERS_MAX;
+   if(readers > s.count)
+      readers = s.count;
+   if(readers < 1)
+      readers = 1;
+
+   s.regions = (verifyregion_t*)calloc(s.count, sizeof(verifyregion_t));
+   s.pool = (char*)numa_alloc((uint64_t)readers * 2 * VERIFY_REGION);
+   if(s.regions == NULL || s.pool == NULL)
+   {
+      job->error = ENOMEM;
+      lwrite("%s: Could not allocate verification buffers\n", job->target);
+      fprintf(stderr, "%s: Could not allocate verification buffers\n", job->target);
+      free(s.regions);
+      numa_free(s.pool, (uint64_t)readers * 2 * VERIFY_REGION);
+      return 1;
+   }
+
+   /* Both ends, then one region from every stretch in between in device
+    * order.  The ends are read whole, the bound is for the rest. */
+   s.regions[0].offset = 0;
+   s.regions[0].length = VERIFY_EDGE;
+   s.regions[1].offset = verify_tail(job);
+   s.regions[1].length = job->size - s.regions[1].offset;
+   for(i = 0; i < job->samples; i++)
+   {
+      uint64_t low = (uint64_t)i * nregions / job->samples;
+      uint64_t high = (uint64_t)(i + 1) * nregions / job->samples;
+
+      s.regions[s.random + i].offset = VERIFY_EDGE + (low + verify_hash(v, i) % (high - low)) * VERIFY_REGION;
+      s.regions[s.random + i].length = VERIFY_REGION;
+   }
+
+   /* Read the media, not the page cache */
+   s.fd = open(job->target, O_RDONLY | (job->oflags & O_DIRECT));
+   if(s.fd < 0 && errno == EINVAL && (job->oflags & O_DIRECT))
+      s.fd = open(job->target, O_RDONLY);
+   else if(s.fd >= 0 && (job->oflags & O_DIRECT))
+      s.fdbuffered = open(job->target, O_RDONLY);
+   if(s.fd < 0)
+   {
+      job->error = errno;
+      lwrite("%s: Could not open for verification: %s\n", job->target, strerror(errno));
+      fprintf(stderr, "%s: Could not open for verification: %s\n", job->target, strerror(errno));
+      free(s.regions);
+      numa_free(s.pool, (uint64_t)readers * 2 * VERIFY_REGION);
+      return 1;
+   }
+#ifdef POSIX_FADV_DONTNEED
+   posix_fadvise(s.fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+
+   pthread_mutex_init(&s.lock, NULL);
+   for(i = 0; i < readers; i++)
+   {
+      if((error = pthread_create(&threads[i], NULL, verify_reader, &s)) != 0)
+         break;
+      started++;
+   }
+
+   /* Without a thread of its own the worker reads them itself */
+   if(started == 0)
+      verify_reader(&s);
+   for(i = 0; i < started; i++)
+      pthread_join(threads[i], NULL);
+   pthread_mutex_destroy(&s.lock);
+
+   /* Counts always take in both ends, the same as the summary */
+   if(!job->skip && s.bad > 0)
+      lwrite("%s: pass %d sampled %d regions (both ends and %d of %ju picked at random) with %d reader(s), "
+            "no bound: %d of the %d regions mismatched\n", job->target, v->pass, s.count, job->samples,
+            (uintmax_t)nregions, started ? started : 1, s.bad, s.count);
+   else if(!job->skip)
+   {
+      v->unwiped = verify_bound(job->samples);
+      lwrite("%s: pass %d sampled %d regions (both ends and %d of %ju picked at random) with %d reader(s), "
+            "at %d%% confidence at most %.4f%% between the ends differs\n", job->target, v->pass, s.count,
+            job->samples, (uintmax_t)nregions, started ? started : 1,
+            (int)(100 - VERIFY_MISS * 100), v->unwiped * 100);
+   }
+
+   v->regions = job->skip ? 0 : s.count;
+   v->failed = s.bad;
+   *checked += s.checked;
+   if(s.fdbuffered >= 0)
+      close(s.fdbuffered);
+   close(s.fd);
+   free(s.regions);
+   numa_free(s.pool, (uint64_t)readers * 2 * VERIFY_REGION);
+   return 0;
+}
+
+/* Read back percent of what the last pass wrote, or the regions of a
+ * sampled verification.  Returns 0 when everything that was read
+ * matched. */
+int verify_pass(nukejob_t *job, int32_t pass, int32_t percent)
+{
+   verify_t v;
+   uint64_t checked = 0;
+   bool sampled;
+   int error;
+
+   pthread_once(&verify_once, verify_select);
+
+   memset(&v, 0, sizeof(verify_t));
+   v.job = job;
+   v.pass = pass;
+   v.percent = percent;
+   v.nchunks = (job->size + VERIFY_CHUNK - 1) / VERIFY_CHUNK;
+
+   if(job->size == 0)
+      return 0;
+
+   /* Sampling as much as the whole device is reading all of it */
+   sampled = percent < 100 && job->samples > 0 && (uint64_t)job->samples < verify_interior(job);
+   if(!sampled && percent == 0)
+      v.percent = 100;
+
+   if(sampled)
+      lwrite("Verifying %s pass %d, %d regions sampled\n", job->target, pass, job->samples);
+   else if(v.percent < 100)
+      lwrite("Verifying %s pass %d, %d%% sampled\n", job->target, pass, v.percent);
+   else
+      lwrite("Verifying %s pass %d\n", job->target, pass);
+   if(job->verbose)
+      printf("Verifying %s pass %d\n", job->target, pass);
+
+   if((error = verify_reference(&v)) != 0)
+   {
+      job->error = error;
+      lwrite("%s: Could not allocate verification buffers\n", job->target);
+      fprintf(stderr, "%s: Could not allocate verification buffers\n", job->target);
+      return 1;
+   }
+
+   error = sampled ? verify_regions(&v, &checked) : verify_sequential(&v, &checked);
+   free(v.ref);
+   free(v.expect);
+   if(error != 0)
+      return 1;
+
+   verify_flush(&v);
+   job->verified += checked;
+   job->mismatched += v.mismatched;
+   job->badranges += v.ranges;
+   job->unwiped = v.unwiped;
+   job->sampled = v.regions;
+   job->sampledbad = v.failed;
+
+   lwrite("%s: pass %d verified %ju bytes, %ju mismatched in %u range(s)\n", job->target, pass,
+         (uintmax_t)checked, (uintmax_t)v.mismatched, v.ranges);
+   if(v.mismatched > 0)
+   {
+      fprintf(stderr, "%s: pass %d verification found %ju mismatched bytes in %u range(s)\n", job->target, pass,
+            (uintmax_t)v.mismatched, v.ranges);
+      if(job->error == 0)
+         job->error = EIO;
+      return 1;
+   }
+
+   return 0;
+}